@@ -0,0 +1,239 @@
+/* Tokenizes many independent streams on one thread with coro_sched and on
+ * one thread per stream, and prints how long each took.
+ *
+ *      bench_sched [streams] [window]
+ *
+ * Every stream is a copy of the same generated document served window bytes
+ * at a time. After each window the input "runs dry" once: a scheduled stream
+ * gets JSON_FILL_AGAIN and waits until the event loop wakes it, a threaded
+ * one yields the processor as a thread blocked on a socket would. */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "coro_sched.h"
+#include "json.h"
+
+#define BENCH_DOC_SIZE (16 * 1024)
+
+struct bench_stream {
+	const char *text;
+	size_t length;
+	size_t at;
+	size_t window;
+	int dry;
+	int threaded;
+	size_t tokens;
+	struct json_tokenizer_t t;
+	struct coro_task_t task;
+	struct bench_stream *next_pending;
+};
+
+static struct bench_stream *pending;
+
+static int bench_fill(struct bench_stream *s, const char **begin, const char **end)
+{
+	size_t n;
+
+	if (s->at == s->length)
+		return EOF;
+
+	if (s->dry) {
+		s->dry = 0;
+
+		if (!s->threaded) {
+			s->next_pending = pending;
+			pending = s;
+			return JSON_FILL_AGAIN;
+		}
+
+		sched_yield();
+	}
+
+	n = s->length - s->at < s->window ? s->length - s->at : s->window;
+	*begin = s->text + s->at;
+	*end = *begin + n;
+	s->at += n;
+	s->dry = 1;
+
+	return 0;
+}
+
+static enum coro_task_state_e bench_step(struct coro_task_t *task)
+{
+	struct bench_stream *s = task->data;
+	enum json_token_kind_e kind = json_tokenizer_next(&s->t);
+
+	if (kind == JSON_TOK_AGAIN)
+		return CORO_TASK_WAITING;
+
+	s->tokens++;
+
+	if (kind == JSON_TOK_NONE || kind == JSON_TOK_ERROR)
+		return CORO_TASK_DONE;
+
+	return CORO_TASK_RUNNABLE;
+}
+
+static void *bench_thread(void *arg)
+{
+	struct bench_stream *s = arg;
+	enum json_token_kind_e kind;
+
+	do {
+		kind = json_tokenizer_next(&s->t);
+		s->tokens++;
+	} while (kind != JSON_TOK_NONE && kind != JSON_TOK_ERROR);
+
+	return NULL;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char *bench_document(size_t *length)
+{
+	char *text = malloc(BENCH_DOC_SIZE + 256);
+	size_t n = 0;
+	int i;
+
+	for (i = 0; text && n < BENCH_DOC_SIZE; i++)
+		n += (size_t)sprintf(text + n,
+				"{\"id\": %d, \"name\": \"item %d\", \"tags\": [\"a\", \"b\"], "
+				"\"value\": %d.5e3, \"ok\": true}\n", i, i, i);
+
+	*length = n;
+
+	return text;
+}
+
+static void bench_reset(struct bench_stream *streams, size_t count, const char *text,
+		size_t length, size_t window, int threaded)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		struct bench_stream *s = &streams[i];
+
+		json_tokenizer_destroy(&s->t);
+		memset(s, 0, sizeof(*s));
+		s->text = text;
+		s->length = length;
+		s->window = window;
+		s->threaded = threaded;
+
+		if (threaded)
+			json_tokenizer_init_buffered(&s->t, s,
+					(int (*)(void *, const char **, const char **))bench_fill);
+		else
+			json_tokenizer_init_nonblocking(&s->t, s,
+					(int (*)(void *, const char **, const char **))bench_fill);
+	}
+}
+
+static size_t bench_total(const struct bench_stream *streams, size_t count)
+{
+	size_t tokens = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		tokens += streams[i].tokens;
+
+	return tokens;
+}
+
+static void bench_report(const char *name, double seconds, size_t tokens, size_t switches)
+{
+	printf("%-18s %8.3f s %12zu tokens %8.1f ns/token", name, seconds, tokens,
+			seconds * 1e9 / (double)tokens);
+
+	if (switches)
+		printf(" %8.1f ns/resume", seconds * 1e9 / (double)switches);
+
+	putchar('\n');
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_stream *streams;
+	struct bench_stream *s;
+	struct coro_sched_t sched;
+	pthread_attr_t attr;
+	pthread_t *threads;
+	size_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000;
+	size_t window = argc > 2 ? strtoull(argv[2], NULL, 10) : 256;
+	size_t length;
+	size_t switches = 0;
+	size_t started;
+	size_t i;
+	char *text;
+	double start;
+
+	if (!count || !window || !(text = bench_document(&length)))
+		return 2;
+
+	streams = calloc(count, sizeof(*streams));
+	threads = calloc(count, sizeof(*threads));
+
+	if (!streams || !threads)
+		return 1;
+
+	printf("%zu streams of %zu bytes, %zu byte windows\n", count, length, window);
+
+	bench_reset(streams, count, text, length, window, 0);
+	coro_sched_init(&sched, 0);
+	start = bench_now();
+
+	for (i = 0; i < count; i++)
+		coro_sched_add(&sched, &streams[i].task, bench_step, &streams[i], 0);
+
+	while (sched.runnable) {
+		while (sched.runnable)
+			switches += coro_sched_run_once(&sched);
+
+		/* The input every waiting stream asked for has arrived. */
+		for (s = pending, pending = NULL; s; s = s->next_pending)
+			coro_sched_wake(&sched, &s->task);
+	}
+
+	bench_report("coro_sched", bench_now() - start, bench_total(streams, count), switches);
+
+	bench_reset(streams, count, text, length, window, 1);
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 64 * 1024);
+	start = bench_now();
+
+	for (started = 0; started < count; started++)
+		if (pthread_create(&threads[started], &attr, bench_thread, &streams[started]))
+			break;
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	bench_report("thread per stream", bench_now() - start,
+			bench_total(streams, started), 0);
+
+	if (started < count)
+		printf("(only %zu threads could be started)\n", started);
+
+	pthread_attr_destroy(&attr);
+
+	for (i = 0; i < count; i++)
+		json_tokenizer_destroy(&streams[i].t);
+
+	free(threads);
+	free(streams);
+	free(text);
+
+	return 0;
+}
@@ -1,33 +1,42 @@
 #include "buf.h"
 
-#include <stdlib.h>
 #include <string.h>
 
-void buf_append_ch(char **buf, size_t *length, size_t *capacity, char c)
+int buf_append_ch(char **buf, size_t *length, size_t *capacity, char c,
+		const struct json_allocator_t *a)
 {
-	buf_ensure_capacity(buf, capacity, *length + 1);
+	int grown;
+
+	grown = buf_ensure_capacity(buf, capacity, *length + 1, a);
 	(*buf)[(*length)++] = c;
+
+	return grown;
 }
 
-void buf_append(char **buf, size_t *length, size_t *capacity, size_t size_of, const char *e)
+int buf_append(char **buf, size_t *length, size_t *capacity, size_t size_of, const char *e,
+		const struct json_allocator_t *a)
 {
 	size_t cap_in_bytes;
 	size_t needed_bytes;
+	int grown;
 
 	cap_in_bytes = *capacity * size_of;
 	needed_bytes = *length * size_of + size_of;
-	buf_ensure_capacity(buf, &cap_in_bytes, needed_bytes);
+	grown = buf_ensure_capacity(buf, &cap_in_bytes, needed_bytes, a);
 	*capacity = cap_in_bytes / size_of;
 	memcpy(*buf + *length * size_of, e, size_of);
 	*length += 1;
+
+	return grown;
 }
 
-void buf_ensure_capacity(char **buf, size_t *capacity, size_t desired_capacity)
+int buf_ensure_capacity(char **buf, size_t *capacity, size_t desired_capacity,
+		const struct json_allocator_t *a)
 {
 	size_t new_capacity;
 
 	if (desired_capacity <= *capacity)
-		return;
+		return 0;
 
 	new_capacity = *capacity;
 
@@ -37,6 +46,8 @@ void buf_ensure_capacity(char **buf, size_t *capacity, size_t desired_capacity)
 	for (; new_capacity < desired_capacity; new_capacity *= 2)
 		;
 
-	*buf = realloc(*buf, new_capacity);
+	*buf = json_realloc(a, *buf, *capacity, new_capacity);
 	*capacity = new_capacity;
+
+	return 1;
 }
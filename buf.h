@@ -3,8 +3,15 @@
 
 #include <stddef.h>
 
-void buf_append_ch(char **buf, size_t *length, size_t *capacity, char c);
-void buf_append(char **buf, size_t *length, size_t *capacity, size_t size_of, const char *e);
-void buf_ensure_capacity(char **buf, size_t *capacity, size_t desired_capacity);
+#include "json_alloc.h"
+
+/* All three return nonzero if the buffer had to be reallocated. Memory comes
+ * from the allocator a, or from malloc if a is NULL. */
+int buf_append_ch(char **buf, size_t *length, size_t *capacity, char c,
+		const struct json_allocator_t *a);
+int buf_append(char **buf, size_t *length, size_t *capacity, size_t size_of, const char *e,
+		const struct json_allocator_t *a);
+int buf_ensure_capacity(char **buf, size_t *capacity, size_t desired_capacity,
+		const struct json_allocator_t *a);
 
 #endif // GRAMAS_BUF_H
@@ -0,0 +1,132 @@
+#include "coro_sched.h"
+
+#include <string.h>
+
+static void cs_push(struct coro_sched_t *s, struct coro_task_t *task)
+{
+	unsigned p = task->priority;
+
+	task->next = NULL;
+	task->queued = 1;
+
+	if (s->tail[p])
+		s->tail[p]->next = task;
+	else
+		s->head[p] = task;
+
+	s->tail[p] = task;
+	s->runnable++;
+}
+
+static struct coro_task_t *cs_pop(struct coro_sched_t *s)
+{
+	struct coro_task_t *task;
+	unsigned p;
+
+	for (p = 0; p < CORO_SCHED_PRIORITIES; p++) {
+		if (!(task = s->head[p]))
+			continue;
+
+		if (!(s->head[p] = task->next))
+			s->tail[p] = NULL;
+
+		task->queued = 0;
+		s->runnable--;
+
+		return task;
+	}
+
+	return NULL;
+}
+
+void coro_sched_init(struct coro_sched_t *s, size_t batch)
+{
+	memset(s, 0, sizeof(*s));
+	s->batch = batch ? batch : CORO_SCHED_DEFAULT_BATCH;
+}
+
+void coro_sched_add(struct coro_sched_t *s, struct coro_task_t *task,
+		enum coro_task_state_e (*step)(struct coro_task_t *), void *data,
+		unsigned priority)
+{
+	task->step = step;
+	task->data = data;
+	task->priority = priority < CORO_SCHED_PRIORITIES
+		? priority : CORO_SCHED_PRIORITIES - 1;
+	task->state = CORO_TASK_RUNNABLE;
+	cs_push(s, task);
+}
+
+void coro_sched_wake(struct coro_sched_t *s, struct coro_task_t *task)
+{
+	if (task->state != CORO_TASK_WAITING)
+		return;
+
+	task->state = CORO_TASK_RUNNABLE;
+	s->waiting--;
+
+	if (!task->queued)
+		cs_push(s, task);
+}
+
+void coro_sched_cancel(struct coro_sched_t *s, struct coro_task_t *task)
+{
+	struct coro_task_t **at;
+	struct coro_task_t *prev = NULL;
+	unsigned p = task->priority;
+
+	if (task->state == CORO_TASK_WAITING)
+		s->waiting--;
+
+	for (at = &s->head[p]; task->queued && *at; prev = *at, at = &(*at)->next) {
+		if (*at != task)
+			continue;
+
+		*at = task->next;
+
+		if (s->tail[p] == task)
+			s->tail[p] = prev;
+
+		task->queued = 0;
+		s->runnable--;
+	}
+
+	task->state = CORO_TASK_DONE;
+}
+
+/* Resumes the task until it stops being runnable or its batch runs out. */
+static size_t cs_resume(struct coro_sched_t *s, struct coro_task_t *task)
+{
+	size_t n = 0;
+
+	while (n < s->batch && (task->state = task->step(task)) == CORO_TASK_RUNNABLE)
+		n++;
+
+	if (task->state == CORO_TASK_RUNNABLE)
+		cs_push(s, task);
+	else if (task->state == CORO_TASK_WAITING)
+		s->waiting++;
+
+	return n + (n < s->batch);
+}
+
+size_t coro_sched_run_once(struct coro_sched_t *s)
+{
+	struct coro_task_t *task;
+	size_t turns = s->runnable;
+	size_t n = 0;
+
+	/* Tasks pushed back during this pass wait for the next one. */
+	while (turns-- && (task = cs_pop(s)))
+		n += cs_resume(s, task);
+
+	return n;
+}
+
+size_t coro_sched_run(struct coro_sched_t *s)
+{
+	while (s->runnable)
+		coro_sched_run_once(s);
+
+	return s->waiting;
+}
@@ -0,0 +1,79 @@
+#ifndef GRAMAS_CORO_SCHED_H
+#define GRAMAS_CORO_SCHED_H
+
+#include <stddef.h>
+
+/* A run queue for coroutines, so one thread can keep thousands of them going
+ * instead of the caller resuming each by hand. A task is a step function that
+ * resumes its coroutine once and says what it is waiting for next:
+ *
+ *      static enum coro_task_state_e step(struct coro_task_t *task)
+ *      {
+ *          struct stream *s = task->data;
+ *
+ *          switch (json_tokenizer_next(&s->t)) {
+ *          case JSON_TOK_AGAIN: return CORO_TASK_WAITING;
+ *          case JSON_TOK_NONE:
+ *          case JSON_TOK_ERROR: return CORO_TASK_DONE;
+ *          default: handle(s); return CORO_TASK_RUNNABLE;
+ *          }
+ *      }
+ *
+ *      coro_sched_add(&s, &stream->task, step, stream, 0);
+ *      coro_sched_run(&s);
+ *
+ * Runnable tasks are taken round-robin from the highest priority queue that
+ * has any, and each is resumed up to batch times in a row before moving on so
+ * that its state stays in cache. A waiting task is left alone until
+ * coro_sched_wake() is called on it. */
+
+#define CORO_SCHED_PRIORITIES 4
+#define CORO_SCHED_DEFAULT_BATCH 64
+
+enum coro_task_state_e {
+	CORO_TASK_RUNNABLE,
+	CORO_TASK_WAITING,
+	CORO_TASK_DONE
+};
+
+struct coro_task_t {
+	enum coro_task_state_e (*step)(struct coro_task_t *task);
+	void *data;
+	unsigned priority;
+	enum coro_task_state_e state;
+	int queued;
+	struct coro_task_t *next;
+};
+
+struct coro_sched_t {
+	struct coro_task_t *head[CORO_SCHED_PRIORITIES];
+	struct coro_task_t *tail[CORO_SCHED_PRIORITIES];
+	size_t batch;
+	size_t runnable;
+	size_t waiting;
+};
+
+/* batch may be 0 for CORO_SCHED_DEFAULT_BATCH. */
+void coro_sched_init(struct coro_sched_t *s, size_t batch);
+
+/* Registers a runnable task. Priority 0 runs first; larger values are
+ * clamped to the lowest priority. */
+void coro_sched_add(struct coro_sched_t *s, struct coro_task_t *task,
+		enum coro_task_state_e (*step)(struct coro_task_t *), void *data,
+		unsigned priority);
+
+/* Makes a waiting task runnable again. Does nothing to any other task, so it
+ * must not be called from the task's own step function. */
+void coro_sched_wake(struct coro_sched_t *s, struct coro_task_t *task);
+
+/* Takes the task off the scheduler and marks it done. */
+void coro_sched_cancel(struct coro_sched_t *s, struct coro_task_t *task);
+
+/* Dispatches as many turns as there are tasks runnable on entry, highest
+ * priority first. Returns the number of resumptions made. */
+size_t coro_sched_run_once(struct coro_sched_t *s);
+
+/* Runs until no task is runnable. Returns the number of tasks left waiting. */
+size_t coro_sched_run(struct coro_sched_t *s);
+
+#endif /* GRAMAS_CORO_SCHED_H */
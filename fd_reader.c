@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fd_reader.h"
+
+#define FD_READER_ALIGNMENT 4096
+
+static void fd_reader_tune(struct fd_reader *f)
+{
+	struct stat st;
+
+	if (fstat(f->fd, &st))
+		return;
+
+	if (S_ISREG(st.st_mode)) {
+		posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	} else if (S_ISFIFO(st.st_mode)) {
+#ifdef F_SETPIPE_SZ
+		/* Only a hint: unprivileged processes are capped by
+		 * /proc/sys/fs/pipe-max-size. A small buffer size never shrinks
+		 * the pipe below what it already holds. */
+		if (f->bufsize <= INT_MAX && fcntl(f->fd, F_GETPIPE_SZ) < (int)f->bufsize)
+			fcntl(f->fd, F_SETPIPE_SZ, (int)f->bufsize);
+#endif
+	}
+}
+
+int fd_reader_init(struct fd_reader *f, int fd, size_t bufsize)
+{
+	void *buf;
+
+	memset(f, 0, sizeof(*f));
+	f->fd = -1;
+	f->wake_fd = -1;
+
+	if (!bufsize)
+		bufsize = FD_READER_DEFAULT_BUFSIZE;
+
+	if (posix_memalign(&buf, FD_READER_ALIGNMENT, bufsize))
+		return 1;
+
+	f->fd = fd;
+	f->buf = buf;
+	f->bufsize = bufsize;
+	fd_reader_tune(f);
+
+	return 0;
+}
+
+int fd_reader_allow_interrupt(struct fd_reader *f)
+{
+	if ((f->wake_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+		return 1;
+
+	f->interruptible = 1;
+
+	return 0;
+}
+
+void fd_reader_interrupt(struct fd_reader *f)
+{
+	uint64_t one = 1;
+
+	/* Only fails once the counter is full, which wakes the reader too. */
+	if (write(f->wake_fd, &one, sizeof(one)) < 0)
+		return;
+}
+
+/* Waits until the descriptor has something to read. Returns nonzero if
+ * fd_reader_interrupt() was called instead. */
+static int fd_reader_wait(struct fd_reader *f)
+{
+	struct pollfd fds[2] = {
+		{ .fd = f->fd, .events = POLLIN },
+		{ .fd = f->wake_fd, .events = POLLIN },
+	};
+	int n;
+
+	do {
+		n = poll(fds, 2, -1);
+	} while (n < 0 && errno == EINTR);
+
+	return n > 0 && fds[1].revents;
+}
+
+static int fd_reader_read(struct fd_reader *f)
+{
+	ssize_t n;
+
+	if (f->interruptible && fd_reader_wait(f)) {
+		f->bytes_in_buf = 0;
+		return 1;
+	}
+
+	do {
+		n = read(f->fd, f->buf, f->bufsize);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0)
+		f->error = errno;
+
+	f->bytes_in_buf = n > 0 ? (size_t)n : 0;
+
+	return f->bytes_in_buf == 0;
+}
+
+int fd_reader_next(struct fd_reader *f)
+{
+	CO_BEGIN(f->state)
+
+	for (;;) {
+		if (fd_reader_read(f))
+			break;
+
+		for (f->at = 0; f->at < f->bytes_in_buf; f->at++)
+			CO_YIELD(f->state, f->buf[f->at]);
+	}
+
+	fd_reader_destroy(f);
+	CO_RETURN(f->state, EOF);
+
+	CO_END
+}
+
+/* Hands out a whole buffer of input at a time, for
+ * json_tokenizer_init_buffered(). The reader is left for its owner to
+ * destroy, which may be interrupting it from another thread. */
+int fd_reader_fill(struct fd_reader *f, const char **begin, const char **end)
+{
+	if (f->fd < 0 || f->eof)
+		return EOF;
+
+	if (fd_reader_read(f)) {
+		f->eof = 1;
+		return EOF;
+	}
+
+	*begin = f->buf;
+	*end = f->buf + f->bytes_in_buf;
+
+	return 0;
+}
+
+int fd_reader_seek(struct fd_reader *f, off_t offset)
+{
+	if (f->fd < 0 || lseek(f->fd, offset, SEEK_SET) < 0)
+		return 1;
+
+	f->state = 0;
+	f->at = 0;
+	f->bytes_in_buf = 0;
+	f->eof = 0;
+
+	return 0;
+}
+
+void fd_reader_destroy(struct fd_reader *f)
+{
+	free(f->buf);
+	f->buf = NULL;
+	if (f->fd >= 0) close(f->fd);
+	f->fd = -1;
+
+	if (f->interruptible)
+		close(f->wake_fd);
+
+	f->interruptible = 0;
+	f->wake_fd = -1;
+}
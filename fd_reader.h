@@ -0,0 +1,51 @@
+#ifndef GRAMAS_FD_READER_H
+#define GRAMAS_FD_READER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "coro.h"
+
+/* Reads a file descriptor with read(2) straight into one page-aligned
+ * buffer, without stdio's locking and its extra copy. Regular files are
+ * advised to the kernel as read sequentially and pipes get a larger pipe
+ * buffer where the system allows it. */
+struct fd_reader {
+	coro_state_t state;
+	int fd;
+	char *buf;
+	size_t bufsize;
+	size_t at;
+	size_t bytes_in_buf;
+	/* The errno of a read that failed, or 0. The input ends there. */
+	int error;
+	int eof;
+
+	/* Set by fd_reader_allow_interrupt(). */
+	int interruptible;
+	int wake_fd;
+};
+
+#define FD_READER_DEFAULT_BUFSIZE (64 * 1024)
+
+/* bufsize may be 0 for FD_READER_DEFAULT_BUFSIZE. Returns nonzero if the
+ * buffer could not be allocated. */
+int fd_reader_init(struct fd_reader *f, int fd, size_t bufsize);
+int fd_reader_next(struct fd_reader *f);
+int fd_reader_fill(struct fd_reader *f, const char **begin, const char **end);
+
+/* Has every read first wait for the descriptor in poll(2) along with an
+ * eventfd, so that fd_reader_interrupt() can wake it. Returns nonzero if the
+ * eventfd could not be made. */
+int fd_reader_allow_interrupt(struct fd_reader *f);
+
+/* Makes the fill waiting for input, and every one after it, return EOF. May
+ * be called from any thread, until the reader is destroyed. */
+void fd_reader_interrupt(struct fd_reader *f);
+
+/* Continues reading at offset, dropping whatever was buffered. Returns
+ * nonzero if the descriptor can not seek. */
+int fd_reader_seek(struct fd_reader *f, off_t offset);
+void fd_reader_destroy(struct fd_reader *f);
+
+#endif /* GRAMAS_FD_READER_H */
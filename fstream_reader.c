@@ -1,6 +1,8 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "fstream_reader.h"
 
@@ -12,14 +14,153 @@ void fstream_init(struct fstream_reader *f, FILE *stream, size_t bufsize)
 	f->buf = malloc(bufsize);
 }
 
+static void *fstream_read_ahead(void *arg)
+{
+	struct fstream_reader *f = arg;
+	ssize_t length;
+	char *buf;
+
+	/* The thread is the stream's only reader, so it reads the descriptor
+	 * directly: fread() would hold on to a short read from a pipe until
+	 * the whole buffer is full. fstream_destroy() cancels the thread if it
+	 * is still waiting for input, which it only allows in read(). */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_mutex_lock(&f->ra_lock);
+
+	for (;;) {
+		while (!f->ra_stop && f->ra_head - f->ra_tail == f->nbuffers)
+			pthread_cond_wait(&f->ra_cond, &f->ra_lock);
+
+		if (f->ra_stop)
+			break;
+
+		buf = f->ra_buffers[f->ra_head % f->nbuffers];
+		pthread_mutex_unlock(&f->ra_lock);
+
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		do
+			length = read(fileno(f->stream), buf, f->bufsize);
+		while (length < 0 && errno == EINTR);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		pthread_mutex_lock(&f->ra_lock);
+
+		if (length <= 0) {
+			f->ra_eof = 1;
+			pthread_cond_signal(&f->ra_cond);
+			break;
+		}
+
+		f->ra_lengths[f->ra_head % f->nbuffers] = (size_t)length;
+		f->ra_head++;
+		pthread_cond_signal(&f->ra_cond);
+	}
+
+	pthread_mutex_unlock(&f->ra_lock);
+
+	return NULL;
+}
+
+int fstream_init_readahead(struct fstream_reader *f, FILE *stream,
+		size_t bufsize, size_t nbuffers)
+{
+	size_t i;
+
+	fstream_init(f, stream, bufsize);
+
+	if (nbuffers < 2)
+		return 0;
+
+	f->ra_buffers = calloc(nbuffers, sizeof(*f->ra_buffers));
+	f->ra_lengths = calloc(nbuffers, sizeof(*f->ra_lengths));
+
+	if (!f->ra_buffers || !f->ra_lengths)
+		goto err;
+
+	f->nbuffers = nbuffers;
+
+	/* The first buffer is the one fstream_init() allocated. */
+	f->ra_buffers[0] = f->buf;
+
+	for (i = 1; i < nbuffers; i++)
+		if (!(f->ra_buffers[i] = malloc(bufsize)))
+			goto err;
+
+	pthread_mutex_init(&f->ra_lock, NULL);
+	pthread_cond_init(&f->ra_cond, NULL);
+
+	if (pthread_create(&f->ra_thread, NULL, fstream_read_ahead, f)) {
+		pthread_cond_destroy(&f->ra_cond);
+		pthread_mutex_destroy(&f->ra_lock);
+		goto err;
+	}
+
+	f->readahead = 1;
+
+	return 0;
+
+err:
+	for (i = 1; f->ra_buffers && i < f->nbuffers; i++)
+		free(f->ra_buffers[i]);
+
+	free(f->ra_buffers);
+	free(f->ra_lengths);
+	f->ra_buffers = NULL;
+	f->ra_lengths = NULL;
+	f->nbuffers = 0;
+
+	return 1;
+}
+
+/* Hands the buffer being read back to the read-ahead thread and waits for
+ * the next one. The wait is not a cancellation point: a reader cancelled in
+ * it would leave ra_lock held and fstream_destroy() stuck on it. */
+static int fstream_next_buffer(struct fstream_reader *f)
+{
+	int cancel_state;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+	pthread_mutex_lock(&f->ra_lock);
+
+	if (f->ra_holding) {
+		f->ra_tail++;
+		f->ra_holding = 0;
+		pthread_cond_signal(&f->ra_cond);
+	}
+
+	while (f->ra_head == f->ra_tail && !f->ra_eof && !f->ra_interrupted)
+		pthread_cond_wait(&f->ra_cond, &f->ra_lock);
+
+	if (f->ra_head != f->ra_tail && !f->ra_interrupted) {
+		f->buf = f->ra_buffers[f->ra_tail % f->nbuffers];
+		f->bytes_in_buf = f->ra_lengths[f->ra_tail % f->nbuffers];
+		f->ra_holding = 1;
+	} else {
+		f->bytes_in_buf = 0;
+	}
+
+	pthread_mutex_unlock(&f->ra_lock);
+	pthread_setcancelstate(cancel_state, NULL);
+
+	return f->bytes_in_buf == 0;
+}
+
+static int fstream_read(struct fstream_reader *f)
+{
+	if (f->readahead)
+		return fstream_next_buffer(f);
+
+	f->bytes_in_buf = fread(f->buf, 1, f->bufsize, f->stream);
+
+	return f->bytes_in_buf == 0;
+}
+
 int fstream_next(struct fstream_reader *f)
 {
 	CO_BEGIN(f->state)
 
 	for (;;) {
-		f->bytes_in_buf = fread(f->buf, 1, f->bufsize, f->stream);
-
-		if (!f->bytes_in_buf)
+		if (fstream_read(f))
 			break;
 
 		for (f->at = 0; f->at < f->bytes_in_buf; f->at++)
@@ -32,8 +173,56 @@ int fstream_next(struct fstream_reader *f)
 	CO_END
 }
 
+/* Hands out a whole buffer of input at a time, for
+ * json_tokenizer_init_buffered(). The reader is left for its owner to
+ * destroy, which may be interrupting it from another thread. */
+int fstream_fill(struct fstream_reader *f, const char **begin, const char **end)
+{
+	if (!f->stream || fstream_read(f))
+		return EOF;
+
+	*begin = f->buf;
+	*end = f->buf + f->bytes_in_buf;
+
+	return 0;
+}
+
+void fstream_interrupt(struct fstream_reader *f)
+{
+	if (!f->readahead)
+		return;
+
+	pthread_mutex_lock(&f->ra_lock);
+	f->ra_interrupted = 1;
+	pthread_cond_broadcast(&f->ra_cond);
+	pthread_mutex_unlock(&f->ra_lock);
+}
+
 void fstream_destroy(struct fstream_reader *f)
 {
+	size_t i;
+
+	if (f->readahead) {
+		pthread_mutex_lock(&f->ra_lock);
+		f->ra_stop = 1;
+		pthread_cond_signal(&f->ra_cond);
+		pthread_mutex_unlock(&f->ra_lock);
+		pthread_cancel(f->ra_thread);
+		pthread_join(f->ra_thread, NULL);
+		pthread_cond_destroy(&f->ra_cond);
+		pthread_mutex_destroy(&f->ra_lock);
+
+		for (i = 0; i < f->nbuffers; i++)
+			free(f->ra_buffers[i]);
+
+		free(f->ra_buffers);
+		free(f->ra_lengths);
+		f->ra_buffers = NULL;
+		f->ra_lengths = NULL;
+		f->readahead = 0;
+		f->buf = NULL;
+	}
+
 	free(f->buf);
 	f->buf = NULL;
 	if (f->stream) fclose(f->stream);
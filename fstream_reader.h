@@ -1,7 +1,9 @@
 #ifndef GRAMAS_FSTREAM_READER_H
 #define GRAMAS_FSTREAM_READER_H
 
+#include <pthread.h>
 #include <stddef.h>
+#include <stdio.h>
 
 #include "coro.h"
 
@@ -12,10 +14,42 @@ struct fstream_reader {
 	size_t bufsize;
 	size_t at;
 	size_t bytes_in_buf;
+
+	/* Read-ahead: a thread keeps up to nbuffers buffers filled. The one at
+	 * ra_tail is being read from while ra_holding is set. */
+	int readahead;
+	char **ra_buffers;
+	size_t *ra_lengths;
+	size_t nbuffers;
+	size_t ra_head;
+	size_t ra_tail;
+	int ra_holding;
+	int ra_eof;
+	int ra_stop;
+	int ra_interrupted;
+	pthread_t ra_thread;
+	pthread_mutex_t ra_lock;
+	pthread_cond_t ra_cond;
 };
 
 void fstream_init(struct fstream_reader *f, FILE *stream, size_t bufsize);
+
+/* Like fstream_init(), but a background thread reads up to nbuffers buffers
+ * ahead of the consumer, each holding up to bufsize bytes of whatever one
+ * read(2) returned. Nothing else may read the stream. fstream_destroy()
+ * cancels the thread rather than waiting for a read that may never finish.
+ * Returns nonzero if the thread could not be started, leaving the reader as
+ * fstream_init() would. */
+int fstream_init_readahead(struct fstream_reader *f, FILE *stream,
+		size_t bufsize, size_t nbuffers);
+
 int fstream_next(struct fstream_reader *f);
+int fstream_fill(struct fstream_reader *f, const char **begin, const char **end);
+
+/* Makes a fill waiting for the read-ahead thread, and every one after it,
+ * return EOF. May be called from any thread, until the reader is destroyed.
+ * Without read-ahead there is nothing to wake: fread() is waited for. */
+void fstream_interrupt(struct fstream_reader *f);
 void fstream_destroy(struct fstream_reader *f);
 
 #endif /* GRAMAS_FSTREAM_READER_H */
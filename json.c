@@ -1,50 +1,148 @@
 #include "json.h"
 
 #include "buf.h"
+#include "json_internal.h"
 
 #include <ctype.h>
 #include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static inline int jt_getch(struct json_tokenizer_t *t)
+#define JT_COUNT_TOKEN(__t, __kind) JT_STAT(__t, tokens[(__kind) - JSON_TOK_ERROR]++)
+
+/* Drops the carried bytes that come before replay_from. */
+static void jt_carry_trim(struct json_tokenizer_t *t)
 {
-	int ret;
+	size_t drop;
+
+	if (t->carry_offset >= t->replay_from)
+		return;
 
-	ret = t->cs_getch(t->cs);
+	drop = t->replay_from - t->carry_offset;
 
-	if (ret == '\n') {
-		t->linenum++;
-		t->char_pos = 0;
-	} else if (ret != EOF) {
-		t->char_pos++;
+	if (drop < t->carry_length) {
+		memmove(t->carry, t->carry + drop, t->carry_length - drop);
+		t->carry_length -= drop;
+	} else {
+		t->carry_length = 0;
 	}
 
-	return ret;
+	t->carry_offset = t->replay_from;
 }
 
-static inline void jt_report_error(struct json_tokenizer_t *t)
+/* Keeps the part of the window that belongs to the token being read, from
+ * replay_from on, in case the input runs out before the token ends. */
+static void jt_carry(struct json_tokenizer_t *t)
 {
-	if (t->on_error) {
-		t->on_error(t->error_handler, t->token, t->length, t->linenum, t->char_pos);
-		t->on_error = NULL;
+	size_t from;
+	size_t length;
+
+	if (t->replay_from == SIZE_MAX) {
+		t->carry_length = 0;
+		return;
 	}
+
+	jt_carry_trim(t);
+
+	if (!t->carry_length)
+		t->carry_offset = t->replay_from;
+
+	/* A window replayed from carry is already in it. */
+	if (t->in_replay)
+		return;
+
+	from = t->carry_offset + t->carry_length - t->in_offset;
+	length = (size_t)(t->in_end - t->in_begin) - from;
+
+	buf_ensure_capacity(&t->carry, &t->carry_capacity, t->carry_length + length, t->allocator);
+	memcpy(t->carry + t->carry_length, t->in_begin + from, length);
+	t->carry_length += length;
 }
 
-static inline void jt_tok_append(struct json_tokenizer_t *t, char c)
+/* Goes back to replay_from after the input ran out in the middle of a
+ * token. */
+static void jt_rewind(struct json_tokenizer_t *t)
+{
+	jt_carry_trim(t);
+	t->starved = 0;
+	t->in_replay = 1;
+	t->in_offset = t->carry_offset;
+	t->in_begin = t->in_at = t->carry;
+	t->in_end = t->carry + t->carry_length;
+}
+
+/* Moves on to the next run of input once the current one is used up. */
+static int jt_refill(struct json_tokenizer_t *t)
+{
+	const char *begin;
+	const char *end;
+	int c;
+
+	if (t->in_begin) {
+		/* Replayed bytes were counted the first time round. */
+		if (!t->in_replay)
+			jt_count_lines(t->in_begin, t->in_end, t->in_offset,
+					&t->in_lines, &t->in_line_start);
+
+		if (t->nonblocking)
+			jt_carry(t);
+
+		t->in_offset += (size_t)(t->in_end - t->in_begin);
+		t->in_replay = 0;
+	}
+
+	if (t->cs_fill) {
+		c = t->cs_fill(t->cs, &begin, &end);
+
+		if (c == JSON_FILL_AGAIN && t->nonblocking) {
+			t->starved = 1;
+			goto eof;
+		}
+
+		if (c == EOF || begin == end)
+			goto eof;
+	} else {
+		if ((c = t->cs_getch(t->cs)) == EOF)
+			goto eof;
+
+		t->in_byte = (char)c;
+		begin = &t->in_byte;
+		end = begin + 1;
+	}
+
+	t->in_begin = begin;
+	t->in_at = begin + 1;
+	t->in_end = end;
+
+	return (unsigned char)*begin;
+
+eof:
+	t->in_begin = t->in_at = t->in_end = NULL;
+	return EOF;
+}
+
+static inline int jt_getch(struct json_tokenizer_t *t)
 {
-	buf_append_ch(&t->token, &t->length, &t->capacity, c);
+	if (t->in_at != t->in_end)
+		return (unsigned char)*t->in_at++;
+
+	return jt_refill(t);
 }
 
-static inline int jt_consume_token(struct json_tokenizer_t *t, enum json_token_kind_e kind)
+static inline int jt_tok_over_limit(struct json_tokenizer_t *t)
 {
-	if (t->kind != kind)
+	if (t->length <= t->tok_limit)
 		return 0;
 
-	json_tokenizer_next(t);
+	return jt_fail(t, t->tok_limit_error);
+}
 
-	return 1;
+static inline void jt_tok_append(struct json_tokenizer_t *t, char c)
+{
+	if (buf_append_ch(&t->token, &t->length, &t->capacity, c, t->allocator))
+		JT_STAT(t, token_reallocs++);
 }
 
 static inline int32_t jt_scan_code_unit(struct json_tokenizer_t *t)
@@ -104,9 +202,16 @@ static int utf8_write_c(int32_t c, char *str)
 	return -1;
 }
 
-static inline int jt_scan_string_char(struct json_tokenizer_t *t)
+#define JT_STRING_CHUNK 2
+
+/* Scans the contents of a string up to and including its closing quote. t->c
+ * must hold the first character not yet scanned. Returns 0 once the closing
+ * quote has been consumed and JT_STRING_CHUNK, with t->c again holding the
+ * next unscanned character, as soon as the token holds string_chunk_size
+ * bytes or more. Returns nonzero otherwise on error. */
+static inline int jt_scan_string(struct json_tokenizer_t *t)
 {
-	static const int32_t TEN_BITS = ~(~0 << 10);
+	static const int32_t TEN_BITS = ~(~0U << 10);
 
 	int32_t high_code_unit;
 	int32_t low_code_unit;
@@ -115,7 +220,7 @@ static inline int jt_scan_string_char(struct json_tokenizer_t *t)
 	int chars_written;
 	int i;
 
-	for (t->c = jt_getch(t); t->c != '"'; t->c = jt_getch(t)) {
+	while (t->c != '"') {
 		if (t->c == '\n' || t->c == '\r' || t->c == EOF)
 			return 1;
 
@@ -125,21 +230,15 @@ static inline int jt_scan_string_char(struct json_tokenizer_t *t)
 			if (t->c == '\n' || t->c == '\r' || t->c == EOF)
 				return 1;
 
-			if (t->c == 'n') { jt_tok_append(t, '\n'); }
-			else if (t->c == 'r') { jt_tok_append(t, '\r'); }
-			else if (t->c == 't') { jt_tok_append(t, '\t'); }
-			else if (t->c == 'f') { jt_tok_append(t, '\f'); }
-			else if (t->c == 'b') { jt_tok_append(t, '\b'); }
-			else if (t->c == '0') { jt_tok_append(t, '\0'); }
-			else if (t->c == 'u') {
+			if (t->c == 'u') {
 				t->c = jt_getch(t);
 
 				if ((high_code_unit = jt_scan_code_unit(t)) < 0)
 					return 1;
 
 				if ((high_code_unit & ~TEN_BITS) == 0xD800) {
-					if (t->c != '\\') return -1;
-					if ((t->c = jt_getch(t)) != 'u') return -1;
+					if (t->c != '\\') return 1;
+					if ((t->c = jt_getch(t)) != 'u') return 1;
 					t->c = jt_getch(t);
 
 					if ((low_code_unit = jt_scan_code_unit(t)) < 0)
@@ -148,7 +247,8 @@ static inline int jt_scan_string_char(struct json_tokenizer_t *t)
 					if ((low_code_unit & ~TEN_BITS) != 0xDC00)
 						return 1;
 
-					codepoint = (high_code_unit & TEN_BITS) | ((low_code_unit & TEN_BITS) << 10);
+					codepoint = 0x10000 + ((high_code_unit & TEN_BITS) << 10)
+						+ (low_code_unit & TEN_BITS);
 					chars_written = utf8_write_c(codepoint, utf8buf);
 				} else {
 					chars_written = utf8_write_c(high_code_unit, utf8buf);
@@ -159,31 +259,78 @@ static inline int jt_scan_string_char(struct json_tokenizer_t *t)
 
 				for (i = 0; i < chars_written; i++)
 					jt_tok_append(t, utf8buf[i]);
+
+				/* jt_scan_code_unit() already read past the escape. */
 			} else {
-				jt_tok_append(t, t->c);
-			};
+				if (t->c == 'n') { jt_tok_append(t, '\n'); }
+				else if (t->c == 'r') { jt_tok_append(t, '\r'); }
+				else if (t->c == 't') { jt_tok_append(t, '\t'); }
+				else if (t->c == 'f') { jt_tok_append(t, '\f'); }
+				else if (t->c == 'b') { jt_tok_append(t, '\b'); }
+				else if (t->c == '0') { jt_tok_append(t, '\0'); }
+				else { jt_tok_append(t, t->c); }
+
+				t->c = jt_getch(t);
+			}
 		} else {
 			jt_tok_append(t, t->c);
+			t->c = jt_getch(t);
 		}
+
+		/* An escape may have added up to four bytes, so this must come
+		 * before a chunk is handed out and charged against the limit. */
+		if (jt_tok_over_limit(t))
+			return 1;
+
+		if (t->length >= t->string_chunk_size)
+			return JT_STRING_CHUNK;
 	}
 
-	if (t->c == EOF)
-		return -1;
+	if (jt_tok_over_limit(t))
+		return 1;
 
-	if (t->c == '"')
-		t->c = jt_getch(t);
+	t->c = jt_getch(t);
 
 	return 0;
 }
 
+/* Returns how many of the first length bytes of s form complete UTF-8
+ * sequences, so that a string can be cut there without splitting one. */
+static size_t jt_utf8_cut(const char *s, size_t length)
+{
+	unsigned char lead;
+	size_t seq_length;
+	size_t i;
+
+	for (i = length; i > 0 && length - i < 3; i--)
+		if (((unsigned char)s[i - 1] & 0xC0) != 0x80)
+			break;
+
+	if (i == 0)
+		return length;
+
+	lead = (unsigned char)s[i - 1];
+
+	if (lead >= 0xF0) seq_length = 4;
+	else if (lead >= 0xE0) seq_length = 3;
+	else if (lead >= 0xC0) seq_length = 2;
+	else seq_length = 1;
+
+	return i - 1 + seq_length <= length ? length : i - 1;
+}
+
 static inline int jt_scan_integer(struct json_tokenizer_t *t)
 {
 	if (!isdigit(t->c))
 		return 1;
 
-	for (; isdigit(t->c); t->c = jt_getch(t))
+	for (; isdigit(t->c); t->c = jt_getch(t)) {
 		jt_tok_append(t, t->c);
 
+		if (jt_tok_over_limit(t))
+			return 1;
+	}
+
 	return 0;
 }
 
@@ -225,27 +372,111 @@ void json_tokenizer_init(struct json_tokenizer_t *t, void *cs, int (*cs_getch)(v
 	memset(t, 0, sizeof(*t));
 	t->cs = cs;
 	t->cs_getch = cs_getch;
+	t->allocator = &json_default_allocator;
+	t->string_chunk_size = SIZE_MAX;
+	t->replay_from = SIZE_MAX;
+	t->limits.max_depth = SIZE_MAX;
+	t->limits.max_token_length = SIZE_MAX;
+	t->limits.max_string_length = SIZE_MAX;
+	t->limits.max_container_elements = SIZE_MAX;
+	t->limits.max_total_bytes = SIZE_MAX;
+}
+
+void json_tokenizer_init_buffered(struct json_tokenizer_t *t, void *cs,
+		int (*cs_fill)(void *, const char **, const char **))
+{
+	json_tokenizer_init(t, cs, NULL);
+	t->cs_fill = cs_fill;
+}
+
+void json_tokenizer_init_nonblocking(struct json_tokenizer_t *t, void *cs,
+		int (*cs_fill)(void *, const char **, const char **))
+{
+	json_tokenizer_init_buffered(t, cs, cs_fill);
+	t->nonblocking = 1;
+}
+
+void json_tokenizer_position(const struct json_tokenizer_t *t,
+		size_t *linenum, size_t *char_pos)
+{
+	size_t lines = t->in_lines;
+	size_t line_start = t->in_line_start;
+
+	if (t->in_begin)
+		jt_count_lines(t->in_begin, t->in_at, t->in_offset, &lines, &line_start);
+
+	*linenum = lines;
+	*char_pos = json_tokenizer_offset(t) - line_start;
+}
+
+void json_tokenizer_token_position(const struct json_tokenizer_t *t,
+		size_t *linenum, size_t *char_pos)
+{
+	size_t lines = t->in_lines;
+	size_t line_start = t->in_line_start;
+
+	/* Tokens hold no newlines, so one that began in an earlier run of
+	 * input has all the newlines before it counted already. */
+	if (t->in_begin && t->tok_offset > t->in_offset)
+		jt_count_lines(t->in_begin, t->in_begin + (t->tok_offset - t->in_offset),
+				t->in_offset, &lines, &line_start);
+
+	*linenum = lines;
+	*char_pos = t->tok_offset >= line_start ? t->tok_offset - line_start : 0;
+}
+
+void json_tokenizer_start_at(struct json_tokenizer_t *t, size_t offset,
+		size_t lines, size_t line_start)
+{
+	t->in_offset = offset;
+	t->in_lines = lines;
+	t->in_line_start = line_start;
 }
 
 enum json_token_kind_e json_tokenizer_next(struct json_tokenizer_t *t)
 {
 	static const size_t INIT_CAPACITY = 32;
 
+	int scan_result;
+
+	if (t->cs_next)
+		return t->cs_next(t);
+
 	CO_BEGIN(t->state)
 
 	t->capacity = INIT_CAPACITY;
-	t->token = malloc(INIT_CAPACITY);
+	t->token = json_alloc(t->allocator, INIT_CAPACITY);
 	t->kind = JSON_TOK_NONE;
 
-	for (t->c = jt_getch(t); t->c != EOF;) {
+	for (t->c = jt_getch(t);;) {
 		t->length = 0;
+		t->tok_limit = t->limits.max_token_length;
+		t->tok_limit_error = JSON_ERR_TOKEN_LENGTH;
+		t->replay_from = SIZE_MAX;
+
+		for (;;) {
+			for (; t->c != EOF && isspace(t->c); t->c = jt_getch(t))
+				;
 
-		for (; t->c != EOF && isspace(t->c); t->c = jt_getch(t))
-			;
+			if (t->c != EOF || !t->starved)
+				break;
 
-		if (t->c == EOF)
+			t->starved = 0;
+			CO_YIELD(t->state, t->kind = JSON_TOK_AGAIN);
+			t->c = jt_getch(t);
+		}
+
+		if (t->c == EOF) {
+			JT_COUNT_TOKEN(t, JSON_TOK_NONE);
 			CO_RETURN(t->state, t->kind = JSON_TOK_NONE);
+		}
+
+		t->tok_offset = json_tokenizer_offset(t) - 1;
+		t->replay_from = t->tok_offset;
+		t->replay_length = 0;
+		t->replay_in_string = 0;
 
+rescan:
 		if (t->c == '{') {
 			jt_tok_append(t, t->c);
 			t->c = jt_getch(t);
@@ -271,36 +502,376 @@ enum json_token_kind_e json_tokenizer_next(struct json_tokenizer_t *t)
 			t->c = jt_getch(t);
 			t->kind = JSON_TOK_COMMA;
 		} else if (isalpha(t->c)) {
-			for (; isalnum(t->c) || t->c == '_'; t->c = jt_getch(t))
-				buf_append_ch(&t->token, &t->length, &t->capacity, t->c);
+			for (; isalnum(t->c) || t->c == '_'; t->c = jt_getch(t)) {
+				jt_tok_append(t, t->c);
+
+				if (jt_tok_over_limit(t)) {
+					JT_COUNT_TOKEN(t, JSON_TOK_ERROR);
+					CO_RETURN(t->state, t->kind = JSON_TOK_ERROR);
+				}
+			}
 
 			t->kind = JSON_TOK_NAKED_WORD;
 		} else if (isdigit(t->c) || t->c == '-') {
 			t->kind = jt_scan_number(t);
 		} else if (t->c == '"') {
-			if (jt_scan_string_char(t))
+			if (t->limits.max_string_length < t->tok_limit) {
+				t->tok_limit = t->limits.max_string_length;
+				t->tok_limit_error = JSON_ERR_STRING_LENGTH;
+			}
+
+			t->c = jt_getch(t);
+
+rescan_string:
+			while ((scan_result = jt_scan_string(t)) == JT_STRING_CHUNK) {
+				t->chunk_carry_length = t->length - jt_utf8_cut(t->token, t->length);
+
+				if (t->chunk_carry_length == t->length)
+					continue;
+
+				/* Hold back the start of a UTF-8 sequence that has not been
+				 * completed yet. */
+				t->length -= t->chunk_carry_length;
+				memcpy(t->chunk_carry, t->token + t->length, t->chunk_carry_length);
+
+				if (t->length > t->tok_limit) {
+					jt_fail(t, t->tok_limit_error);
+					JT_COUNT_TOKEN(t, JSON_TOK_ERROR);
+					CO_RETURN(t->state, t->kind = JSON_TOK_ERROR);
+				}
+
+				t->tok_limit -= t->length;
+				jt_tok_append(t, '\0');
+
+				JT_COUNT_TOKEN(t, JSON_TOK_STRING_CHUNK);
+				CO_YIELD(t->state, t->kind = JSON_TOK_STRING_CHUNK);
+
+				memcpy(t->token, t->chunk_carry, t->chunk_carry_length);
+				t->length = t->chunk_carry_length;
+
+				/* Pieces already handed out are not read again. */
+				t->replay_from = json_tokenizer_offset(t) - (t->c != EOF);
+				t->replay_length = t->length;
+				t->replay_in_string = 1;
+			}
+
+			if (scan_result && !t->starved) {
+				JT_COUNT_TOKEN(t, JSON_TOK_ERROR);
 				CO_RETURN(t->state, t->kind = JSON_TOK_ERROR);
+			}
 
 			t->kind = JSON_TOK_STRING;
 		} else {
+			JT_COUNT_TOKEN(t, JSON_TOK_ERROR);
 			CO_RETURN(t->state, t->kind = JSON_TOK_ERROR);
 		}
 
+		/* The input ran out before it was clear where the token ends. Read
+		 * it again from the last point it can be picked up at. */
+		if (t->starved) {
+			jt_rewind(t);
+			CO_YIELD(t->state, t->kind = JSON_TOK_AGAIN);
+
+			t->length = t->replay_length;
+			t->c = jt_getch(t);
+
+			if (t->replay_in_string)
+				goto rescan_string;
+
+			goto rescan;
+		}
+
 		jt_tok_append(t, '\0');
+		JT_COUNT_TOKEN(t, t->kind);
 		CO_YIELD(t->state, t->kind);
-	}
 
-	CO_RETURN(t->state, t->kind = JSON_TOK_NONE);
+		/* json_tokenizer_next_batch() ran into a bad token. */
+		if (t->kind == JSON_TOK_ERROR)
+			CO_RETURN(t->state, JSON_TOK_ERROR);
+	}
 
 	CO_END
 }
 
+/* Reads the token starting at t->c the way json_tokenizer_next() would, but
+ * without building its text. */
+static enum json_token_kind_e jt_scan_raw(struct json_tokenizer_t *t, size_t offset,
+		int *has_escapes)
+{
+	static const int32_t TEN_BITS = ~(~0U << 10);
+
+	enum json_token_kind_e kind = JSON_TOK_INT;
+	int32_t code_unit;
+	size_t limit;
+	int c = t->c;
+
+	t->c = jt_getch(t);
+
+	switch (c) {
+		case '{': return JSON_TOK_LEFT_CURLY_BRACE;
+		case '}': return JSON_TOK_RIGHT_CURLY_BRACE;
+		case '[': return JSON_TOK_LEFT_SQUARE_BRACE;
+		case ']': return JSON_TOK_RIGHT_SQUARE_BRACE;
+		case ':': return JSON_TOK_COLON;
+		case ',': return JSON_TOK_COMMA;
+		case '"': break;
+
+		default:
+			if (isalpha(c)) {
+				for (; isalnum(t->c) || t->c == '_'; t->c = jt_getch(t))
+					;
+
+				break;
+			}
+
+			if (c == '-' && !isdigit(t->c))
+				return JSON_TOK_ERROR;
+
+			if (c != '-' && !isdigit(c))
+				return JSON_TOK_ERROR;
+
+			for (; isdigit(t->c); t->c = jt_getch(t))
+				;
+
+			if (t->c == '.') {
+				kind = JSON_TOK_FLOAT;
+
+				if (!isdigit(t->c = jt_getch(t)))
+					return JSON_TOK_ERROR;
+
+				for (; isdigit(t->c); t->c = jt_getch(t))
+					;
+			}
+
+			if (t->c == 'e') {
+				kind = JSON_TOK_FLOAT;
+
+				if (!isdigit(t->c = jt_getch(t)))
+					return JSON_TOK_ERROR;
+
+				for (; isdigit(t->c); t->c = jt_getch(t))
+					;
+			}
+
+			if (json_tokenizer_offset(t) - (t->c != EOF) - offset > t->limits.max_token_length)
+				return JSON_TOK_ERROR;
+
+			return kind;
+	}
+
+	if (c != '"') {
+		if (json_tokenizer_offset(t) - (t->c != EOF) - offset > t->limits.max_token_length)
+			return JSON_TOK_ERROR;
+
+		return JSON_TOK_NAKED_WORD;
+	}
+
+	while (t->c != '"') {
+		if (t->c == '\n' || t->c == '\r' || t->c == EOF)
+			return JSON_TOK_ERROR;
+
+		if (t->c == '\\') {
+			*has_escapes = 1;
+			t->c = jt_getch(t);
+
+			if (t->c == '\n' || t->c == '\r' || t->c == EOF)
+				return JSON_TOK_ERROR;
+
+			if (t->c != 'u') {
+				t->c = jt_getch(t);
+				continue;
+			}
+
+			t->c = jt_getch(t);
+
+			if ((code_unit = jt_scan_code_unit(t)) < 0)
+				return JSON_TOK_ERROR;
+
+			if ((code_unit & ~TEN_BITS) == 0xD800) {
+				if (t->c != '\\') return JSON_TOK_ERROR;
+				if ((t->c = jt_getch(t)) != 'u') return JSON_TOK_ERROR;
+				t->c = jt_getch(t);
+
+				if ((code_unit = jt_scan_code_unit(t)) < 0)
+					return JSON_TOK_ERROR;
+
+				if ((code_unit & ~TEN_BITS) != 0xDC00)
+					return JSON_TOK_ERROR;
+			}
+		} else {
+			t->c = jt_getch(t);
+		}
+	}
+
+	t->c = jt_getch(t);
+
+	limit = t->limits.max_token_length;
+
+	if (t->limits.max_string_length < limit)
+		limit = t->limits.max_string_length;
+
+	/* The span covers both quotes. */
+	if (json_tokenizer_offset(t) - (t->c != EOF) - offset - 2 > limit)
+		return JSON_TOK_ERROR;
+
+	return JSON_TOK_STRING;
+}
+
+size_t json_tokenizer_next_batch(struct json_tokenizer_t *t,
+		struct json_token_t *tokens, size_t n)
+{
+	struct json_token_t *tok;
+	size_t i;
+	int decoded;
+	int chunked = 0;
+
+	for (i = 0; i < n; i++) {
+		tok = &tokens[i];
+
+		if ((decoded = t->state == 0 || t->kind == JSON_TOK_STRING_CHUNK || t->nonblocking)) {
+			/* Let the coroutine get to the start of a token first, or do
+			 * all the work if the input may run out in the middle of one. */
+			for (chunked = 0; json_tokenizer_next(t) == JSON_TOK_STRING_CHUNK; chunked = 1)
+				;
+
+			if (t->kind == JSON_TOK_NONE || t->kind == JSON_TOK_AGAIN)
+				break;
+
+			tok->kind = t->kind;
+			tok->has_escapes = 0;
+			tok->offset = t->tok_offset;
+		} else {
+			if (t->kind == JSON_TOK_ERROR || t->kind == JSON_TOK_NONE)
+				break;
+
+			for (; t->c != EOF && isspace(t->c); t->c = jt_getch(t))
+				;
+
+			if (t->c == EOF) {
+				t->kind = JSON_TOK_NONE;
+				break;
+			}
+
+			tok->has_escapes = 0;
+			tok->offset = t->tok_offset = json_tokenizer_offset(t) - 1;
+			tok->kind = t->kind = jt_scan_raw(t, tok->offset, &tok->has_escapes);
+			t->length = 0;
+			t->token[0] = '\0';
+			JT_COUNT_TOKEN(t, t->kind);
+		}
+
+		tok->length = json_tokenizer_offset(t) - (t->c != EOF) - tok->offset;
+
+		/* Every escape decodes to fewer bytes than it takes, so a string
+		 * the coroutine has already decoded had some if it shrank. Only
+		 * the last chunk of a chunked one is left to go by: assume so. */
+		if (decoded && tok->kind == JSON_TOK_STRING)
+			tok->has_escapes = chunked || tok->length - 2 != t->length - 1;
+
+		if (tok->kind == JSON_TOK_ERROR)
+			return i + 1;
+	}
+
+	return i;
+}
+
 void json_tokenizer_destroy(struct json_tokenizer_t *t)
 {
-	free(t->token);
+	json_free(t->allocator, t->token, t->capacity);
+	json_free(t->allocator, t->carry, t->carry_capacity);
 	memset(t, 0, sizeof(*t));
 }
 
+int json_tokenizer_skip_value(struct json_tokenizer_t *t)
+{
+	size_t depth;
+
+	switch (t->kind) {
+		case JSON_TOK_STRING_CHUNK:
+			while (json_tokenizer_next(t) == JSON_TOK_STRING_CHUNK)
+				;
+
+			if (t->kind != JSON_TOK_STRING) {
+				jt_report_error(t);
+				return 1;
+			}
+
+			json_tokenizer_next(t);
+			return 0;
+		case JSON_TOK_STRING:
+		case JSON_TOK_INT:
+		case JSON_TOK_FLOAT:
+		case JSON_TOK_NAKED_WORD:
+			json_tokenizer_next(t);
+			return 0;
+		case JSON_TOK_LEFT_CURLY_BRACE:
+		case JSON_TOK_LEFT_SQUARE_BRACE:
+			break;
+		default:
+			jt_report_error(t);
+			return 1;
+	}
+
+	/* There is no input to scan when the tokens come from elsewhere. */
+	if (t->cs_next) {
+		for (depth = 1; depth;) {
+			switch (json_tokenizer_next(t)) {
+				case JSON_TOK_LEFT_CURLY_BRACE:
+				case JSON_TOK_LEFT_SQUARE_BRACE:
+					depth++;
+					break;
+				case JSON_TOK_RIGHT_CURLY_BRACE:
+				case JSON_TOK_RIGHT_SQUARE_BRACE:
+					depth--;
+					break;
+				case JSON_TOK_ERROR:
+				case JSON_TOK_NONE:
+					jt_report_error(t);
+					return 1;
+				default:
+					break;
+			}
+		}
+
+		json_tokenizer_next(t);
+		return 0;
+	}
+
+	/* t->c already holds the character after the opening bracket. */
+	for (depth = 1; depth; t->c = jt_getch(t)) {
+		if (t->c == '"') {
+			for (t->c = jt_getch(t); t->c != '"' && t->c != EOF; t->c = jt_getch(t))
+				if (t->c == '\\')
+					t->c = jt_getch(t);
+		} else if (t->c == '{' || t->c == '[') {
+			depth++;
+		} else if (t->c == '}' || t->c == ']') {
+			depth--;
+		}
+
+		if (t->c == EOF) {
+			t->kind = JSON_TOK_ERROR;
+			jt_report_error(t);
+			return 1;
+		}
+	}
+
+	json_tokenizer_next(t);
+
+	return 0;
+}
+
+void json_tokenizer_stats(const struct json_tokenizer_t *t, struct json_stats_t *stats)
+{
+#if JSON_STATS
+	memcpy(stats, &t->stats, sizeof(*stats));
+	stats->bytes_consumed = json_tokenizer_offset(t);
+#else
+	(void)t;
+	memset(stats, 0, sizeof(*stats));
+#endif
+}
+
 const char * json_tok_kind_to_str(enum json_token_kind_e kind)
 {
 	switch (kind) {
@@ -316,10 +887,83 @@ const char * json_tok_kind_to_str(enum json_token_kind_e kind)
 		case JSON_TOK_RIGHT_CURLY_BRACE: return "right_curly_brace";
 		case JSON_TOK_LEFT_SQUARE_BRACE: return "left_square_brace";
 		case JSON_TOK_RIGHT_SQUARE_BRACE: return "right_square_brace";
+		case JSON_TOK_STRING_CHUNK: return "string_chunk";
+		case JSON_TOK_AGAIN: return "again";
 		default: return "undefined";
 	}
 }
 
+const char * json_strerror(enum json_error_e error)
+{
+	switch (error) {
+		case JSON_ERR_NONE: return "no error";
+		case JSON_ERR_SYNTAX: return "unexpected token";
+		case JSON_ERR_DEPTH: return "nesting too deep";
+		case JSON_ERR_TOKEN_LENGTH: return "token too long";
+		case JSON_ERR_STRING_LENGTH: return "string too long";
+		case JSON_ERR_CONTAINER_ELEMENTS: return "too many container elements";
+		case JSON_ERR_TOTAL_BYTES: return "value too large";
+		case JSON_ERR_NO_MEMORY: return "out of memory";
+		default: return "undefined";
+	}
+}
+
+int jt_take_string(struct json_tokenizer_t *t, struct json_string_t *out)
+{
+	char *text = NULL;
+	size_t length = 0;
+	size_t capacity = 0;
+
+	if (t->kind == JSON_TOK_STRING) {
+		if (jt_account(t, t->length))
+			return 1;
+
+		json_string_set_a(out, t->token, t->length, t->allocator);
+		JT_STAT(t, string_bytes_copied += t->length);
+		json_tokenizer_next(t);
+
+		return 0;
+	}
+
+	if (t->kind != JSON_TOK_STRING_CHUNK)
+		return 1;
+
+	/* Pieces lose their NUL except for the last one. */
+	for (; t->kind == JSON_TOK_STRING_CHUNK; json_tokenizer_next(t)) {
+		if (jt_account(t, t->length - 1))
+			goto err;
+
+		buf_ensure_capacity(&text, &capacity, length + t->length - 1, t->allocator);
+		memcpy(text + length, t->token, t->length - 1);
+		length += t->length - 1;
+	}
+
+	if (t->kind != JSON_TOK_STRING || jt_account(t, t->length))
+		goto err;
+
+	buf_ensure_capacity(&text, &capacity, length + t->length, t->allocator);
+	memcpy(text + length, t->token, t->length);
+	length += t->length;
+	JT_STAT(t, string_bytes_copied += length);
+	json_tokenizer_next(t);
+
+	json_string_destroy_a(out, t->allocator);
+
+	if (length <= JSON_STRING_INLINE_MAX) {
+		json_string_set_a(out, text, length, t->allocator);
+		json_free(t->allocator, text, capacity);
+	} else {
+		out->heap.text = json_realloc(t->allocator, text, capacity, length);
+		out->heap.length = length;
+	}
+
+	return 0;
+
+err:
+	json_free(t->allocator, text, capacity);
+	return 1;
+}
+
 static int json_parse_object(struct json_tokenizer_t *t, struct json_value_t *ret);
 static int json_parse_kv_pair(
 		struct json_tokenizer_t *t,
@@ -330,30 +974,51 @@ static int json_parse_array(struct json_tokenizer_t *t, struct json_value_t *ret
 
 int json_value_parse(struct json_tokenizer_t *t, struct json_value_t *ret)
 {
+	if (t->depth == 0)
+		t->dom_bytes = 0;
+
 	switch (t->kind) {
 		case JSON_TOK_LEFT_CURLY_BRACE:
 			return json_parse_object(t, ret);
 		case JSON_TOK_LEFT_SQUARE_BRACE:
 			return json_parse_array(t, ret);
 		case JSON_TOK_STRING:
-			json_value_string_init(ret, t->token, t->length);
-			json_tokenizer_next(t);
+		case JSON_TOK_STRING_CHUNK:
+			json_value_destroy_a(ret, t->allocator);
+			ret->type = JSON_STRING;
+
+			if (jt_take_string(t, &ret->string)) {
+				jt_report_error(t);
+				return 1;
+			}
+
 			break;
+		/* The *_init() functions would free the old value with the
+		 * default allocator. */
 		case JSON_TOK_INT:
-			json_value_int_init(ret, strtol(t->token, NULL, 10));
+			json_value_destroy_a(ret, t->allocator);
+			ret->type = JSON_INT;
+			ret->n_int = strtol(t->token, NULL, 10);
 			json_tokenizer_next(t);
 			break;
 		case JSON_TOK_FLOAT:
-			json_value_float_init(ret, strtod(t->token, NULL));
+			json_value_destroy_a(ret, t->allocator);
+			ret->type = JSON_FLOAT;
+			ret->n_float = strtod(t->token, NULL);
 			json_tokenizer_next(t);
 			break;
 		case JSON_TOK_NAKED_WORD:
 			if (strcmp(t->token, "false") == 0) {
-				json_value_bool_init(ret, 0);
+				json_value_destroy_a(ret, t->allocator);
+				ret->type = JSON_BOOL;
+				ret->n_int = 0;
 			} else if (strcmp(t->token, "true") == 0) {
-				json_value_bool_init(ret, 1);
+				json_value_destroy_a(ret, t->allocator);
+				ret->type = JSON_BOOL;
+				ret->n_int = 1;
 			} else if (strcmp(t->token, "null") == 0) {
-				json_value_null_init(ret);
+				json_value_destroy_a(ret, t->allocator);
+				ret->type = JSON_NULL;
 			} else {
 				jt_report_error(t);
 				return 1;
@@ -376,19 +1041,33 @@ static int json_parse_object(struct json_tokenizer_t *t, struct json_value_t *re
 	struct json_value_t val = { 0 };
 	int error = 0;
 
-	if (!jt_consume_token(t, JSON_TOK_LEFT_CURLY_BRACE))
-		goto err;
+	if (!jt_consume_token(t, JSON_TOK_LEFT_CURLY_BRACE)) {
+		jt_report_error(t);
+		return 1;
+	}
 
-	json_value_object_init(ret);
+	json_value_object_init_a(ret, t->allocator);
+
+	if (jt_depth_enter(t))
+		goto err;
 
 	if (jt_consume_token(t, JSON_TOK_RIGHT_CURLY_BRACE))
 		goto end;
 
 	do {
+		if (ret->object.length >= t->limits.max_container_elements) {
+			jt_fail(t, JSON_ERR_CONTAINER_ELEMENTS);
+			goto err;
+		}
+
+		if (jt_account(t, sizeof(struct json_kv_pair_t)))
+			goto err;
+
 		if (json_parse_kv_pair(t, &str, &val))
 			goto err;
 
-		json_value_object_put(ret, &str, &val);
+		json_value_object_put_a(ret, &str, &val, t->allocator);
+		JT_STAT(t, object_sorts++);
 	} while (jt_consume_token(t, JSON_TOK_COMMA));
 
 	if (!jt_consume_token(t, JSON_TOK_RIGHT_CURLY_BRACE))
@@ -401,8 +1080,9 @@ err:
 	error = 1;
 
 end:
-	json_string_destroy(&str);
-	json_value_destroy(&val);
+	t->depth--;
+	json_string_destroy_a(&str, t->allocator);
+	json_value_destroy_a(&val, t->allocator);
 
 	return error;
 }
@@ -412,14 +1092,11 @@ static int json_parse_kv_pair(
 		struct json_string_t *k,
 		struct json_value_t *v)
 {
-	if (t->kind != JSON_TOK_STRING) {
+	if (jt_take_string(t, k)) {
 		jt_report_error(t);
 		return 1;
 	}
 
-	json_string_set(k, t->token, t->length);
-	json_tokenizer_next(t);
-
 	if (!jt_consume_token(t, JSON_TOK_COLON)) {
 		jt_report_error(t);
 		return 1;
@@ -438,19 +1115,32 @@ static int json_parse_array(struct json_tokenizer_t *t, struct json_value_t *ret
 	struct json_value_t val = { 0 };
 	int error = 0;
 
-	if (!jt_consume_token(t, JSON_TOK_LEFT_SQUARE_BRACE))
-		goto err;
+	if (!jt_consume_token(t, JSON_TOK_LEFT_SQUARE_BRACE)) {
+		jt_report_error(t);
+		return 1;
+	}
+
+	json_value_array_init_a(ret, t->allocator);
 
-	json_value_array_init(ret);
+	if (jt_depth_enter(t))
+		goto err;
 
 	if (jt_consume_token(t, JSON_TOK_RIGHT_SQUARE_BRACE))
 		goto end;
 
 	do {
+		if (ret->array.length >= t->limits.max_container_elements) {
+			jt_fail(t, JSON_ERR_CONTAINER_ELEMENTS);
+			goto err;
+		}
+
+		if (jt_account(t, sizeof(struct json_value_t)))
+			goto err;
+
 		if (json_value_parse(t, &val))
 			goto err;
 
-		json_value_array_append(ret, &val);
+		jt_array_append(t, ret, &val);
 	} while (jt_consume_token(t, JSON_TOK_COMMA));
 
 	if (!jt_consume_token(t, JSON_TOK_RIGHT_SQUARE_BRACE))
@@ -463,46 +1153,213 @@ err:
 	error = 1;
 
 end:
-	json_value_destroy(&val);
+	t->depth--;
+	json_value_destroy_a(&val, t->allocator);
 
 	return error;
 }
 
+static size_t jv_element_size(const struct json_value_t *a)
+{
+	return a->packing == JSON_ARRAY_VALUES ? sizeof(struct json_value_t) : sizeof(int64_t);
+}
+
+static enum json_value_type_e jv_packed_type(const struct json_value_t *a)
+{
+	return a->packing == JSON_ARRAY_INTS ? JSON_INT : JSON_FLOAT;
+}
+
+void jt_array_append(struct json_tokenizer_t *t, struct json_value_t *a, struct json_value_t *v)
+{
+	size_t bytes;
+
+	if (t->pack_arrays && !a->array.length && a->packing == JSON_ARRAY_VALUES
+			&& v->type & JSON_NUMBER) {
+		/* Keeps the slots the array was created with. */
+		bytes = a->array.capacity * sizeof(struct json_value_t);
+		a->packing = v->type == JSON_INT ? JSON_ARRAY_INTS : JSON_ARRAY_FLOATS;
+		a->array.capacity = bytes / jv_element_size(a);
+	}
+
+	json_value_array_append_a(a, v, t->allocator);
+}
+
 void json_value_array_append(struct json_value_t *a, struct json_value_t *v)
 {
-	buf_append((char **)&a->array.values, &a->array.length, &a->array.capacity,
-			sizeof(*v), (char *)v);
+	json_value_array_append_a(a, v, NULL);
+}
+
+void json_value_array_append_a(
+		struct json_value_t *a,
+		struct json_value_t *v,
+		const struct json_allocator_t *allocator)
+{
+	if (a->packing != JSON_ARRAY_VALUES && v->type != jv_packed_type(a))
+		json_value_array_unpack_a(a, allocator);
+
+	if (a->packing == JSON_ARRAY_INTS) {
+		buf_append((char **)&a->array.ints, &a->array.length, &a->array.capacity,
+				sizeof(v->n_int), (char *)&v->n_int, allocator);
+	} else if (a->packing == JSON_ARRAY_FLOATS) {
+		buf_append((char **)&a->array.floats, &a->array.length, &a->array.capacity,
+				sizeof(v->n_float), (char *)&v->n_float, allocator);
+	} else {
+		buf_append((char **)&a->array.values, &a->array.length, &a->array.capacity,
+				sizeof(*v), (char *)v, allocator);
+	}
+
 	memset(v, 0, sizeof(*v));
 }
 
+int json_value_array_pack(struct json_value_t *v)
+{
+	return json_value_array_pack_a(v, NULL);
+}
+
+int json_value_array_pack_a(struct json_value_t *v, const struct json_allocator_t *allocator)
+{
+	struct json_value_t *values = v->array.values;
+	enum json_value_type_e type;
+	int64_t *ints;
+	double *floats;
+	size_t i;
+
+	if (v->type != JSON_ARRAY)
+		return 1;
+
+	if (v->packing != JSON_ARRAY_VALUES)
+		return 0;
+
+	if (!v->array.length || !(values[0].type & JSON_NUMBER))
+		return 1;
+
+	type = values[0].type;
+
+	for (i = 1; i < v->array.length; i++) {
+		if (values[i].type != type)
+			return 1;
+	}
+
+	if (type == JSON_INT) {
+		ints = json_alloc(allocator, v->array.length * sizeof(*ints));
+
+		for (i = 0; i < v->array.length; i++)
+			ints[i] = values[i].n_int;
+
+		v->array.ints = ints;
+		v->packing = JSON_ARRAY_INTS;
+	} else {
+		floats = json_alloc(allocator, v->array.length * sizeof(*floats));
+
+		for (i = 0; i < v->array.length; i++)
+			floats[i] = values[i].n_float;
+
+		v->array.floats = floats;
+		v->packing = JSON_ARRAY_FLOATS;
+	}
+
+	json_free(allocator, values, v->array.capacity * sizeof(*values));
+	v->array.capacity = v->array.length;
+
+	return 0;
+}
+
+void json_value_array_unpack(struct json_value_t *v)
+{
+	json_value_array_unpack_a(v, NULL);
+}
+
+void json_value_array_unpack_a(struct json_value_t *v, const struct json_allocator_t *allocator)
+{
+	struct json_value_t *values;
+	size_t i;
+
+	if (v->type != JSON_ARRAY || v->packing == JSON_ARRAY_VALUES)
+		return;
+
+	values = json_calloc(allocator, v->array.capacity, sizeof(*values));
+
+	for (i = 0; i < v->array.length; i++) {
+		values[i].type = jv_packed_type(v);
+
+		if (v->packing == JSON_ARRAY_INTS)
+			values[i].n_int = v->array.ints[i];
+		else
+			values[i].n_float = v->array.floats[i];
+	}
+
+	json_free(allocator, v->array.ints, v->array.capacity * jv_element_size(v));
+	v->array.values = values;
+	v->packing = JSON_ARRAY_VALUES;
+}
+
 void json_value_object_init(struct json_value_t *v)
+{
+	json_value_object_init_a(v, NULL);
+}
+
+void json_value_object_init_a(struct json_value_t *v, const struct json_allocator_t *allocator)
 {
 	v->type = JSON_OBJECT;
 	v->object.length = 0;
 	v->object.capacity = 4;
-	v->object.fields = calloc(v->object.capacity, sizeof(v->object.fields[0]));
+	v->object.fields = json_calloc(allocator, v->object.capacity, sizeof(v->object.fields[0]));
 }
 
 void json_value_array_init(struct json_value_t *v)
+{
+	json_value_array_init_a(v, NULL);
+}
+
+void json_value_array_init_a(struct json_value_t *v, const struct json_allocator_t *allocator)
 {
 	v->type = JSON_ARRAY;
+	v->packing = JSON_ARRAY_VALUES;
 	v->array.length = 0;
 	v->array.capacity = 4;
-	v->array.values = calloc(v->array.capacity, sizeof(v->array.values[0]));
+	v->array.values = json_calloc(allocator, v->array.capacity, sizeof(v->array.values[0]));
 }
 
 void json_value_string_init(struct json_value_t *v, const char *token, size_t length)
 {
-	json_value_destroy(v);
+	json_value_string_init_a(v, token, length, NULL);
+}
+
+void json_value_string_init_a(
+		struct json_value_t *v,
+		const char *token,
+		size_t length,
+		const struct json_allocator_t *allocator)
+{
+	json_value_destroy_a(v, allocator);
 	v->type = JSON_STRING;
-	json_string_set(&v->string, token, length);
+	json_string_set_a(&v->string, token, length, allocator);
 }
 
 void json_string_set(struct json_string_t *jstr, const char *text, size_t length)
 {
-	jstr->text = realloc(jstr->text, length);
-	jstr->length = length;
-	memcpy(jstr->text, text, length);
+	json_string_set_a(jstr, text, length, NULL);
+}
+
+void json_string_set_a(
+		struct json_string_t *jstr,
+		const char *text,
+		size_t length,
+		const struct json_allocator_t *allocator)
+{
+	if (length <= JSON_STRING_INLINE_MAX) {
+		json_string_destroy_a(jstr, allocator);
+		memcpy(jstr->small + JSON_STRING_INLINE_OFFSET, text, length);
+		jstr->small[JSON_STRING_TAG] = (char)(JSON_STRING_INLINE_FLAG | length);
+		return;
+	}
+
+	if (json_string_is_inline(jstr))
+		memset(jstr, 0, sizeof(*jstr));
+
+	jstr->heap.text = json_realloc(allocator, jstr->heap.text, jstr->heap.length, length);
+	jstr->heap.length = length;
+	memcpy(jstr->heap.text, text, length);
 }
 
 void json_string_move(struct json_string_t *from, struct json_string_t *to)
@@ -513,26 +1370,49 @@ void json_string_move(struct json_string_t *from, struct json_string_t *to)
 
 void json_string_copy(const struct json_string_t *from, struct json_string_t *to)
 {
-	to->length = from->length;
-	to->text = malloc(to->length);
-	memcpy(to->text, from->text, to->length);
+	json_string_copy_a(from, to, NULL);
+}
+
+void json_string_copy_a(
+		const struct json_string_t *from,
+		struct json_string_t *to,
+		const struct json_allocator_t *allocator)
+{
+	if (json_string_is_inline(from)) {
+		memcpy(to, from, sizeof(*from));
+		return;
+	}
+
+	to->heap.length = from->heap.length;
+	to->heap.text = json_alloc(allocator, to->heap.length);
+	memcpy(to->heap.text, from->heap.text, to->heap.length);
 }
 
 void json_string_destroy(struct json_string_t *jstr)
 {
-	free(jstr->text);
+	json_string_destroy_a(jstr, NULL);
+}
+
+void json_string_destroy_a(struct json_string_t *jstr, const struct json_allocator_t *allocator)
+{
+	if (!json_string_is_inline(jstr))
+		json_free(allocator, jstr->heap.text, jstr->heap.length);
+
 	memset(jstr, 0, sizeof(*jstr));
 }
 
 int json_string_cmp(const struct json_string_t *a, const struct json_string_t *b)
 {
-	if (a->length > b->length)
+	size_t a_length = json_string_length(a);
+	size_t b_length = json_string_length(b);
+
+	if (a_length > b_length)
 		return 1;
 
-	if (a->length < b->length)
+	if (a_length < b_length)
 		return -1;
 
-	return memcmp(a->text, b->text, a->length);
+	return memcmp(json_string_text(a), json_string_text(b), a_length);
 }
 
 void json_value_int_init(struct json_value_t *v, int64_t i)
@@ -565,14 +1445,23 @@ void json_value_null_init(struct json_value_t *v)
 static int json_kv_pair_cmp(const struct json_kv_pair_t *a, const struct json_kv_pair_t *b);
 
 void json_value_object_put(struct json_value_t *v, struct json_string_t *name, struct json_value_t *val)
+{
+	json_value_object_put_a(v, name, val, NULL);
+}
+
+void json_value_object_put_a(
+		struct json_value_t *v,
+		struct json_string_t *name,
+		struct json_value_t *val,
+		const struct json_allocator_t *allocator)
 {
 	struct json_kv_pair_t kv = { 0 };
 
 	json_string_move(name, &kv.name);
-	json_value_move(val, &kv.value);
+	json_value_move_a(val, &kv.value, allocator);
 
 	buf_append((char **)&v->object.fields, &v->object.length, &v->object.capacity,
-			sizeof(kv), (const char *)&kv);
+			sizeof(kv), (const char *)&kv, allocator);
 
 	memset(val, 0, sizeof(*val));
 
@@ -586,6 +1475,14 @@ static int json_kv_pair_cmp(const struct json_kv_pair_t *a, const struct json_kv
 }
 
 void json_value_copy(const struct json_value_t *from, struct json_value_t *to)
+{
+	json_value_copy_a(from, to, NULL);
+}
+
+void json_value_copy_a(
+		const struct json_value_t *from,
+		struct json_value_t *to,
+		const struct json_allocator_t *allocator)
 {
 	const struct json_kv_pair_t *from_field;
 	struct json_kv_pair_t *to_field;
@@ -593,38 +1490,45 @@ void json_value_copy(const struct json_value_t *from, struct json_value_t *to)
 	struct json_value_t *to_val;
 	size_t i;
 
-	json_value_destroy(to);
+	json_value_destroy_a(to, allocator);
 	memcpy(to, from, sizeof(*to));
 
 	switch (from->type) {
 		case JSON_OBJECT:
-			to->object.fields = calloc(from->object.capacity, sizeof(*from_field));
+			to->object.fields = json_calloc(allocator, from->object.capacity, sizeof(*from_field));
 
 			for (i = 0; i < from->object.length; i++) {
 				from_field = &from->object.fields[i];
 				to_field = &to->object.fields[i];
 
-				json_string_copy(&from_field->name, &to_field->name);
-				json_value_copy(&from_field->value, &to_field->value);
+				json_string_copy_a(&from_field->name, &to_field->name, allocator);
+				json_value_copy_a(&from_field->value, &to_field->value, allocator);
 			}
 
 			break;
 
 		case JSON_ARRAY:
-			to->array.values = calloc(from->object.capacity, sizeof(*from_val));
+			if (from->packing != JSON_ARRAY_VALUES) {
+				to->array.ints = json_alloc(allocator,
+						from->array.capacity * jv_element_size(from));
+				memcpy(to->array.ints, from->array.ints,
+						from->array.length * jv_element_size(from));
+				break;
+			}
+
+			to->array.values = json_calloc(allocator, from->array.capacity, sizeof(*from_val));
 
 			for (i = 0; i < from->array.length; i++) {
 				from_val = &from->array.values[i];
 				to_val = &to->array.values[i];
 
-				json_value_copy(from_val, to_val);
+				json_value_copy_a(from_val, to_val, allocator);
 			}
 
 			break;
 
 		case JSON_STRING:
-			to->string.text = malloc(from->string.length);
-			memcpy(to->string.text, from->string.text, to->string.length);
+			json_string_copy_a(&from->string, &to->string, allocator);
 			break;
 
 		case JSON_INT:
@@ -640,12 +1544,25 @@ void json_value_copy(const struct json_value_t *from, struct json_value_t *to)
 
 void json_value_move(struct json_value_t *from, struct json_value_t *to)
 {
-	json_value_destroy(to);
+	json_value_move_a(from, to, NULL);
+}
+
+void json_value_move_a(
+		struct json_value_t *from,
+		struct json_value_t *to,
+		const struct json_allocator_t *allocator)
+{
+	json_value_destroy_a(to, allocator);
 	memcpy(to, from, sizeof(*from));
 	memset(from, 0, sizeof(*from));
 }
 
 void json_value_destroy(struct json_value_t *v)
+{
+	json_value_destroy_a(v, NULL);
+}
+
+void json_value_destroy_a(struct json_value_t *v, const struct json_allocator_t *allocator)
 {
 	size_t i;
 
@@ -655,22 +1572,24 @@ void json_value_destroy(struct json_value_t *v)
 	switch (v->type) {
 		case JSON_OBJECT:
 			for (i = 0; i < v->object.length; i++) {
-				json_string_destroy(&v->object.fields[i].name);
-				json_value_destroy(&v->object.fields[i].value);
+				json_string_destroy_a(&v->object.fields[i].name, allocator);
+				json_value_destroy_a(&v->object.fields[i].value, allocator);
 			}
 
-			free(v->object.fields);
+			json_free(allocator, v->object.fields,
+					v->object.capacity * sizeof(v->object.fields[0]));
 			break;
 
 		case JSON_ARRAY:
-			for (i = 0; i < v->array.length; i++)
-				json_value_destroy(&v->array.values[i]);
+			for (i = 0; v->packing == JSON_ARRAY_VALUES && i < v->array.length; i++)
+				json_value_destroy_a(&v->array.values[i], allocator);
 
-			free(v->array.values);
+			json_free(allocator, v->array.values,
+					v->array.capacity * jv_element_size(v));
 			break;
 
 		case JSON_STRING:
-			free(v->string.text);
+			json_string_destroy_a(&v->string, allocator);
 			break;
 
 		case JSON_INT:
@@ -686,6 +1605,139 @@ void json_value_destroy(struct json_value_t *v)
 	memset(v, 0, sizeof(*v));
 }
 
+/* Space handed out from the block json_value_freeze() is building. With a
+ * NULL base nothing is written and only the size is worked out. */
+struct jv_block {
+	char *base;
+	size_t size;
+};
+
+static void *jv_block_take(struct jv_block *b, size_t size, size_t align)
+{
+	size_t at = (b->size + align - 1) & ~(align - 1);
+
+	b->size = at + size;
+
+	return b->base ? b->base + at : NULL;
+}
+
+static void jv_freeze_string(struct jv_block *b, const struct json_string_t *from,
+		struct json_string_t *to)
+{
+	char *text;
+
+	if (json_string_is_inline(from)) {
+		if (to)
+			*to = *from;
+
+		return;
+	}
+
+	text = jv_block_take(b, from->heap.length, 1);
+
+	if (!to)
+		return;
+
+	memcpy(text, from->heap.text, from->heap.length);
+	to->heap.text = text;
+	to->heap.length = from->heap.length;
+}
+
+/* Copies the contents of from into the block, to being where from itself
+ * has already been placed, or NULL while measuring. */
+static void jv_freeze(struct jv_block *b, const struct json_value_t *from,
+		struct json_value_t *to)
+{
+	struct json_kv_pair_t *fields;
+	struct json_value_t *values;
+	size_t i;
+
+	if (to)
+		*to = *from;
+
+	switch (from->type) {
+		case JSON_OBJECT:
+			fields = jv_block_take(b, from->object.length * sizeof(*fields),
+					_Alignof(struct json_kv_pair_t));
+
+			if (to) {
+				to->object.fields = from->object.length ? fields : NULL;
+				to->object.capacity = from->object.length;
+			}
+
+			for (i = 0; i < from->object.length; i++) {
+				jv_freeze_string(b, &from->object.fields[i].name,
+						to ? &fields[i].name : NULL);
+				jv_freeze(b, &from->object.fields[i].value,
+						to ? &fields[i].value : NULL);
+			}
+
+			break;
+
+		case JSON_ARRAY:
+			if (from->packing != JSON_ARRAY_VALUES) {
+				values = jv_block_take(b, from->array.length * jv_element_size(from),
+						_Alignof(int64_t));
+
+				if (to) {
+					memcpy(values, from->array.values,
+							from->array.length * jv_element_size(from));
+					to->array.values = from->array.length ? values : NULL;
+					to->array.capacity = from->array.length;
+				}
+
+				break;
+			}
+
+			values = jv_block_take(b, from->array.length * sizeof(*values),
+					_Alignof(struct json_value_t));
+
+			if (to) {
+				to->array.values = from->array.length ? values : NULL;
+				to->array.capacity = from->array.length;
+			}
+
+			for (i = 0; i < from->array.length; i++)
+				jv_freeze(b, &from->array.values[i], to ? &values[i] : NULL);
+
+			break;
+
+		case JSON_STRING:
+			jv_freeze_string(b, &from->string, to ? &to->string : NULL);
+			break;
+
+		default:
+			/* Scalars were copied whole. */
+			break;
+	}
+}
+
+struct json_value_t *json_value_freeze(struct json_value_t *v)
+{
+	return json_value_freeze_a(v, NULL);
+}
+
+struct json_value_t *json_value_freeze_a(
+		struct json_value_t *v,
+		const struct json_allocator_t *allocator)
+{
+	struct jv_block b = { 0 };
+	struct json_value_t *root;
+
+	jv_block_take(&b, sizeof(*root), _Alignof(struct json_value_t));
+	jv_freeze(&b, v, NULL);
+
+	if (!(b.base = malloc(b.size)))
+		return NULL;
+
+	b.size = 0;
+	root = jv_block_take(&b, sizeof(*root), _Alignof(struct json_value_t));
+	jv_freeze(&b, v, root);
+	json_value_destroy_a(v, allocator);
+
+	return root;
+}
+
 #define WRITE_LITERAL(__fn, __sink, __str) (__fn)((__sink), __str, sizeof(__str) - 1)
 
 static void json_kv_to_str(
@@ -699,6 +1751,11 @@ static void json_string_to_str(
 		void *sink,
 		void (*sink_write)(void *sink, const char *text, size_t length));
 
+static void json_packed_to_str(
+		const struct json_value_t *v,
+		void *sink,
+		void (*sink_write)(void *sink, const char *text, size_t length));
+
 void json_value_to_string(
 		const struct json_value_t *v,
 		void *sink,
@@ -727,6 +1784,11 @@ void json_value_to_string(
 			break;
 
 		case JSON_ARRAY:
+			if (v->packing != JSON_ARRAY_VALUES) {
+				json_packed_to_str(v, sink, sink_write);
+				break;
+			}
+
 			WRITE_LITERAL(sink_write, sink, "[");
 
 			for (i = 0; i < v->array.length - 1 && v->array.length; i++) {
@@ -742,7 +1804,8 @@ void json_value_to_string(
 			break;
 
 		case JSON_STRING:
-			json_string_to_str(v->string.text, v->string.length - 1, sink, sink_write);
+			json_string_to_str(json_string_text(&v->string),
+					json_string_length(&v->string) - 1, sink, sink_write);
 			break;
 
 		case JSON_INT:
@@ -774,11 +1837,40 @@ static void json_kv_to_str(
 		void *sink,
 		void (*sink_write)(void *sink, const char *text, size_t length))
 {
-	json_string_to_str(kv->name.text, kv->name.length - 1, sink, sink_write);
+	json_string_to_str(json_string_text(&kv->name), json_string_length(&kv->name) - 1,
+			sink, sink_write);
 	WRITE_LITERAL(sink_write, sink, ": ");
 	json_value_to_string(&kv->value, sink, sink_write);
 }
 
+/* Prints the elements of a packed array the way they would be printed if
+ * they were json_value_t ones. */
+static void json_packed_to_str(
+		const struct json_value_t *v,
+		void *sink,
+		void (*sink_write)(void *sink, const char *text, size_t length))
+{
+	struct json_value_t e = { 0 };
+	size_t i;
+
+	e.type = jv_packed_type(v);
+	WRITE_LITERAL(sink_write, sink, "[");
+
+	for (i = 0; i < v->array.length; i++) {
+		if (i)
+			WRITE_LITERAL(sink_write, sink, ", ");
+
+		if (v->packing == JSON_ARRAY_INTS)
+			e.n_int = v->array.ints[i];
+		else
+			e.n_float = v->array.floats[i];
+
+		json_value_to_string(&e, sink, sink_write);
+	}
+
+	WRITE_LITERAL(sink_write, sink, "]");
+}
+
 static void json_string_to_str(
 		const char *s,
 		size_t length,
@@ -789,3 +1881,45 @@ static void json_string_to_str(
 	sink_write(sink, s, length);
 	WRITE_LITERAL(sink_write, sink, "\"");
 }
+
+static void json_stats_put_size(struct json_value_t *obj, const char *name, size_t n)
+{
+	struct json_string_t key = { 0 };
+	struct json_value_t val = { 0 };
+
+	json_string_set(&key, name, strlen(name) + 1);
+	json_value_int_init(&val, (int64_t)n);
+	json_value_object_put(obj, &key, &val);
+	json_string_destroy(&key);
+}
+
+void json_stats_to_string(
+		const struct json_stats_t *stats,
+		void *sink,
+		void (*sink_write)(void *sink, const char *text, size_t length))
+{
+	struct json_value_t root = { 0 };
+	struct json_value_t tokens = { 0 };
+	struct json_string_t key = { 0 };
+	int kind;
+
+	json_value_object_init(&root);
+	json_value_object_init(&tokens);
+
+	for (kind = JSON_TOK_ERROR; kind <= JSON_TOK_LAST; kind++)
+		json_stats_put_size(&tokens, json_tok_kind_to_str(kind),
+				stats->tokens[kind - JSON_TOK_ERROR]);
+
+	json_stats_put_size(&root, "bytes_consumed", stats->bytes_consumed);
+	json_stats_put_size(&root, "token_reallocs", stats->token_reallocs);
+	json_stats_put_size(&root, "max_depth", stats->max_depth);
+	json_stats_put_size(&root, "object_sorts", stats->object_sorts);
+	json_stats_put_size(&root, "string_bytes_copied", stats->string_bytes_copied);
+	json_string_set(&key, "tokens", sizeof("tokens"));
+	json_value_object_put(&root, &key, &tokens);
+
+	json_value_to_string(&root, sink, sink_write);
+
+	json_string_destroy(&key);
+	json_value_destroy(&root);
+}
@@ -2,9 +2,16 @@
 #define GRAMAS_JSON_READER_H
 
 #include "coro.h"
+#include "json_alloc.h"
 
 #include <stddef.h>
 
+/* Build with JSON_STATS=1 to have the tokenizer and the parser count what they
+ * do. With the default of 0 the counters are compiled out entirely. */
+#ifndef JSON_STATS
+#define JSON_STATS 0
+#endif
+
 enum json_token_kind_e {
 	JSON_TOK_ERROR = -1,
 	JSON_TOK_NONE = 0,
@@ -18,6 +25,55 @@ enum json_token_kind_e {
 	JSON_TOK_RIGHT_CURLY_BRACE,
 	JSON_TOK_LEFT_SQUARE_BRACE,
 	JSON_TOK_RIGHT_SQUARE_BRACE,
+	JSON_TOK_STRING_CHUNK,
+	JSON_TOK_AGAIN,
+
+	JSON_TOK_LAST = JSON_TOK_AGAIN
+};
+
+#define JSON_TOK_KIND_COUNT (JSON_TOK_LAST - JSON_TOK_ERROR + 1)
+
+/* A token as json_tokenizer_next_batch() reports it: where it lies in the
+ * input instead of a copy of its text. Strings span both quotes and are left
+ * escaped; has_escapes is clear when their contents can be used as they are. */
+struct json_token_t {
+	enum json_token_kind_e kind;
+	int has_escapes;
+	size_t offset;
+	size_t length;
+};
+
+struct json_stats_t {
+	size_t bytes_consumed;
+	size_t tokens[JSON_TOK_KIND_COUNT];	/* Indexed by kind - JSON_TOK_ERROR */
+	size_t token_reallocs;
+	size_t max_depth;
+	size_t object_sorts;
+	size_t string_bytes_copied;
+};
+
+enum json_error_e {
+	JSON_ERR_NONE = 0,
+	JSON_ERR_SYNTAX,
+	JSON_ERR_DEPTH,
+	JSON_ERR_TOKEN_LENGTH,
+	JSON_ERR_STRING_LENGTH,
+	JSON_ERR_CONTAINER_ELEMENTS,
+	JSON_ERR_TOTAL_BYTES,
+	JSON_ERR_NO_MEMORY,
+};
+
+/* Hard limits for untrusted input. SIZE_MAX means "no limit", which is what
+ * json_tokenizer_init() sets every field to. Lengths are in bytes and do not
+ * count the terminating NUL. max_total_bytes bounds the memory of a single
+ * top-level value as estimated by the parser: element slots plus string
+ * bytes. */
+struct json_limits_t {
+	size_t max_depth;
+	size_t max_token_length;
+	size_t max_string_length;
+	size_t max_container_elements;
+	size_t max_total_bytes;
 };
 
 struct json_tokenizer_t {
@@ -25,29 +81,153 @@ struct json_tokenizer_t {
 
 	void *cs;
 	int (*cs_getch)(void *);
+	/* Set by json_tokenizer_init_buffered(): points begin and end at the
+	 * next run of input bytes and returns 0, or returns EOF once there are
+	 * none left. The bytes must stay put until the next call. */
+	int (*cs_fill)(void *, const char **begin, const char **end);
+	/* If set, json_tokenizer_next() leaves tokenizing to it: it must fill
+	 * in kind, token, length, tok_offset and the input position of the
+	 * next token and return its kind. See json_pipeline.h. */
+	enum json_token_kind_e (*cs_next)(struct json_tokenizer_t *);
+
+	/* The run of input currently being read and what is known about the
+	 * input before it. Line and column numbers are worked out from these
+	 * only when they are asked for. */
+	const char *in_begin;
+	const char *in_at;
+	const char *in_end;
+	size_t in_offset;
+	size_t in_lines;
+	size_t in_line_start;
+	char in_byte;
+
+	/* Set by json_tokenizer_init_nonblocking(). The bytes of a token that
+	 * ran out of input are kept in carry and read again once there is
+	 * more. */
+	int nonblocking;
+	int starved;
+	int in_replay;
+	int replay_in_string;
+	size_t replay_from;
+	size_t replay_length;
+	char *carry;
+	size_t carry_offset;
+	size_t carry_length;
+	size_t carry_capacity;
 
 	void *error_handler;
 	void (*on_error)(
 			void *error_handler,
+			enum json_error_e error,
 			const char *unexpected_token,
 			size_t length,
 			size_t linenum,
 			size_t char_pos);
 
+	/* Used for the token buffer and for every value json_value_parse()
+	 * builds. Set it after json_tokenizer_init() and before the first call
+	 * to json_tokenizer_next(). */
+	const struct json_allocator_t *allocator;
+
+	/* If set, the parsers pack arrays whose first element is a number,
+	 * falling back to json_value_t elements at the first element of
+	 * another type. See json_array_packing_e. */
+	int pack_arrays;
+
 	char *token;
 	size_t length;
 	size_t capacity;
-	size_t linenum;
-	size_t char_pos;
+	/* Byte offset of the first character of the current token. */
+	size_t tok_offset;
 	enum json_token_kind_e kind;
 	int c;
+
+	/* Strings that grow to string_chunk_size bytes are handed out in pieces:
+	 * a run of JSON_TOK_STRING_CHUNK tokens followed by the JSON_TOK_STRING
+	 * that holds the rest. Every piece is unescaped, NUL-terminated like any
+	 * other token and ends on a UTF-8 sequence boundary, so it may be up to
+	 * three bytes longer than string_chunk_size. Only the current piece is
+	 * ever buffered. json_tokenizer_init() sets it to SIZE_MAX, which
+	 * disables chunking; the parsers reassemble chunked strings. */
+	size_t string_chunk_size;
+	char chunk_carry[4];
+	size_t chunk_carry_length;
+
+	struct json_limits_t limits;
+	enum json_error_e error;
+	size_t tok_limit;
+	enum json_error_e tok_limit_error;
+	size_t depth;
+	size_t dom_bytes;
+
+#if JSON_STATS
+	struct json_stats_t stats;
+#endif
 };
 
 void json_tokenizer_init(struct json_tokenizer_t *t, void *cs, int (*cs_getch)(void *));
+void json_tokenizer_init_buffered(struct json_tokenizer_t *t, void *cs,
+		int (*cs_fill)(void *, const char **, const char **));
+
+/* cs_fill may also return JSON_FILL_AGAIN when no input is available yet. The
+ * tokenizer then returns JSON_TOK_AGAIN and picks up where it left off on the
+ * next call, once cs_fill has something. Meant for token-level consumers:
+ * the parsers and json_tokenizer_skip_value() treat JSON_TOK_AGAIN as an
+ * error. */
+#define JSON_FILL_AGAIN 1
+
+void json_tokenizer_init_nonblocking(struct json_tokenizer_t *t, void *cs,
+		int (*cs_fill)(void *, const char **, const char **));
 enum json_token_kind_e json_tokenizer_next(struct json_tokenizer_t *t);
 void json_tokenizer_destroy(struct json_tokenizer_t *t);
 
+/* Steps over the value that starts at the current token and leaves the
+ * tokenizer on the token that follows it. Arrays and objects are
+ * fast-forwarded by tracking bracket depth and string quotes only: no token
+ * text is built, no escapes are decoded and nothing inside is validated
+ * beyond brackets balancing before EOF. Returns nonzero, after reporting the
+ * error through on_error, if the current token does not start a value or the
+ * input ends inside it. */
+int json_tokenizer_skip_value(struct json_tokenizer_t *t);
+
+/* Reads up to n tokens into the array and returns how many it got, which is
+ * fewer than n only at the end of the input, after a JSON_TOK_ERROR token or,
+ * for a non-blocking tokenizer, when it is waiting for input.
+ * Token text is neither copied nor unescaped, so afterwards the tokenizer
+ * stands on the last token read with an empty t->token. Length limits are
+ * checked against the raw input bytes. Can be mixed freely with
+ * json_tokenizer_next(). */
+size_t json_tokenizer_next_batch(struct json_tokenizer_t *t,
+		struct json_token_t *tokens, size_t n);
+
+/* Number of input bytes read so far, including the lookahead character. */
+static inline size_t json_tokenizer_offset(const struct json_tokenizer_t *t)
+{
+	return t->in_offset + (size_t)(t->in_at - t->in_begin);
+}
+
+/* Zero-based line and column of the last character read, the same position
+ * on_error is given. Only the bytes of the current input run are scanned. */
+void json_tokenizer_position(const struct json_tokenizer_t *t,
+		size_t *linenum, size_t *char_pos);
+
+/* The same for the first character of the current token. Not exact on the
+ * parsing side of a json_pipeline_t, which only knows where tokens end. */
+void json_tokenizer_token_position(const struct json_tokenizer_t *t,
+		size_t *linenum, size_t *char_pos);
+
+/* Counts positions as if the input were the part of a larger one that starts
+ * offset bytes and lines newlines in, on a line beginning at line_start. Call
+ * before the first token, e.g. for a piece cut out by json_split(). */
+void json_tokenizer_start_at(struct json_tokenizer_t *t, size_t offset,
+		size_t lines, size_t line_start);
+
+/* Copies the counters out of the tokenizer. They are all zero unless built
+ * with JSON_STATS. */
+void json_tokenizer_stats(const struct json_tokenizer_t *t, struct json_stats_t *stats);
+
 const char * json_tok_kind_to_str(enum json_token_kind_e kind);
+const char * json_strerror(enum json_error_e error);
 
 enum json_value_type_e {
 	JSON_NONE = 0,
@@ -64,15 +244,78 @@ enum json_value_type_e {
 
 struct json_value_t;
 
+/* Strings of up to JSON_STRING_INLINE_MAX bytes are kept inside the struct
+ * itself and cost no allocation. Longer ones live on the heap. Either way the
+ * struct stays two words long: a short string's length is kept in the most
+ * significant byte of heap.length, whose top bit tells the two forms apart.
+ * A zeroed struct is a valid empty string. Use json_string_text() and
+ * json_string_length() rather than the fields. */
+#define JSON_STRING_INLINE_MAX (sizeof(char *) + sizeof(size_t) - 1)
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define JSON_STRING_TAG 0
+#define JSON_STRING_INLINE_OFFSET 1
+#else
+#define JSON_STRING_TAG (sizeof(char *) + sizeof(size_t) - 1)
+#define JSON_STRING_INLINE_OFFSET 0
+#endif
+
+#define JSON_STRING_INLINE_FLAG 0x80
+
 struct json_string_t {
-	char *text;
-	size_t length;
+	union {
+		struct {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			size_t length;
+			char *text;
+#else
+			char *text;
+			size_t length;
+#endif
+		} heap;
+		char small[sizeof(char *) + sizeof(size_t)];
+	};
+};
+
+static inline int json_string_is_inline(const struct json_string_t *s)
+{
+	return (unsigned char)s->small[JSON_STRING_TAG] & JSON_STRING_INLINE_FLAG;
+}
+
+static inline size_t json_string_length(const struct json_string_t *s)
+{
+	if (json_string_is_inline(s))
+		return (unsigned char)s->small[JSON_STRING_TAG] & ~JSON_STRING_INLINE_FLAG;
+
+	return s->heap.length;
+}
+
+static inline const char *json_string_text(const struct json_string_t *s)
+{
+	if (json_string_is_inline(s))
+		return s->small + JSON_STRING_INLINE_OFFSET;
+
+	return s->heap.text;
+}
+
+/* Arrays hold json_value_t elements unless they are packed: an array of
+ * nothing but ints or nothing but floats can keep them as a plain int64_t or
+ * double array instead, a quarter of the size and ready for vectorized
+ * loops. Appending an element of another type unpacks the array again. */
+enum json_array_packing_e {
+	JSON_ARRAY_VALUES = 0,
+	JSON_ARRAY_INTS,
+	JSON_ARRAY_FLOATS
 };
 
 struct json_array_t {
 	size_t length;
 	size_t capacity;
-	struct json_value_t *values;
+	union {
+		struct json_value_t *values;
+		int64_t *ints;
+		double *floats;
+	};
 };
 
 struct json_object_t {
@@ -83,6 +326,8 @@ struct json_object_t {
 
 struct json_value_t {
 	enum json_value_type_e type;
+	/* How an array's elements are kept. Fits in what would be padding. */
+	enum json_array_packing_e packing;
 
 	union {
 		struct json_object_t object;
@@ -98,36 +343,113 @@ struct json_kv_pair_t {
 	struct json_value_t value;
 };
 
+/* The elements of a packed array, or NULL if v is not an array packed that
+ * way. */
+static inline const int64_t *json_value_array_ints(const struct json_value_t *v)
+{
+	return v->type == JSON_ARRAY && v->packing == JSON_ARRAY_INTS ? v->array.ints : NULL;
+}
+
+static inline const double *json_value_array_floats(const struct json_value_t *v)
+{
+	return v->type == JSON_ARRAY && v->packing == JSON_ARRAY_FLOATS ? v->array.floats : NULL;
+}
+
 int json_value_parse(struct json_tokenizer_t *t, struct json_value_t *v);
 
+/* Every function below that allocates or frees memory has an _a variant that
+ * takes the allocator to use. The plain versions use json_default_allocator.
+ * A tree must be destroyed with the allocator it was built with; values from
+ * json_value_parse() belong to the tokenizer's allocator. The scalar
+ * initializers release the previous contents of v with the default
+ * allocator, so empty such values with json_value_destroy_a() first. */
 void json_value_object_init(struct json_value_t *v);
+void json_value_object_init_a(struct json_value_t *v, const struct json_allocator_t *allocator);
 void json_value_array_init(struct json_value_t *v);
+void json_value_array_init_a(struct json_value_t *v, const struct json_allocator_t *allocator);
 void json_value_string_init(struct json_value_t *v, const char *text, size_t length);
+void json_value_string_init_a(
+		struct json_value_t *v,
+		const char *text,
+		size_t length,
+		const struct json_allocator_t *allocator);
 void json_value_int_init(struct json_value_t *v, int64_t i);
 void json_value_float_init(struct json_value_t *v, double d);
 void json_value_bool_init(struct json_value_t *v, int b);
 void json_value_null_init(struct json_value_t *v);
 
 void json_string_set(struct json_string_t *jstr, const char *text, size_t length);
+void json_string_set_a(
+		struct json_string_t *jstr,
+		const char *text,
+		size_t length,
+		const struct json_allocator_t *allocator);
 void json_string_move(struct json_string_t *from, struct json_string_t *to);
 void json_string_copy(const struct json_string_t *from, struct json_string_t *to);
+void json_string_copy_a(
+		const struct json_string_t *from,
+		struct json_string_t *to,
+		const struct json_allocator_t *allocator);
 void json_string_destroy(struct json_string_t *jstr);
+void json_string_destroy_a(struct json_string_t *jstr, const struct json_allocator_t *allocator);
 int json_string_cmp(const struct json_string_t *a, const struct json_string_t *b);
 
 void json_value_object_put(
 		struct json_value_t *v,
 		struct json_string_t *name,
 		struct json_value_t *val);
+void json_value_object_put_a(
+		struct json_value_t *v,
+		struct json_string_t *name,
+		struct json_value_t *val,
+		const struct json_allocator_t *allocator);
 
 void json_value_array_append(struct json_value_t *a, struct json_value_t *v);
+void json_value_array_append_a(
+		struct json_value_t *a,
+		struct json_value_t *v,
+		const struct json_allocator_t *allocator);
+
+/* Packs the array v if its elements are all ints or all floats, and returns
+ * nonzero if they are not, or if there are none. */
+int json_value_array_pack(struct json_value_t *v);
+int json_value_array_pack_a(struct json_value_t *v, const struct json_allocator_t *allocator);
+/* Turns a packed array back into one of json_value_t elements. */
+void json_value_array_unpack(struct json_value_t *v);
+void json_value_array_unpack_a(struct json_value_t *v, const struct json_allocator_t *allocator);
 
 void json_value_copy(const struct json_value_t *from, struct json_value_t *to);
+void json_value_copy_a(
+		const struct json_value_t *from,
+		struct json_value_t *to,
+		const struct json_allocator_t *allocator);
 void json_value_move(struct json_value_t *from, struct json_value_t *to);
+void json_value_move_a(
+		struct json_value_t *from,
+		struct json_value_t *to,
+		const struct json_allocator_t *allocator);
 void json_value_destroy(struct json_value_t *v);
+void json_value_destroy_a(struct json_value_t *v, const struct json_allocator_t *allocator);
+
+/* Moves the tree in v into a single block of memory, laid out depth first
+ * with every array and string taking exactly the space it needs, and returns
+ * its root, leaving v empty. Returns NULL and leaves v as it was if there is
+ * no memory. The block comes from malloc() and is released with one free()
+ * of the root; until then the tree must not be changed or destroyed. The
+ * allocator of the _a variant is the one v was built with. */
+struct json_value_t *json_value_freeze(struct json_value_t *v);
+struct json_value_t *json_value_freeze_a(
+		struct json_value_t *v,
+		const struct json_allocator_t *allocator);
 
 void json_value_to_string(
 		const struct json_value_t *v,
 		void *sink,
 		void (*sink_write)(void *sink, const char *text, size_t length));
 
+void json_stats_to_string(
+		const struct json_stats_t *stats,
+		void *sink,
+		void (*sink_write)(void *sink, const char *text, size_t length));
+
 #endif // GRAMAS_JSON_READER_H
@@ -0,0 +1,30 @@
+#include "json_alloc.h"
+
+#include <stdlib.h>
+
+static void *default_alloc(void *ctx, size_t size)
+{
+	(void)ctx;
+	return malloc(size);
+}
+
+static void *default_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	(void)ctx;
+	(void)old_size;
+	return realloc(ptr, new_size);
+}
+
+static void default_free(void *ctx, void *ptr, size_t size)
+{
+	(void)ctx;
+	(void)size;
+	free(ptr);
+}
+
+const struct json_allocator_t json_default_allocator = {
+	.ctx = NULL,
+	.alloc = default_alloc,
+	.realloc = default_realloc,
+	.free = default_free,
+};
@@ -0,0 +1,64 @@
+#ifndef GRAMAS_JSON_ALLOC_H
+#define GRAMAS_JSON_ALLOC_H
+
+#include <stddef.h>
+#include <string.h>
+
+/* Memory used by the tokenizer and by json_value_t trees is obtained through
+ * this vtable. Every call receives ctx so that an allocator can keep arenas,
+ * pools or counters without resorting to globals. Both realloc and free are
+ * told how large the block was when it was last allocated, which lets
+ * size-class pools avoid storing headers.
+ *
+ * Wherever an allocator pointer is accepted NULL means json_default_allocator,
+ * which simply forwards to malloc, realloc and free. */
+struct json_allocator_t {
+	void *ctx;
+	void *(*alloc)(void *ctx, size_t size);
+	void *(*realloc)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+	void (*free)(void *ctx, void *ptr, size_t size);
+};
+
+extern const struct json_allocator_t json_default_allocator;
+
+static inline const struct json_allocator_t *json_allocator_or_default(
+		const struct json_allocator_t *a)
+{
+	return a ? a : &json_default_allocator;
+}
+
+static inline void *json_alloc(const struct json_allocator_t *a, size_t size)
+{
+	a = json_allocator_or_default(a);
+	return a->alloc(a->ctx, size);
+}
+
+static inline void *json_calloc(const struct json_allocator_t *a, size_t n, size_t size)
+{
+	void *ret;
+
+	ret = json_alloc(a, n * size);
+
+	if (ret)
+		memset(ret, 0, n * size);
+
+	return ret;
+}
+
+static inline void *json_realloc(const struct json_allocator_t *a, void *ptr,
+		size_t old_size, size_t new_size)
+{
+	a = json_allocator_or_default(a);
+	return a->realloc(a->ctx, ptr, old_size, new_size);
+}
+
+static inline void json_free(const struct json_allocator_t *a, void *ptr, size_t size)
+{
+	if (!ptr)
+		return;
+
+	a = json_allocator_or_default(a);
+	a->free(a->ctx, ptr, size);
+}
+
+#endif /* GRAMAS_JSON_ALLOC_H */
@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "buf.h"
+#include "json_follow.h"
+
+#define JSON_FOLLOW_READ (64 * 1024)
+
+static void jf_boundary(void *ctx, const struct json_split_point_t *at)
+{
+	struct json_follow_t *f = ctx;
+
+	f->ready_at = *at;
+}
+
+static void jf_watch(struct json_follow_t *f)
+{
+#ifdef __linux__
+	char path[64];
+
+	if ((f->inotify_fd = inotify_init1(IN_CLOEXEC)) < 0)
+		return;
+
+	/* The descriptor's link in /proc names the file even if it was
+	 * opened by someone else, as standard input is. */
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", f->fd);
+
+	if (inotify_add_watch(f->inotify_fd, path, IN_MODIFY) < 0) {
+		close(f->inotify_fd);
+		f->inotify_fd = -1;
+	}
+#endif
+}
+
+int json_follow_open(struct json_follow_t *f, int fd, const struct json_split_point_t *from)
+{
+	struct stat st;
+
+	memset(f, 0, sizeof(*f));
+	f->fd = fd;
+	f->inotify_fd = -1;
+	f->poll_ms = JSON_FOLLOW_POLL_MS;
+	f->regular = !fstat(fd, &st) && S_ISREG(st.st_mode);
+
+	if (from) {
+		/* Pipes can only start from the beginning. */
+		if (from->offset && lseek(fd, (off_t)from->offset, SEEK_SET) < 0)
+			return 1;
+
+		f->done = *from;
+	}
+
+	json_splitter_init(&f->splitter, jf_boundary, f);
+	json_splitter_start_at(&f->splitter, &f->done);
+	f->ready_at = f->handed_at = f->done;
+
+	if (f->regular)
+		jf_watch(f);
+
+	return 0;
+}
+
+/* Waits for the file to grow. Returns nonzero if it shrank instead. */
+static int jf_wait(struct json_follow_t *f)
+{
+	struct timespec ts;
+	struct stat st;
+	char events[4096];
+
+	if (!fstat(f->fd, &st) && (size_t)st.st_size < f->done.offset + f->length)
+		return 1;
+
+	if (f->inotify_fd >= 0) {
+		/* Events that came in since the last read wake it at once. */
+		if (read(f->inotify_fd, events, sizeof(events)) >= 0 || errno == EINTR)
+			return 0;
+
+		close(f->inotify_fd);
+		f->inotify_fd = -1;
+	}
+
+	ts.tv_sec = f->poll_ms / 1000;
+	ts.tv_nsec = (long)(f->poll_ms % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+
+	return 0;
+}
+
+static int jf_read(struct json_follow_t *f)
+{
+	ssize_t n;
+
+	buf_ensure_capacity(&f->buf, &f->capacity, f->length + JSON_FOLLOW_READ, NULL);
+
+	do {
+		n = read(f->fd, f->buf + f->length, JSON_FOLLOW_READ);
+	} while (n < 0 && errno == EINTR);
+
+	if (n > 0) {
+		json_splitter_feed(&f->splitter, f->buf + f->length, (size_t)n);
+		f->length += (size_t)n;
+	}
+
+	return n < 0 ? -1 : n == 0;
+}
+
+int json_follow_next(struct json_follow_t *f, const char **begin, const char **end,
+		struct json_split_point_t *at)
+{
+	int r;
+
+	json_follow_commit(f);
+
+	while (f->ready_at.offset == f->done.offset) {
+		if (f->eof)
+			return EOF;
+
+		if ((r = jf_read(f)) < 0)
+			return 1;
+
+		if (!r)
+			continue;
+
+		if (!f->regular) {
+			/* Whatever is left is all there is going to be. */
+			f->eof = 1;
+
+			if (!f->length)
+				return EOF;
+
+			/* The splitter has counted the lines of all of it. */
+			f->ready_at.offset = f->done.offset + f->length;
+			f->ready_at.lines = f->splitter.lines;
+			f->ready_at.line_start = f->splitter.line_start;
+			break;
+		}
+
+		if (jf_wait(f))
+			return 1;
+	}
+
+	*begin = f->buf;
+	*end = f->buf + (f->ready_at.offset - f->done.offset);
+	*at = f->done;
+	f->handed_at = f->ready_at;
+
+	return 0;
+}
+
+void json_follow_commit(struct json_follow_t *f)
+{
+	size_t n = f->handed_at.offset - f->done.offset;
+
+	if (!n)
+		return;
+
+	memmove(f->buf, f->buf + n, f->length - n);
+	f->length -= n;
+	f->done = f->handed_at;
+}
+
+void json_follow_close(struct json_follow_t *f)
+{
+	if (f->inotify_fd >= 0)
+		close(f->inotify_fd);
+
+	if (f->fd >= 0)
+		close(f->fd);
+
+	free(f->buf);
+	memset(f, 0, sizeof(*f));
+	f->fd = f->inotify_fd = -1;
+}
+
+int json_checkpoint_load(const char *path, struct json_split_point_t *at, size_t *values)
+{
+	FILE *f;
+	int n;
+
+	if (!(f = fopen(path, "r")))
+		return 1;
+
+	n = fscanf(f, "%zu %zu %zu %zu", &at->offset, &at->lines, &at->line_start, values);
+	fclose(f);
+
+	return n != 4;
+}
+
+int json_checkpoint_save(const char *path, const struct json_split_point_t *at, size_t values)
+{
+	char *tmp;
+	FILE *f;
+	int failed;
+
+	if (asprintf(&tmp, "%s.tmp", path) < 0)
+		return 1;
+
+	if (!(f = fopen(tmp, "w"))) {
+		free(tmp);
+		return 1;
+	}
+
+	fprintf(f, "%zu %zu %zu %zu\n", at->offset, at->lines, at->line_start, values);
+	failed = fflush(f) || fsync(fileno(f));
+	failed |= fclose(f);
+	failed = failed || rename(tmp, path);
+	free(tmp);
+
+	return failed;
+}
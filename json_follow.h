@@ -0,0 +1,74 @@
+#ifndef GRAMAS_JSON_FOLLOW_H
+#define GRAMAS_JSON_FOLLOW_H
+
+#include <stddef.h>
+
+#include "json_split.h"
+
+/* Reads a file that is still being appended to, the way tail -f does: the
+ * end of the file is not the end of the input, only a point to wait at until
+ * it grows, by inotify where available and by polling otherwise. Pipes and
+ * the like end as usual.
+ *
+ * Input is handed out as runs of whole top-level objects and arrays, found
+ * with json_splitter_t as it arrives, so a value is never parsed before all
+ * of it has been written and the parser never waits in the middle of one:
+ *
+ *      json_follow_open(&f, fd, &resume);
+ *
+ *      while (!json_follow_next(&f, &begin, &end, &at)) {
+ *          parse [begin, end), json_tokenizer_start_at(&t, at.offset, ...)
+ *          json_follow_commit(&f);
+ *          json_checkpoint_save(path, &f.done, values);
+ *      }
+ *
+ * Values that are not objects or arrays are only handed out together with
+ * the object or array after them, or at the end of a pipe. */
+
+struct json_follow_t {
+	int fd;
+	int regular;
+	int inotify_fd;
+	unsigned poll_ms;
+
+	/* Input from done.offset on. Boundaries up to ready have been found. */
+	char *buf;
+	size_t length;
+	size_t capacity;
+	size_t ready;
+	size_t handed;
+	int eof;
+
+	struct json_splitter_t splitter;
+	struct json_split_point_t ready_at;
+	struct json_split_point_t handed_at;
+
+	/* Where the values handed out and committed so far end. */
+	struct json_split_point_t done;
+};
+
+#define JSON_FOLLOW_POLL_MS 250
+
+/* Starts following fd from from, or from the beginning if from is NULL.
+ * Returns nonzero if fd can not be positioned there. */
+int json_follow_open(struct json_follow_t *f, int fd, const struct json_split_point_t *from);
+
+/* Waits for at least one whole value and hands out all the whole values read
+ * so far, starting at the position *at. Returns EOF at the end of a pipe and
+ * 1 on error, such as the file shrinking. */
+int json_follow_next(struct json_follow_t *f, const char **begin, const char **end,
+		struct json_split_point_t *at);
+
+/* Marks what the last json_follow_next() handed out as done with. */
+void json_follow_commit(struct json_follow_t *f);
+
+/* Closes the descriptor and frees the buffer. */
+void json_follow_close(struct json_follow_t *f);
+
+/* A checkpoint is where the values done with end and how many there were,
+ * kept in a small text file that is replaced atomically. Both return
+ * nonzero on failure; a missing file is a failure to load. */
+int json_checkpoint_load(const char *path, struct json_split_point_t *at, size_t *values);
+int json_checkpoint_save(const char *path, const struct json_split_point_t *at, size_t values);
+
+#endif /* GRAMAS_JSON_FOLLOW_H */
@@ -0,0 +1,245 @@
+#include "json_index.h"
+
+#include "buf.h"
+#include "json_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_INDEX_MAGIC "JSIX"
+#define JSON_INDEX_VERSION 1
+#define JSON_INDEX_READ (1024 * 1024)
+
+static void ji_put_varint(struct json_index_t *idx, uint64_t v)
+{
+	buf_ensure_capacity((char **)&idx->data, &idx->capacity, idx->length + 10, NULL);
+
+	for (; v >= 0x80; v >>= 7)
+		idx->data[idx->length++] = (unsigned char)(v | 0x80);
+
+	idx->data[idx->length++] = (unsigned char)v;
+}
+
+#define JI_VARINT_MAX 10
+
+/* Returns nonzero if the varint at *p runs past end or is longer than any
+ * 64-bit value needs. */
+static int ji_get_varint(const unsigned char **p, const unsigned char *end, uint64_t *v)
+{
+	int shift = 0;
+	int i;
+
+	for (*v = 0, i = 0; i < JI_VARINT_MAX && *p != end; i++, shift += 7) {
+		*v |= (uint64_t)(**p & 0x7f) << shift;
+
+		if (!(*(*p)++ & 0x80))
+			return 0;
+	}
+
+	return 1;
+}
+
+void json_index_init(struct json_index_t *idx, unsigned flags)
+{
+	memset(idx, 0, sizeof(*idx));
+	idx->flags = flags;
+}
+
+void json_index_destroy(struct json_index_t *idx)
+{
+	free(idx->data);
+	free(idx->checkpoints);
+	memset(idx, 0, sizeof(*idx));
+}
+
+void json_index_add(struct json_index_t *idx, const struct json_tokenizer_t *t)
+{
+	struct json_index_checkpoint_t cp;
+	struct json_index_entry_t e = { t->tok_offset, 0, 0 };
+	size_t column;
+
+	if (idx->flags & JSON_INDEX_LINES) {
+		json_tokenizer_token_position(t, &e.lines, &column);
+		e.line_start = e.offset - column;
+	}
+
+	if (idx->count % JSON_INDEX_STRIDE == 0) {
+		cp.at = idx->last;
+		cp.data = idx->length;
+		buf_append((char **)&idx->checkpoints, &idx->ncheckpoints,
+				&idx->checkpoints_capacity, sizeof(cp), (const char *)&cp, NULL);
+	}
+
+	ji_put_varint(idx, e.offset - idx->last.offset);
+
+	if (idx->flags & JSON_INDEX_LINES) {
+		ji_put_varint(idx, e.lines - idx->last.lines);
+		ji_put_varint(idx, e.offset - e.line_start);
+	}
+
+	idx->last = e;
+	idx->count++;
+}
+
+int json_index_get(const struct json_index_t *idx, size_t n,
+		struct json_index_entry_t *e)
+{
+	const struct json_index_checkpoint_t *cp;
+	const unsigned char *p;
+	const unsigned char *end = idx->data + idx->length;
+	uint64_t v[3];
+	size_t i;
+
+	if (n >= idx->count)
+		return 1;
+
+	cp = &idx->checkpoints[n / JSON_INDEX_STRIDE];
+	*e = cp->at;
+	p = idx->data + cp->data;
+
+	for (i = n / JSON_INDEX_STRIDE * JSON_INDEX_STRIDE; i <= n; i++) {
+		if (ji_get_varint(&p, end, &v[0]))
+			return 1;
+
+		e->offset += v[0];
+
+		if (idx->flags & JSON_INDEX_LINES) {
+			if (ji_get_varint(&p, end, &v[1]) || ji_get_varint(&p, end, &v[2]))
+				return 1;
+
+			e->lines += v[1];
+			e->line_start = e->offset - v[2];
+		}
+	}
+
+	return 0;
+}
+
+int json_index_parse(const struct json_index_t *idx, size_t n,
+		struct json_tokenizer_t *t, struct json_value_t *v)
+{
+	struct json_index_entry_t e;
+
+	if (json_index_get(idx, n, &e))
+		return 1;
+
+	if (idx->flags & JSON_INDEX_LINES)
+		json_tokenizer_start_at(t, e.offset, e.lines, e.line_start);
+	else
+		json_tokenizer_start_at(t, e.offset, 0, 0);
+
+	json_tokenizer_next(t);
+
+	return json_value_parse(t, v);
+}
+
+static int ji_write_u64(FILE *f, uint64_t v)
+{
+	unsigned char b[8];
+	int i;
+
+	for (i = 0; i < 8; i++, v >>= 8)
+		b[i] = (unsigned char)v;
+
+	return fwrite(b, 1, 8, f) != 8;
+}
+
+static int ji_read_u64(FILE *f, uint64_t *v)
+{
+	unsigned char b[8];
+	int i;
+
+	if (fread(b, 1, 8, f) != 8)
+		return 1;
+
+	for (*v = 0, i = 7; i >= 0; i--)
+		*v = *v << 8 | b[i];
+
+	return 0;
+}
+
+/* Layout, all integers little-endian 64-bit: "JSIX", version, flags, record
+ * count, the length of the varint data and the data itself. Checkpoints are
+ * rebuilt on reading. */
+int json_index_write(const struct json_index_t *idx, FILE *f)
+{
+	return fwrite(JSON_INDEX_MAGIC, 1, 4, f) != 4
+		|| ji_write_u64(f, JSON_INDEX_VERSION)
+		|| ji_write_u64(f, idx->flags)
+		|| ji_write_u64(f, idx->count)
+		|| ji_write_u64(f, idx->length)
+		|| fwrite(idx->data, 1, idx->length, f) != idx->length;
+}
+
+int json_index_read(struct json_index_t *idx, FILE *f)
+{
+	struct json_index_checkpoint_t cp;
+	struct json_index_entry_t e = { 0, 0, 0 };
+	const unsigned char *p;
+	const unsigned char *end;
+	char magic[4];
+	uint64_t version;
+	uint64_t flags;
+	uint64_t count;
+	uint64_t length;
+	uint64_t v;
+	size_t n;
+	size_t i;
+
+	json_index_destroy(idx);
+
+	if (fread(magic, 1, 4, f) != 4 || memcmp(magic, JSON_INDEX_MAGIC, 4)
+			|| ji_read_u64(f, &version) || version != JSON_INDEX_VERSION
+			|| ji_read_u64(f, &flags) || ji_read_u64(f, &count)
+			|| ji_read_u64(f, &length))
+		return 1;
+
+	idx->flags = (unsigned)flags;
+
+	/* The length is not trusted with an allocation before the data is
+	 * there: the buffer only grows as fast as the file delivers. */
+	while (idx->length < length) {
+		n = length - idx->length < JSON_INDEX_READ ? length - idx->length : JSON_INDEX_READ;
+		buf_ensure_capacity((char **)&idx->data, &idx->capacity, idx->length + n, NULL);
+
+		if (!idx->data || fread(idx->data + idx->length, 1, n, f) != n)
+			return 1;
+
+		idx->length += n;
+	}
+
+	p = idx->data;
+	end = p + idx->length;
+
+	for (i = 0; i < count; i++) {
+		if (i % JSON_INDEX_STRIDE == 0) {
+			cp.at = e;
+			cp.data = (size_t)(p - idx->data);
+			buf_append((char **)&idx->checkpoints, &idx->ncheckpoints,
+					&idx->checkpoints_capacity, sizeof(cp), (const char *)&cp, NULL);
+		}
+
+		if (ji_get_varint(&p, end, &v))
+			return 1;
+
+		e.offset += v;
+
+		if (idx->flags & JSON_INDEX_LINES) {
+			if (ji_get_varint(&p, end, &v))
+				return 1;
+
+			e.lines += v;
+
+			if (ji_get_varint(&p, end, &v))
+				return 1;
+
+			e.line_start = e.offset - v;
+		}
+
+		idx->count++;
+	}
+
+	idx->last = e;
+
+	return 0;
+}
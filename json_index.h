@@ -0,0 +1,77 @@
+#ifndef GRAMAS_JSON_INDEX_H
+#define GRAMAS_JSON_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "json.h"
+
+/* Where every record of a big input starts, so that record N can be parsed
+ * without tokenizing everything before it. A record is a top-level value, or
+ * with JSON_INDEX_ELEMENTS an element of a top-level array.
+ *
+ * Records are added in order as the input is parsed. Each is stored as the
+ * distance from the one before it, and with JSON_INDEX_LINES the newlines in
+ * between and its column, all as variable-length integers: a few bytes per
+ * record. Every JSON_INDEX_STRIDE records the full position is kept as well
+ * so that finding one never decodes more than a stride's worth.
+ *
+ * To parse record n, position the input at json_index_get()'s offset, for
+ * example with fd_reader_seek() or by handing the tokenizer a mapped file
+ * from there, and call json_index_parse() on a fresh tokenizer. */
+
+#define JSON_INDEX_LINES 1
+#define JSON_INDEX_ELEMENTS 2
+
+#define JSON_INDEX_STRIDE 128
+
+struct json_index_entry_t {
+	size_t offset;
+	size_t lines;
+	size_t line_start;
+};
+
+struct json_index_checkpoint_t {
+	struct json_index_entry_t at;
+	size_t data;
+};
+
+struct json_index_t {
+	unsigned flags;
+	size_t count;
+
+	unsigned char *data;
+	size_t length;
+	size_t capacity;
+
+	struct json_index_checkpoint_t *checkpoints;
+	size_t ncheckpoints;
+	size_t checkpoints_capacity;
+
+	struct json_index_entry_t last;
+};
+
+void json_index_init(struct json_index_t *idx, unsigned flags);
+void json_index_destroy(struct json_index_t *idx);
+
+/* Records that the current token of t starts the next record. */
+void json_index_add(struct json_index_t *idx, const struct json_tokenizer_t *t);
+
+/* Looks up record n. Returns nonzero if there is no such record. Without
+ * JSON_INDEX_LINES, lines and line_start are left at zero. */
+int json_index_get(const struct json_index_t *idx, size_t n,
+		struct json_index_entry_t *e);
+
+/* Parses record n into v with t, whose input must start at the record.
+ * Errors are reported at their place in the whole input if the index has
+ * JSON_INDEX_LINES. Returns nonzero on error, as json_value_parse() does. */
+int json_index_parse(const struct json_index_t *idx, size_t n,
+		struct json_tokenizer_t *t, struct json_value_t *v);
+
+/* Both return nonzero on failure. json_index_read() expects an initialized
+ * index and replaces its contents. */
+int json_index_write(const struct json_index_t *idx, FILE *f);
+int json_index_read(struct json_index_t *idx, FILE *f);
+
+#endif /* GRAMAS_JSON_INDEX_H */
@@ -0,0 +1,96 @@
+#ifndef GRAMAS_JSON_INTERNAL_H
+#define GRAMAS_JSON_INTERNAL_H
+
+/* Helpers shared by the parsers built on top of json_tokenizer_t. Not part of
+ * the public interface. */
+
+#include "json.h"
+
+#include <string.h>
+
+#if JSON_STATS
+#define JT_STAT(__t, __expr) ((void)((__t)->stats.__expr))
+#else
+#define JT_STAT(__t, __expr) ((void)0)
+#endif
+
+/* Counts the newlines in [begin, end) and remembers where the last line
+ * starts, offset being the position of begin in the input. */
+static inline void jt_count_lines(const char *begin, const char *end, size_t offset,
+		size_t *lines, size_t *line_start)
+{
+	const char *nl;
+
+	for (; (nl = memchr(begin, '\n', (size_t)(end - begin))); begin = nl + 1) {
+		++*lines;
+		*line_start = offset + (size_t)(nl + 1 - begin);
+		offset += (size_t)(nl + 1 - begin);
+	}
+}
+
+static inline void jt_report_error(struct json_tokenizer_t *t)
+{
+	size_t linenum;
+	size_t char_pos;
+
+	if (!t->error)
+		t->error = JSON_ERR_SYNTAX;
+
+	if (t->on_error) {
+		json_tokenizer_position(t, &linenum, &char_pos);
+		t->on_error(t->error_handler, t->error, t->token, t->length,
+				linenum, char_pos);
+		t->on_error = NULL;
+	}
+}
+
+static inline int jt_fail(struct json_tokenizer_t *t, enum json_error_e error)
+{
+	t->error = error;
+	return 1;
+}
+
+static inline int jt_depth_enter(struct json_tokenizer_t *t)
+{
+	if (++t->depth > t->limits.max_depth)
+		return jt_fail(t, JSON_ERR_DEPTH);
+
+#if JSON_STATS
+	if (t->depth > t->stats.max_depth)
+		t->stats.max_depth = t->depth;
+#endif
+
+	return 0;
+}
+
+/* Charges the value currently being built with another n bytes. */
+static inline int jt_account(struct json_tokenizer_t *t, size_t n)
+{
+	t->dom_bytes += n;
+
+	if (t->dom_bytes <= t->limits.max_total_bytes)
+		return 0;
+
+	return jt_fail(t, JSON_ERR_TOTAL_BYTES);
+}
+
+static inline int jt_consume_token(struct json_tokenizer_t *t, enum json_token_kind_e kind)
+{
+	if (t->kind != kind)
+		return 0;
+
+	json_tokenizer_next(t);
+
+	return 1;
+}
+
+/* Copies the string at the current token into out, reassembling it first if
+ * it arrives in JSON_TOK_STRING_CHUNK pieces, and advances past it. Returns
+ * nonzero without reporting if there is no string there or a limit is hit. */
+int jt_take_string(struct json_tokenizer_t *t, struct json_string_t *out);
+
+/* Appends v to the array being parsed, packing the array on its first
+ * element if pack_arrays is set. */
+void jt_array_append(struct json_tokenizer_t *t, struct json_value_t *a, struct json_value_t *v);
+
+#endif /* GRAMAS_JSON_INTERNAL_H */
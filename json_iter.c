@@ -0,0 +1,75 @@
+#include "json_iter.h"
+
+#include "json_internal.h"
+
+#include <string.h>
+
+int json_array_iter_open(struct json_array_iter_t *it, struct json_tokenizer_t *t)
+{
+	memset(it, 0, sizeof(*it));
+	it->t = t;
+
+	if (!jt_consume_token(t, JSON_TOK_LEFT_SQUARE_BRACE)) {
+		jt_report_error(t);
+		return 1;
+	}
+
+	if (jt_depth_enter(t)) {
+		t->depth--;
+		jt_report_error(t);
+		return 1;
+	}
+
+	if (jt_consume_token(t, JSON_TOK_RIGHT_SQUARE_BRACE)) {
+		t->depth--;
+		it->done = 1;
+	}
+
+	return 0;
+}
+
+int json_array_iter_next(struct json_array_iter_t *it, struct json_value_t *v)
+{
+	struct json_tokenizer_t *t = it->t;
+	int error;
+
+	if (it->done)
+		return 0;
+
+	if (it->index >= t->limits.max_container_elements) {
+		jt_fail(t, JSON_ERR_CONTAINER_ELEMENTS);
+		goto err;
+	}
+
+	t->dom_bytes = 0;
+
+	if (it->projection)
+		error = json_value_parse_projected(t, it->projection, v);
+	else
+		error = json_value_parse(t, v);
+
+	if (error)
+		goto err;
+
+	it->index++;
+
+	if (jt_consume_token(t, JSON_TOK_COMMA))
+		return 1;
+
+	if (!jt_consume_token(t, JSON_TOK_RIGHT_SQUARE_BRACE)) {
+		json_value_destroy_a(v, t->allocator);
+		goto err;
+	}
+
+	t->depth--;
+	it->done = 1;
+
+	return 1;
+
+err:
+	jt_report_error(t);
+	t->depth--;
+	it->done = 1;
+
+	return -1;
+}
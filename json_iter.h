@@ -0,0 +1,45 @@
+#ifndef GRAMAS_JSON_ITER_H
+#define GRAMAS_JSON_ITER_H
+
+#include "json.h"
+#include "json_projection.h"
+
+#include <stddef.h>
+
+/* Walks the elements of an array one at a time without building the array
+ * itself, so a top-level array of millions of records can be processed with
+ * memory bounded by its largest element:
+ *
+ *      struct json_array_iter_t it;
+ *      struct json_value_t v = { 0 };
+ *
+ *      if (json_array_iter_open(&it, t))
+ *          return error;
+ *
+ *      while ((r = json_array_iter_next(&it, &v)) > 0) {
+ *          use(&v);
+ *          json_value_destroy_a(&v, t->allocator);
+ *      }
+ *
+ * Limits apply as if the array was parsed whole, except that max_total_bytes
+ * is charged per element. */
+
+struct json_array_iter_t {
+	struct json_tokenizer_t *t;
+
+	/* If set, elements are parsed with json_value_parse_projected(). */
+	const struct json_projection_t *projection;
+
+	size_t index;
+	int done;
+};
+
+/* Consumes the opening bracket of the array at the current token. Returns
+ * nonzero, after reporting through on_error, if there is no array there. */
+int json_array_iter_open(struct json_array_iter_t *it, struct json_tokenizer_t *t);
+
+/* Parses the next element into v. Returns 1 if there was one, 0 once the
+ * closing bracket has been consumed and -1 on error. */
+int json_array_iter_next(struct json_array_iter_t *it, struct json_value_t *v);
+
+#endif /* GRAMAS_JSON_ITER_H */
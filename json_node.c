@@ -0,0 +1,418 @@
+#include "json_node.h"
+
+#include "buf.h"
+#include "json_internal.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(sizeof(struct json_node_t) == 16, "json_node_t must stay 16 bytes");
+
+/* Children of the containers being parsed, innermost last. */
+struct jn_stack {
+	struct json_node_t *nodes;
+	size_t length;
+	size_t capacity;
+};
+
+/* The fields of an object as they sit among its children. */
+struct jn_field {
+	struct json_node_t key;
+	struct json_node_t value;
+};
+
+static int jn_parse(struct json_tokenizer_t *t, struct jn_stack *s, struct json_node_t *n);
+
+static int jn_string_cmp(const struct json_node_t *a, const char *b, size_t b_length)
+{
+	size_t a_length = json_node_string_length(a);
+
+	if (a_length > b_length)
+		return 1;
+
+	if (a_length < b_length)
+		return -1;
+
+	return memcmp(json_node_string_text(a), b, a_length);
+}
+
+static int jn_field_cmp(const struct jn_field *a, const struct jn_field *b)
+{
+	return jn_string_cmp(&a->key, json_node_string_text(&b->key),
+			json_node_string_length(&b->key));
+}
+
+static int jn_take_string(struct json_tokenizer_t *t, struct json_node_t *n)
+{
+	struct json_string_t str = { 0 };
+	size_t length;
+
+	if (jt_take_string(t, &str))
+		return 1;
+
+	length = json_string_length(&str);
+
+	if (length > UINT32_MAX) {
+		json_string_destroy_a(&str, t->allocator);
+		return jt_fail(t, JSON_ERR_STRING_LENGTH);
+	}
+
+	memset(n, 0, sizeof(*n));
+
+	if (length <= JSON_NODE_INLINE_MAX) {
+		memcpy(n, json_string_text(&str), length);
+		n->small_length = (uint8_t)length;
+		json_string_destroy_a(&str, t->allocator);
+	} else if (json_string_is_inline(&str)) {
+		n->text = json_alloc(t->allocator, length);
+		memcpy(n->text, json_string_text(&str), length);
+		n->length = (uint32_t)length;
+	} else {
+		/* Both were allocated at exactly length bytes. */
+		n->text = str.heap.text;
+		n->length = (uint32_t)length;
+	}
+
+	n->type = JSON_STRING;
+
+	return 0;
+}
+
+/* Moves the children pushed since base into a new array owned by n. */
+static void jn_close(struct json_tokenizer_t *t, struct jn_stack *s, size_t base,
+		enum json_value_type_e type, struct json_node_t *n)
+{
+	size_t count = s->length - base;
+
+	memset(n, 0, sizeof(*n));
+	n->type = (uint8_t)type;
+	n->length = (uint32_t)(type == JSON_OBJECT ? count / 2 : count);
+
+	if (count) {
+		n->children = json_alloc(t->allocator, count * sizeof(*n));
+		memcpy(n->children, s->nodes + base, count * sizeof(*n));
+	}
+
+	s->length = base;
+}
+
+/* Drops the children pushed since base. */
+static void jn_unwind(struct json_tokenizer_t *t, struct jn_stack *s, size_t base)
+{
+	while (s->length > base)
+		json_node_destroy_a(&s->nodes[--s->length], t->allocator);
+}
+
+static void jn_push(struct json_tokenizer_t *t, struct jn_stack *s, const struct json_node_t *n)
+{
+	buf_append((char **)&s->nodes, &s->length, &s->capacity, sizeof(*n),
+			(const char *)n, t->allocator);
+}
+
+static int jn_parse_object(struct json_tokenizer_t *t, struct jn_stack *s, struct json_node_t *n)
+{
+	struct json_node_t key;
+	struct json_node_t val;
+	size_t base = s->length;
+	size_t count = 0;
+
+	jt_consume_token(t, JSON_TOK_LEFT_CURLY_BRACE);
+
+	if (jt_depth_enter(t))
+		goto err;
+
+	if (jt_consume_token(t, JSON_TOK_RIGHT_CURLY_BRACE))
+		goto end;
+
+	do {
+		if (count >= t->limits.max_container_elements || count >= UINT32_MAX) {
+			jt_fail(t, JSON_ERR_CONTAINER_ELEMENTS);
+			goto err;
+		}
+
+		if (jt_account(t, 2 * sizeof(*n)))
+			goto err;
+
+		if (jn_take_string(t, &key))
+			goto err;
+
+		jn_push(t, s, &key);
+
+		if (!jt_consume_token(t, JSON_TOK_COLON) || jn_parse(t, s, &val))
+			goto err;
+
+		jn_push(t, s, &val);
+		count++;
+	} while (jt_consume_token(t, JSON_TOK_COMMA));
+
+	if (!jt_consume_token(t, JSON_TOK_RIGHT_CURLY_BRACE))
+		goto err;
+
+	if (count > 1) {
+		qsort(s->nodes + base, count, sizeof(struct jn_field),
+				(int(*)(const void*, const void*))jn_field_cmp);
+		JT_STAT(t, object_sorts++);
+	}
+
+end:
+	t->depth--;
+	jn_close(t, s, base, JSON_OBJECT, n);
+
+	return 0;
+
+err:
+	jt_report_error(t);
+	t->depth--;
+	jn_unwind(t, s, base);
+
+	return 1;
+}
+
+static int jn_parse_array(struct json_tokenizer_t *t, struct jn_stack *s, struct json_node_t *n)
+{
+	struct json_node_t val;
+	size_t base = s->length;
+	size_t count = 0;
+
+	jt_consume_token(t, JSON_TOK_LEFT_SQUARE_BRACE);
+
+	if (jt_depth_enter(t))
+		goto err;
+
+	if (jt_consume_token(t, JSON_TOK_RIGHT_SQUARE_BRACE))
+		goto end;
+
+	do {
+		if (count >= t->limits.max_container_elements || count >= UINT32_MAX) {
+			jt_fail(t, JSON_ERR_CONTAINER_ELEMENTS);
+			goto err;
+		}
+
+		if (jt_account(t, sizeof(*n)))
+			goto err;
+
+		if (jn_parse(t, s, &val))
+			goto err;
+
+		jn_push(t, s, &val);
+		count++;
+	} while (jt_consume_token(t, JSON_TOK_COMMA));
+
+	if (!jt_consume_token(t, JSON_TOK_RIGHT_SQUARE_BRACE))
+		goto err;
+
+end:
+	t->depth--;
+	jn_close(t, s, base, JSON_ARRAY, n);
+
+	return 0;
+
+err:
+	jt_report_error(t);
+	t->depth--;
+	jn_unwind(t, s, base);
+
+	return 1;
+}
+
+static int jn_parse(struct json_tokenizer_t *t, struct jn_stack *s, struct json_node_t *n)
+{
+	memset(n, 0, sizeof(*n));
+
+	switch (t->kind) {
+		case JSON_TOK_LEFT_CURLY_BRACE:
+			return jn_parse_object(t, s, n);
+		case JSON_TOK_LEFT_SQUARE_BRACE:
+			return jn_parse_array(t, s, n);
+		case JSON_TOK_STRING:
+		case JSON_TOK_STRING_CHUNK:
+			if (jn_take_string(t, n)) {
+				jt_report_error(t);
+				return 1;
+			}
+
+			return 0;
+		case JSON_TOK_INT:
+			n->type = JSON_INT;
+			n->n_int = strtoll(t->token, NULL, 10);
+			break;
+		case JSON_TOK_FLOAT:
+			n->type = JSON_FLOAT;
+			n->n_float = strtod(t->token, NULL);
+			break;
+		case JSON_TOK_NAKED_WORD:
+			if (strcmp(t->token, "false") == 0) {
+				n->type = JSON_BOOL;
+			} else if (strcmp(t->token, "true") == 0) {
+				n->type = JSON_BOOL;
+				n->n_int = 1;
+			} else if (strcmp(t->token, "null") == 0) {
+				n->type = JSON_NULL;
+			} else {
+				jt_report_error(t);
+				return 1;
+			}
+
+			break;
+		default:
+			jt_report_error(t);
+			return 1;
+	}
+
+	json_tokenizer_next(t);
+
+	return 0;
+}
+
+int json_node_parse(struct json_tokenizer_t *t, struct json_node_t *n)
+{
+	struct jn_stack s = { 0 };
+	int error;
+
+	if (t->depth == 0)
+		t->dom_bytes = 0;
+
+	json_node_destroy_a(n, t->allocator);
+	error = jn_parse(t, &s, n);
+	json_free(t->allocator, s.nodes, s.capacity * sizeof(*s.nodes));
+
+	return error;
+}
+
+const struct json_node_t *json_node_get(const struct json_node_t *n, const char *name)
+{
+	size_t length = strlen(name) + 1;
+	size_t lo = 0;
+	size_t hi;
+	size_t mid;
+	int cmp;
+
+	if (n->type != JSON_OBJECT)
+		return NULL;
+
+	for (hi = n->length; lo < hi;) {
+		mid = lo + (hi - lo) / 2;
+		cmp = jn_string_cmp(json_node_key(n, mid), name, length);
+
+		if (cmp == 0)
+			return json_node_field(n, mid);
+
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+void json_node_destroy(struct json_node_t *n)
+{
+	json_node_destroy_a(n, NULL);
+}
+
+void json_node_destroy_a(struct json_node_t *n, const struct json_allocator_t *allocator)
+{
+	size_t count = n->length;
+	size_t i;
+
+	switch (n->type) {
+		case JSON_OBJECT:
+			count *= 2;
+			/* fall through */
+		case JSON_ARRAY:
+			for (i = 0; i < count; i++)
+				json_node_destroy_a(&n->children[i], allocator);
+
+			json_free(allocator, n->children, count * sizeof(*n));
+			break;
+
+		case JSON_STRING:
+			if (!n->small_length)
+				json_free(allocator, n->text, n->length);
+
+			break;
+	}
+
+	memset(n, 0, sizeof(*n));
+}
+
+#define WRITE_LITERAL(__fn, __sink, __str) (__fn)((__sink), __str, sizeof(__str) - 1)
+
+static void jn_string_to_str(
+		const struct json_node_t *n,
+		void *sink,
+		void (*sink_write)(void *sink, const char *text, size_t length))
+{
+	WRITE_LITERAL(sink_write, sink, "\"");
+	sink_write(sink, json_node_string_text(n), json_node_string_length(n) - 1);
+	WRITE_LITERAL(sink_write, sink, "\"");
+}
+
+void json_node_to_string(
+		const struct json_node_t *n,
+		void *sink,
+		void (*sink_write)(void *sink, const char *text, size_t length))
+{
+	size_t i;
+	char numbuf[128];
+	int chars_written;
+
+	switch (n->type) {
+		case JSON_OBJECT:
+			WRITE_LITERAL(sink_write, sink, "{");
+
+			for (i = 0; i < n->length; i++) {
+				if (i)
+					WRITE_LITERAL(sink_write, sink, ", ");
+
+				jn_string_to_str(json_node_key(n, i), sink, sink_write);
+				WRITE_LITERAL(sink_write, sink, ": ");
+				json_node_to_string(json_node_field(n, i), sink, sink_write);
+			}
+
+			WRITE_LITERAL(sink_write, sink, "}");
+			break;
+
+		case JSON_ARRAY:
+			WRITE_LITERAL(sink_write, sink, "[");
+
+			for (i = 0; i < n->length; i++) {
+				if (i)
+					WRITE_LITERAL(sink_write, sink, ", ");
+
+				json_node_to_string(json_node_element(n, i), sink, sink_write);
+			}
+
+			WRITE_LITERAL(sink_write, sink, "]");
+			break;
+
+		case JSON_STRING:
+			jn_string_to_str(n, sink, sink_write);
+			break;
+
+		case JSON_INT:
+			chars_written = snprintf(numbuf, sizeof(numbuf), "%" PRIi64, n->n_int);
+			sink_write(sink, numbuf, chars_written);
+			break;
+
+		case JSON_FLOAT:
+			chars_written = snprintf(numbuf, sizeof(numbuf), "%g", n->n_float);
+			sink_write(sink, numbuf, chars_written);
+			break;
+
+		case JSON_BOOL:
+			if (n->n_int) {
+				WRITE_LITERAL(sink_write, sink, "true");
+			} else {
+				WRITE_LITERAL(sink_write, sink, "false");
+			}
+			break;
+
+		case JSON_NULL:
+			WRITE_LITERAL(sink_write, sink, "null");
+			break;
+	}
+}
@@ -0,0 +1,88 @@
+#ifndef GRAMAS_JSON_NODE_H
+#define GRAMAS_JSON_NODE_H
+
+#include "json.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* A compact alternative to json_value_t for trees that are read far more
+ * often than they are changed. Every node is 16 bytes, half a json_value_t:
+ * scalars are stored inline, lengths are 32 bits and containers carry no
+ * capacity, since json_node_parse() collects the children of a container on
+ * a scratch stack and gives them an exactly sized array once it is closed.
+ * Strings of up to JSON_NODE_INLINE_MAX bytes, counting the NUL, are kept in
+ * the node itself.
+ *
+ * An object's children are its fields as key and value pairs, sorted by key
+ * the way json_value_object_put() sorts them. Lengths are counted like
+ * json_string_t counts them, terminating NUL included, and
+ * strings, arrays and objects that do not fit in 32 bits are rejected with
+ * JSON_ERR_STRING_LENGTH and JSON_ERR_CONTAINER_ELEMENTS. */
+
+#define JSON_NODE_INLINE_MAX 12
+
+struct json_node_t {
+	union {
+		struct json_node_t *children;
+		char *text;
+		int64_t n_int;
+		double n_float;
+	};
+	/* Elements, fields or string bytes. Overwritten by inline strings. */
+	uint32_t length;
+	uint8_t type;	/* enum json_value_type_e */
+	uint8_t small_length;	/* Nonzero for inline strings */
+	uint16_t reserved;
+};
+
+static inline size_t json_node_string_length(const struct json_node_t *n)
+{
+	return n->small_length ? n->small_length : n->length;
+}
+
+static inline const char *json_node_string_text(const struct json_node_t *n)
+{
+	return n->small_length ? (const char *)n : n->text;
+}
+
+/* Elements of an array or fields of an object. */
+static inline size_t json_node_count(const struct json_node_t *n)
+{
+	return n->length;
+}
+
+static inline const struct json_node_t *json_node_element(const struct json_node_t *n, size_t i)
+{
+	return &n->children[i];
+}
+
+static inline const struct json_node_t *json_node_key(const struct json_node_t *n, size_t i)
+{
+	return &n->children[2 * i];
+}
+
+static inline const struct json_node_t *json_node_field(const struct json_node_t *n, size_t i)
+{
+	return &n->children[2 * i + 1];
+}
+
+/* Parses the value at the current token like json_value_parse() does, with
+ * the same limits, memory coming from the tokenizer's allocator. */
+int json_node_parse(struct json_tokenizer_t *t, struct json_node_t *n);
+
+/* Finds the field of object n called name by binary search, or returns
+ * NULL. */
+const struct json_node_t *json_node_get(const struct json_node_t *n, const char *name);
+
+void json_node_destroy(struct json_node_t *n);
+void json_node_destroy_a(struct json_node_t *n, const struct json_allocator_t *allocator);
+
+/* Writes n out exactly as json_value_to_string() writes the same value. */
+void json_node_to_string(
+		const struct json_node_t *n,
+		void *sink,
+		void (*sink_write)(void *sink, const char *text, size_t length));
+
+#endif /* GRAMAS_JSON_NODE_H */
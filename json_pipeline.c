@@ -0,0 +1,277 @@
+#include "json_pipeline.h"
+
+#include "buf.h"
+#include "json_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Catches the line count up with the producer's tokenizer. Only the bytes
+ * read since the last token are scanned, unless the input window changed. */
+static void jpl_count_lines(struct json_pipeline_t *p)
+{
+	const struct json_tokenizer_t *t = &p->producer;
+
+	if (t->in_begin != p->lines_window || t->in_offset != p->lines_window_offset) {
+		p->lines_window = t->in_begin;
+		p->lines_window_offset = t->in_offset;
+		p->lines_at = t->in_begin;
+		p->lines = t->in_lines;
+		p->line_start = t->in_line_start;
+	}
+
+	if (!t->in_begin)
+		return;
+
+	jt_count_lines(p->lines_at, t->in_at,
+			t->in_offset + (size_t)(p->lines_at - t->in_begin),
+			&p->lines, &p->line_start);
+	p->lines_at = t->in_at;
+}
+
+static void jpl_push(struct json_pipeline_t *p, struct json_pipeline_batch_t *b)
+{
+	struct json_tokenizer_t *t = &p->producer;
+	struct json_pipeline_token_t *tok = &b->tokens[b->count++];
+
+	jpl_count_lines(p);
+
+	tok->kind = t->kind;
+	tok->c = t->c;
+	tok->text = b->text_length;
+	tok->length = t->length;
+	tok->tok_offset = t->tok_offset;
+	tok->offset = json_tokenizer_offset(t);
+	tok->linenum = p->lines;
+	tok->line_start = p->line_start;
+
+	/* Error tokens are not NUL-terminated. */
+	buf_ensure_capacity(&b->text, &b->text_capacity, b->text_length + t->length + 1, NULL);
+	memcpy(b->text + b->text_length, t->token, t->length);
+	b->text[b->text_length + t->length] = '\0';
+	b->text_length += t->length + 1;
+}
+
+/* Wakes the other side if it has gone to sleep on cond. A sleeper sets its
+ * flag before it looks at the ring one last time, and the index it waits on
+ * is moved before the flag is read here, so one of the two always sees the
+ * other. */
+static void jpl_wake(struct json_pipeline_t *p, atomic_int *sleeping, pthread_cond_t *cond)
+{
+	if (!atomic_load(sleeping))
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	pthread_cond_signal(cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+/* Hands the batch being filled over to the parser. */
+static void jpl_publish(struct json_pipeline_t *p)
+{
+	p->filling->error = p->producer.error;
+	p->filling = NULL;
+
+	atomic_store(&p->head, atomic_load_explicit(&p->head, memory_order_relaxed) + 1);
+	jpl_wake(p, &p->parser_sleeping, &p->not_empty);
+}
+
+/* Waits for room in the ring. Returns nonzero if the pipeline is stopped. */
+static int jpl_claim(struct json_pipeline_t *p)
+{
+	size_t head = atomic_load_explicit(&p->head, memory_order_relaxed);
+
+	if (head - atomic_load_explicit(&p->tail, memory_order_acquire) == p->batch_count) {
+		pthread_mutex_lock(&p->lock);
+		atomic_store(&p->producer_sleeping, 1);
+
+		while (head - atomic_load(&p->tail) == p->batch_count && !atomic_load(&p->stop))
+			pthread_cond_wait(&p->not_full, &p->lock);
+
+		atomic_store(&p->producer_sleeping, 0);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	if (atomic_load(&p->stop))
+		return 1;
+
+	p->filling = &p->batches[head % p->batch_count];
+	p->filling->count = 0;
+	p->filling->text_length = 0;
+
+	return 0;
+}
+
+/* Whatever has been tokenized goes to the parser before the producer waits
+ * for more input, so an error or a complete value on a slow stream is seen
+ * without waiting for a full batch. */
+static int jpl_fill(void *arg, const char **begin, const char **end)
+{
+	struct json_pipeline_t *p = arg;
+
+	if (p->filling && p->filling->count)
+		jpl_publish(p);
+
+	if (atomic_load(&p->stop))
+		return EOF;
+
+	return p->cs_fill(p->cs, begin, end);
+}
+
+static void *jpl_produce(void *arg)
+{
+	struct json_pipeline_t *p = arg;
+	enum json_token_kind_e kind;
+
+	do {
+		kind = json_tokenizer_next(&p->producer);
+
+		if (!p->filling && jpl_claim(p))
+			return NULL;
+
+		jpl_push(p, p->filling);
+
+		if (kind == JSON_TOK_NONE || kind == JSON_TOK_ERROR
+				|| p->filling->count == JSON_PIPELINE_BATCH_TOKENS
+				|| p->filling->text_length >= JSON_PIPELINE_BATCH_TEXT)
+			jpl_publish(p);
+	} while (kind != JSON_TOK_NONE && kind != JSON_TOK_ERROR);
+
+	return NULL;
+}
+
+static enum json_token_kind_e jpl_next(struct json_tokenizer_t *t)
+{
+	struct json_pipeline_t *p = t->cs;
+	const struct json_pipeline_token_t *tok;
+	size_t tail;
+
+	/* The producer stops after the last token. */
+	if (p->current && (t->kind == JSON_TOK_NONE || t->kind == JSON_TOK_ERROR))
+		return t->kind;
+
+	if (!p->current || p->at == p->current->count) {
+		tail = atomic_load_explicit(&p->tail, memory_order_relaxed);
+
+		if (p->current) {
+			atomic_store(&p->tail, ++tail);
+			jpl_wake(p, &p->producer_sleeping, &p->not_full);
+		}
+
+		if (atomic_load_explicit(&p->head, memory_order_acquire) == tail) {
+			pthread_mutex_lock(&p->lock);
+			atomic_store(&p->parser_sleeping, 1);
+
+			while (atomic_load(&p->head) == tail)
+				pthread_cond_wait(&p->not_empty, &p->lock);
+
+			atomic_store(&p->parser_sleeping, 0);
+			pthread_mutex_unlock(&p->lock);
+		}
+
+		p->current = &p->batches[tail % p->batch_count];
+		p->at = 0;
+	}
+
+	tok = &p->current->tokens[p->at++];
+
+	t->kind = tok->kind;
+	t->c = tok->c;
+	t->token = p->current->text + tok->text;
+	t->length = tok->length;
+	t->tok_offset = tok->tok_offset;
+	t->in_offset = tok->offset;
+	t->in_lines = tok->linenum;
+	t->in_line_start = tok->line_start;
+
+	if (t->kind == JSON_TOK_ERROR && p->current->error)
+		t->error = p->current->error;
+
+	return t->kind;
+}
+
+void json_pipeline_init(struct json_pipeline_t *p, void *cs,
+		int (*cs_fill)(void *, const char **, const char **),
+		size_t batch_count)
+{
+	memset(p, 0, sizeof(*p));
+	json_tokenizer_init(&p->tokenizer, p, NULL);
+	p->tokenizer.cs_next = jpl_next;
+	p->cs = cs;
+	p->cs_fill = cs_fill;
+	json_tokenizer_init_buffered(&p->producer, p, jpl_fill);
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->not_full, NULL);
+	pthread_cond_init(&p->not_empty, NULL);
+	p->batch_count = batch_count ? batch_count : JSON_PIPELINE_DEFAULT_BATCHES;
+}
+
+int json_pipeline_start(struct json_pipeline_t *p)
+{
+	p->producer.limits.max_token_length = p->tokenizer.limits.max_token_length;
+	p->producer.limits.max_string_length = p->tokenizer.limits.max_string_length;
+	p->producer.string_chunk_size = p->tokenizer.string_chunk_size;
+
+	if (!(p->batches = calloc(p->batch_count, sizeof(*p->batches))))
+		return 1;
+
+	if (pthread_create(&p->thread, NULL, jpl_produce, p))
+		return 1;
+
+	p->started = 1;
+
+	return 0;
+}
+
+/* Wakes the producer if it waits for room, and has the source give up if it
+ * waits for input, which may never come. */
+static void jpl_stop(struct json_pipeline_t *p)
+{
+	if (!p->started)
+		return;
+
+	atomic_store(&p->stop, 1);
+
+	pthread_mutex_lock(&p->lock);
+	pthread_cond_signal(&p->not_full);
+	pthread_mutex_unlock(&p->lock);
+
+	if (p->cs_interrupt)
+		p->cs_interrupt(p->cs);
+
+	pthread_join(p->thread, NULL);
+	p->started = 0;
+}
+
+void json_pipeline_stats(struct json_pipeline_t *p, struct json_stats_t *stats)
+{
+	struct json_stats_t producer;
+
+	jpl_stop(p);
+	json_tokenizer_stats(&p->tokenizer, stats);
+	json_tokenizer_stats(&p->producer, &producer);
+	memcpy(stats->tokens, producer.tokens, sizeof(stats->tokens));
+	stats->token_reallocs = producer.token_reallocs;
+}
+
+void json_pipeline_destroy(struct json_pipeline_t *p)
+{
+	size_t i;
+
+	jpl_stop(p);
+
+	for (i = 0; p->batches && i < p->batch_count; i++)
+		json_free(NULL, p->batches[i].text, p->batches[i].text_capacity);
+
+	free(p->batches);
+
+	/* The token text belonged to a batch. */
+	p->tokenizer.token = NULL;
+	p->tokenizer.capacity = 0;
+	json_tokenizer_destroy(&p->tokenizer);
+	json_tokenizer_destroy(&p->producer);
+	pthread_cond_destroy(&p->not_empty);
+	pthread_cond_destroy(&p->not_full);
+	pthread_mutex_destroy(&p->lock);
+}
@@ -0,0 +1,128 @@
+#ifndef GRAMAS_JSON_PIPELINE_H
+#define GRAMAS_JSON_PIPELINE_H
+
+#include "json.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+/* Tokenizes on one thread and parses on another. A producer thread runs its
+ * own tokenizer over the input and hands the tokens over in batches through a
+ * single-producer, single-consumer ring; the parsing side reads them through
+ * an ordinary tokenizer, so json_value_parse() and everything else built on
+ * json_tokenizer_t work unchanged:
+ *
+ *      struct json_pipeline_t p;
+ *
+ *      json_pipeline_init(&p, cs, cs_fill, 0);
+ *      p.cs_interrupt = cs_interrupt;
+ *      p.tokenizer.limits.max_depth = 64;
+ *
+ *      if (json_pipeline_start(&p))
+ *          return error;
+ *
+ *      json_tokenizer_next(&p.tokenizer);
+ *
+ *      while (p.tokenizer.kind != JSON_TOK_NONE)
+ *          if (json_value_parse(&p.tokenizer, &v)) ...
+ *
+ *      json_pipeline_destroy(&p);
+ *
+ * The ring's head and tail are atomics, each moved by one side only; the
+ * lock and the condition variables are only taken for the producer to sleep
+ * once every batch is waiting to be parsed, for the parser to sleep while the
+ * ring is empty, and to wake either. A batch is handed over when it is full or
+ * when the producer has to wait for input. Each token carries the input
+ * position it was read at, so errors are reported at the same line and column
+ * as without the pipeline.
+ *
+ * A producer still reading when the pipeline is destroyed is stopped through
+ * cs_interrupt, never cancelled: a thread cancelled inside the source could
+ * leave the source's own locks held. */
+
+#define JSON_PIPELINE_BATCH_TOKENS 1024
+#define JSON_PIPELINE_BATCH_TEXT (64 * 1024)
+#define JSON_PIPELINE_DEFAULT_BATCHES 8
+
+struct json_pipeline_token_t {
+	enum json_token_kind_e kind;
+	int c;
+	size_t text;
+	size_t length;
+	size_t tok_offset;
+	size_t offset;
+	size_t linenum;
+	size_t line_start;
+};
+
+struct json_pipeline_batch_t {
+	struct json_pipeline_token_t tokens[JSON_PIPELINE_BATCH_TOKENS];
+	size_t count;
+	char *text;
+	size_t text_length;
+	size_t text_capacity;
+	enum json_error_e error;
+};
+
+struct json_pipeline_t {
+	/* Parse from this one. Its limits and allocator may be changed until
+	 * json_pipeline_start(); token length limits and string_chunk_size are
+	 * handed on to the producer then. */
+	struct json_tokenizer_t tokenizer;
+
+	struct json_tokenizer_t producer;
+	pthread_t thread;
+	int started;
+
+	/* The ring. Only the producer moves head and only the parser moves
+	 * tail; lock is held just to sleep and to wake a sleeper. */
+	struct json_pipeline_batch_t *batches;
+	size_t batch_count;
+	atomic_size_t head;
+	atomic_size_t tail;
+	atomic_int stop;
+	atomic_int producer_sleeping;
+	atomic_int parser_sleeping;
+	pthread_mutex_t lock;
+	pthread_cond_t not_full;
+	pthread_cond_t not_empty;
+
+	void *cs;
+	int (*cs_fill)(void *, const char **, const char **);
+	/* May be set before json_pipeline_start(). Called from another thread,
+	 * it must make a cs_fill waiting for input, and every later one, return
+	 * EOF. Without it json_pipeline_destroy() waits for cs_fill to return. */
+	void (*cs_interrupt)(void *cs);
+
+	/* Consumer side. */
+	struct json_pipeline_batch_t *current;
+	size_t at;
+
+	/* Producer side: the batch being filled and how far newlines have
+	 * been counted. */
+	struct json_pipeline_batch_t *filling;
+	const char *lines_window;
+	size_t lines_window_offset;
+	const char *lines_at;
+	size_t lines;
+	size_t line_start;
+};
+
+/* batch_count may be 0 for JSON_PIPELINE_DEFAULT_BATCHES. The input is read
+ * the way json_tokenizer_init_buffered() does. */
+void json_pipeline_init(struct json_pipeline_t *p, void *cs,
+		int (*cs_fill)(void *, const char **, const char **),
+		size_t batch_count);
+
+/* Starts the producer thread. Returns nonzero if it could not be started. */
+int json_pipeline_start(struct json_pipeline_t *p);
+
+/* Stops the producer if it is still running and frees everything. */
+void json_pipeline_destroy(struct json_pipeline_t *p);
+
+/* The counters of both sides: tokens as the producer read them, the rest as
+ * the parser saw them. Stops the producer first. */
+void json_pipeline_stats(struct json_pipeline_t *p, struct json_stats_t *stats);
+
+#endif /* GRAMAS_JSON_PIPELINE_H */
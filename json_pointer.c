@@ -0,0 +1,159 @@
+#include "json_pointer.h"
+
+#include "buf.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Array indices are decimal without leading zeros. "-" and anything else that
+ * is not an index gets SIZE_MAX, which is never in range. */
+static size_t jptr_parse_index(const char *s, size_t length)
+{
+	size_t ret = 0;
+	size_t i;
+
+	if (!length || (s[0] == '0' && length > 1))
+		return SIZE_MAX;
+
+	for (i = 0; i < length; i++) {
+		if (s[i] < '0' || s[i] > '9')
+			return SIZE_MAX;
+
+		if (ret > (SIZE_MAX - 1 - (s[i] - '0')) / 10)
+			return SIZE_MAX;
+
+		ret = ret * 10 + (s[i] - '0');
+	}
+
+	return ret;
+}
+
+/* Unescapes the segment [begin, end) into p. */
+static int jptr_add_segment(struct json_pointer_t *p, const char *begin, const char *end)
+{
+	struct json_pointer_segment_t seg = { 0 };
+	char *name;
+	size_t length = 0;
+	const char *s;
+
+	name = malloc(end - begin + 1);
+
+	for (s = begin; s < end; s++) {
+		if (*s != '~') {
+			name[length++] = *s;
+		} else if (s + 1 < end && (s[1] == '0' || s[1] == '1')) {
+			name[length++] = s[1] == '0' ? '~' : '/';
+			s++;
+		} else {
+			free(name);
+			return 1;
+		}
+	}
+
+	name[length] = '\0';
+	seg.index = jptr_parse_index(name, length);
+	json_string_set(&seg.name, name, length + 1);
+	free(name);
+
+	buf_append((char **)&p->segments, &p->length, &p->capacity, sizeof(seg),
+			(const char *)&seg, NULL);
+
+	return 0;
+}
+
+int json_pointer_compile(struct json_pointer_t *p, const char *pointer)
+{
+	const char *end;
+
+	memset(p, 0, sizeof(*p));
+
+	if (!*pointer)
+		return 0;
+
+	if (*pointer != '/')
+		return 1;
+
+	do {
+		pointer++;
+		end = pointer + strcspn(pointer, "/");
+
+		if (jptr_add_segment(p, pointer, end)) {
+			json_pointer_destroy(p);
+			return 1;
+		}
+
+		pointer = end;
+	} while (*pointer);
+
+	return 0;
+}
+
+void json_pointer_destroy(struct json_pointer_t *p)
+{
+	size_t i;
+
+	for (i = 0; i < p->length; i++)
+		json_string_destroy(&p->segments[i].name);
+
+	free(p->segments);
+	memset(p, 0, sizeof(*p));
+}
+
+static const struct json_value_t *jptr_find_field(
+		const struct json_object_t *o,
+		const struct json_string_t *name)
+{
+	size_t lo = 0;
+	size_t hi = o->length;
+	size_t mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = json_string_cmp(name, &o->fields[mid].name);
+
+		if (cmp == 0)
+			return &o->fields[mid].value;
+
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+const struct json_value_t *json_pointer_eval(
+		const struct json_pointer_t *p,
+		const struct json_value_t *v)
+{
+	const struct json_pointer_segment_t *seg;
+	size_t i;
+
+	for (i = 0; v && i < p->length; i++) {
+		seg = &p->segments[i];
+
+		switch (v->type) {
+			case JSON_OBJECT:
+				v = jptr_find_field(&v->object, &seg->name);
+				break;
+
+			case JSON_ARRAY:
+				/* Packed elements are not json_value_t. */
+				if (v->packing != JSON_ARRAY_VALUES)
+					v = NULL;
+				else
+					v = seg->index < v->array.length ? &v->array.values[seg->index] : NULL;
+
+				break;
+
+			default:
+				v = NULL;
+				break;
+		}
+	}
+
+	return v;
+}
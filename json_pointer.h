@@ -0,0 +1,38 @@
+#ifndef GRAMAS_JSON_POINTER_H
+#define GRAMAS_JSON_POINTER_H
+
+#include "json.h"
+
+#include <stddef.h>
+
+/* RFC 6901 JSON Pointers, compiled once and evaluated against any number of
+ * documents. Compilation splits the pointer into segments, undoes the ~0 and
+ * ~1 escapes and pre-parses array indices, so evaluation is one binary search
+ * per object step (fields are kept sorted by json_string_cmp()) and one
+ * bounds check per array step. */
+
+struct json_pointer_segment_t {
+	struct json_string_t name;	/* Includes the terminating NUL, like field names */
+	size_t index;	/* SIZE_MAX unless the segment is a valid array index */
+};
+
+struct json_pointer_t {
+	size_t length;
+	size_t capacity;
+	struct json_pointer_segment_t *segments;
+};
+
+/* Returns nonzero and leaves p empty if pointer is not a valid JSON Pointer.
+ * The empty string refers to the whole document. */
+int json_pointer_compile(struct json_pointer_t *p, const char *pointer);
+void json_pointer_destroy(struct json_pointer_t *p);
+
+/* Returns the value p refers to inside v or NULL if there is none. The
+ * elements of packed arrays have no json_value_t to point to, so pointers
+ * into them find nothing; use json_value_array_ints() and
+ * json_value_array_floats() for those. */
+const struct json_value_t *json_pointer_eval(
+		const struct json_pointer_t *p,
+		const struct json_value_t *v);
+
+#endif /* GRAMAS_JSON_POINTER_H */
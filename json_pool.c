@@ -0,0 +1,152 @@
+#include "json_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_CLASSES 15	/* 16 << 0 ... 16 << 7 and 24 << 0 ... 24 << 6 */
+
+struct pool_block {
+	struct pool_block *next;
+};
+
+struct pool_list {
+	struct pool_block *head;
+	size_t count;
+};
+
+static _Thread_local struct pool_list pool_lists[POOL_CLASSES];
+
+static inline int floor_log2(size_t n)
+{
+#if __GNUC__
+	return (int)(sizeof(n) * 8 - 1) - __builtin_clzl(n);
+#else
+	int ret = 0;
+
+	while (n >>= 1)
+		ret++;
+
+	return ret;
+#endif
+}
+
+/* Classes alternate between 16 << k and 24 << k so that the 4, 8, 16 and 32
+ * element arrays of both json_value_t and json_kv_pair_t fit exactly. */
+static inline int pool_class(size_t size)
+{
+	int log;
+
+	if (size <= 16)
+		return 0;
+
+	log = floor_log2(size - 1);
+
+	if (size <= (size_t)3 << (log - 1))
+		return 2 * (log - 4) + 1;
+
+	return 2 * (log - 4) + 2;
+}
+
+static inline size_t pool_class_size(int cls)
+{
+	if (cls & 1)
+		return (size_t)24 << (cls / 2);
+
+	return (size_t)16 << (cls / 2);
+}
+
+static void *pool_alloc(void *ctx, size_t size)
+{
+	struct pool_list *list;
+	struct pool_block *block;
+	int cls;
+
+	(void)ctx;
+
+	if (size > JSON_POOL_MAX_BLOCK)
+		return malloc(size);
+
+	cls = pool_class(size);
+	list = &pool_lists[cls];
+
+	if (!list->head)
+		return malloc(pool_class_size(cls));
+
+	block = list->head;
+	list->head = block->next;
+	list->count--;
+
+	return block;
+}
+
+static void pool_free(void *ctx, void *ptr, size_t size)
+{
+	struct pool_list *list;
+	struct pool_block *block;
+	int cls;
+
+	(void)ctx;
+
+	if (size > JSON_POOL_MAX_BLOCK) {
+		free(ptr);
+		return;
+	}
+
+	cls = pool_class(size);
+	list = &pool_lists[cls];
+
+	if (list->count >= JSON_POOL_CLASS_BYTES / pool_class_size(cls)) {
+		free(ptr);
+		return;
+	}
+
+	block = ptr;
+	block->next = list->head;
+	list->head = block;
+	list->count++;
+}
+
+static void *pool_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size)
+{
+	void *ret;
+
+	if (!ptr)
+		return pool_alloc(ctx, new_size);
+
+	if (old_size > JSON_POOL_MAX_BLOCK && new_size > JSON_POOL_MAX_BLOCK)
+		return realloc(ptr, new_size);
+
+	if (old_size <= JSON_POOL_MAX_BLOCK && new_size <= JSON_POOL_MAX_BLOCK
+			&& pool_class(old_size) == pool_class(new_size))
+		return ptr;
+
+	if (!(ret = pool_alloc(ctx, new_size)))
+		return NULL;
+
+	memcpy(ret, ptr, old_size < new_size ? old_size : new_size);
+	pool_free(ctx, ptr, old_size);
+
+	return ret;
+}
+
+const struct json_allocator_t json_pool_allocator = {
+	.ctx = NULL,
+	.alloc = pool_alloc,
+	.realloc = pool_realloc,
+	.free = pool_free,
+};
+
+void json_pool_trim(void)
+{
+	struct pool_block *block;
+	int cls;
+
+	for (cls = 0; cls < POOL_CLASSES; cls++) {
+		while ((block = pool_lists[cls].head)) {
+			pool_lists[cls].head = block->next;
+			free(block);
+		}
+
+		pool_lists[cls].count = 0;
+	}
+}
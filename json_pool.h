@@ -0,0 +1,25 @@
+#ifndef GRAMAS_JSON_POOL_H
+#define GRAMAS_JSON_POOL_H
+
+#include "json_alloc.h"
+
+/* A size-class pool for the small, similarly sized blocks a DOM is made of:
+ * container arrays as they double from 4 elements up and short strings.
+ * Requests up to JSON_POOL_MAX_BLOCK bytes are rounded up to one of the
+ * classes 16, 24, 32, 48, 64, ..., 1536, 2048 and freed blocks are kept on a
+ * free list of the calling thread for reuse. Each list holds at most
+ * JSON_POOL_CLASS_BYTES worth of blocks; anything beyond that, and every
+ * larger request, goes straight to malloc and free.
+ *
+ * Blocks may be freed by a different thread than the one that allocated them.
+ * They then end up on the freeing thread's list. */
+#define JSON_POOL_MAX_BLOCK 2048
+#define JSON_POOL_CLASS_BYTES (64 * 1024)
+
+extern const struct json_allocator_t json_pool_allocator;
+
+/* Returns every block cached by the calling thread to malloc. Call it before
+ * a thread that used the pool exits. */
+void json_pool_trim(void);
+
+#endif /* GRAMAS_JSON_POOL_H */
@@ -0,0 +1,466 @@
+#include "json_projection.h"
+
+#include "buf.h"
+#include "json_internal.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JP_SKIPPED 2
+
+static size_t jp_new_node(struct json_projection_t *p)
+{
+	struct json_projection_node_t node = { 0 };
+
+	buf_append((char **)&p->nodes, &p->length, &p->capacity, sizeof(node),
+			(const char *)&node, NULL);
+
+	return p->length - 1;
+}
+
+void json_projection_init(struct json_projection_t *p)
+{
+	memset(p, 0, sizeof(*p));
+	jp_new_node(p);
+}
+
+static int jp_step_eq(const struct json_projection_step_t *a, const struct json_projection_step_t *b)
+{
+	if (a->kind != b->kind)
+		return 0;
+
+	if (a->kind == JSON_PROJ_KEY)
+		return json_string_cmp(&a->name, &b->name) == 0;
+
+	if (a->kind == JSON_PROJ_INDEX)
+		return a->index == b->index;
+
+	return 1;
+}
+
+/* Returns the child of node reached through step, creating it if needed.
+ * Takes ownership of step->name. */
+static size_t jp_child(struct json_projection_t *p, size_t node,
+		struct json_projection_step_t *step)
+{
+	struct json_projection_node_t *n;
+	size_t i;
+
+	n = &p->nodes[node];
+
+	for (i = 0; i < n->length; i++) {
+		if (jp_step_eq(&n->steps[i], step)) {
+			json_string_destroy(&step->name);
+			return n->steps[i].child;
+		}
+	}
+
+	step->child = jp_new_node(p);
+	n = &p->nodes[node];
+	buf_append((char **)&n->steps, &n->length, &n->capacity, sizeof(*step),
+			(const char *)step, NULL);
+
+	return step->child;
+}
+
+/* Splits path into steps, appending them to steps. Returns nonzero if the
+ * path is malformed. */
+static int jp_parse_path(const char *path, struct json_projection_step_t **steps,
+		size_t *length, size_t *capacity)
+{
+	struct json_projection_step_t step;
+	size_t name_length;
+	char *name;
+	char *end;
+
+	if (strcmp(path, ".") == 0)
+		return 0;
+
+	while (*path) {
+		memset(&step, 0, sizeof(step));
+
+		if (*path == '.') {
+			path++;
+
+			if (*path == '*') {
+				step.kind = JSON_PROJ_ANY_KEY;
+				path++;
+			} else {
+				name_length = strcspn(path, ".[");
+
+				if (!name_length)
+					return 1;
+
+				if (!(name = malloc(name_length + 1)))
+					return 1;
+
+				memcpy(name, path, name_length);
+				name[name_length] = '\0';
+
+				step.kind = JSON_PROJ_KEY;
+				json_string_set(&step.name, name, name_length + 1);
+				free(name);
+				path += name_length;
+			}
+		} else if (*path == '[') {
+			path++;
+
+			if (path[0] == '*' && path[1] == ']') {
+				step.kind = JSON_PROJ_ANY_INDEX;
+				path += 2;
+			} else {
+				if (!isdigit((unsigned char)*path))
+					return 1;
+
+				step.kind = JSON_PROJ_INDEX;
+				step.index = strtoull(path, &end, 10);
+
+				if (*end != ']')
+					return 1;
+
+				path = end + 1;
+			}
+		} else {
+			return 1;
+		}
+
+		buf_append((char **)steps, length, capacity, sizeof(step), (const char *)&step, NULL);
+	}
+
+	return 0;
+}
+
+int json_projection_add(struct json_projection_t *p, const char *path)
+{
+	struct json_projection_step_t *steps = NULL;
+	size_t length = 0;
+	size_t capacity = 0;
+	size_t node = 0;
+	size_t i;
+	int error;
+
+	error = jp_parse_path(path, &steps, &length, &capacity);
+
+	for (i = 0; i < length; i++) {
+		if (error)
+			json_string_destroy(&steps[i].name);
+		else
+			node = jp_child(p, node, &steps[i]);
+	}
+
+	if (!error)
+		p->nodes[node].terminal = 1;
+
+	free(steps);
+
+	return error;
+}
+
+void json_projection_destroy(struct json_projection_t *p)
+{
+	size_t i;
+	size_t j;
+
+	for (i = 0; i < p->length; i++) {
+		for (j = 0; j < p->nodes[i].length; j++)
+			json_string_destroy(&p->nodes[i].steps[j].name);
+
+		free(p->nodes[i].steps);
+	}
+
+	free(p->nodes);
+	memset(p, 0, sizeof(*p));
+}
+
+/* Collects into next the nodes that the current key or index leads to from
+ * any of the active nodes. key is NULL when stepping into an array. */
+static size_t jp_advance(
+		const struct json_projection_t *p,
+		const size_t *active,
+		size_t nactive,
+		const char *key,
+		size_t key_length,
+		size_t index,
+		size_t *next)
+{
+	const struct json_projection_step_t *step;
+	const struct json_projection_node_t *node;
+	size_t nnext = 0;
+	size_t i;
+	size_t j;
+
+	for (i = 0; i < nactive; i++) {
+		node = &p->nodes[active[i]];
+
+		for (j = 0; j < node->length; j++) {
+			step = &node->steps[j];
+
+			if (key) {
+				if (step->kind == JSON_PROJ_ANY_KEY
+						|| (step->kind == JSON_PROJ_KEY
+							&& json_string_length(&step->name) == key_length
+							&& memcmp(json_string_text(&step->name), key, key_length) == 0))
+					next[nnext++] = step->child;
+			} else {
+				if (step->kind == JSON_PROJ_ANY_INDEX
+						|| (step->kind == JSON_PROJ_INDEX && step->index == index))
+					next[nnext++] = step->child;
+			}
+		}
+	}
+
+	return nnext;
+}
+
+/* Room for the nodes jp_advance() can step to, from the tokenizer's
+ * allocator. Fails the parse if there is none. */
+static size_t *jp_scratch(struct json_tokenizer_t *t, const struct json_projection_t *p)
+{
+	size_t *next;
+
+	if (!(next = json_alloc(t->allocator, p->length * sizeof(*next)))) {
+		jt_fail(t, JSON_ERR_NO_MEMORY);
+		jt_report_error(t);
+	}
+
+	return next;
+}
+
+static void jp_scratch_free(struct json_tokenizer_t *t, const struct json_projection_t *p,
+		size_t *next)
+{
+	json_free(t->allocator, next, p->length * sizeof(*next));
+}
+
+static int jp_parse(
+		struct json_tokenizer_t *t,
+		const struct json_projection_t *p,
+		const size_t *active,
+		size_t nactive,
+		struct json_value_t *ret);
+
+static int jp_parse_object(
+		struct json_tokenizer_t *t,
+		const struct json_projection_t *p,
+		const size_t *active,
+		size_t nactive,
+		struct json_value_t *ret)
+{
+	struct json_string_t str = { 0 };
+	struct json_value_t val = { 0 };
+	size_t *next;
+	size_t nnext;
+	int error = 0;
+	int r;
+
+	if (!(next = jp_scratch(t, p)))
+		return 1;
+
+	if (!jt_consume_token(t, JSON_TOK_LEFT_CURLY_BRACE)) {
+		jp_scratch_free(t, p, next);
+		jt_report_error(t);
+		return 1;
+	}
+
+	json_value_object_init_a(ret, t->allocator);
+
+	if (jt_depth_enter(t))
+		goto err;
+
+	if (jt_consume_token(t, JSON_TOK_RIGHT_CURLY_BRACE))
+		goto end;
+
+	do {
+		if (t->kind == JSON_TOK_STRING) {
+			nnext = jp_advance(p, active, nactive, t->token, t->length, 0, next);
+
+			if (!nnext)
+				json_tokenizer_next(t);
+			else if (jt_take_string(t, &str))
+				goto err;
+		} else {
+			/* Keys long enough to arrive in pieces have to be put back
+			 * together before they can be matched. */
+			if (jt_take_string(t, &str))
+				goto err;
+
+			nnext = jp_advance(p, active, nactive, json_string_text(&str),
+					json_string_length(&str), 0, next);
+		}
+
+		if (!nnext) {
+			json_string_destroy_a(&str, t->allocator);
+
+			if (!jt_consume_token(t, JSON_TOK_COLON))
+				goto err;
+
+			if (json_tokenizer_skip_value(t))
+				goto err;
+
+			continue;
+		}
+
+		if (ret->object.length >= t->limits.max_container_elements) {
+			jt_fail(t, JSON_ERR_CONTAINER_ELEMENTS);
+			goto err;
+		}
+
+		if (jt_account(t, sizeof(struct json_kv_pair_t)))
+			goto err;
+
+		if (!jt_consume_token(t, JSON_TOK_COLON))
+			goto err;
+
+		if ((r = jp_parse(t, p, next, nnext, &val)) == 1)
+			goto err;
+
+		if (r == JP_SKIPPED) {
+			json_string_destroy_a(&str, t->allocator);
+			continue;
+		}
+
+		json_value_object_put_a(ret, &str, &val, t->allocator);
+		JT_STAT(t, object_sorts++);
+	} while (jt_consume_token(t, JSON_TOK_COMMA));
+
+	if (!jt_consume_token(t, JSON_TOK_RIGHT_CURLY_BRACE))
+		goto err;
+
+	goto end;
+
+err:
+	jt_report_error(t);
+	error = 1;
+
+end:
+	t->depth--;
+	jp_scratch_free(t, p, next);
+	json_string_destroy_a(&str, t->allocator);
+	json_value_destroy_a(&val, t->allocator);
+
+	if (!error && !ret->object.length) {
+		json_value_destroy_a(ret, t->allocator);
+		return JP_SKIPPED;
+	}
+
+	return error;
+}
+
+static int jp_parse_array(
+		struct json_tokenizer_t *t,
+		const struct json_projection_t *p,
+		const size_t *active,
+		size_t nactive,
+		struct json_value_t *ret)
+{
+	struct json_value_t val = { 0 };
+	size_t *next;
+	size_t nnext;
+	size_t index;
+	int error = 0;
+	int r;
+
+	if (!(next = jp_scratch(t, p)))
+		return 1;
+
+	if (!jt_consume_token(t, JSON_TOK_LEFT_SQUARE_BRACE)) {
+		jp_scratch_free(t, p, next);
+		jt_report_error(t);
+		return 1;
+	}
+
+	json_value_array_init_a(ret, t->allocator);
+
+	if (jt_depth_enter(t))
+		goto err;
+
+	if (jt_consume_token(t, JSON_TOK_RIGHT_SQUARE_BRACE))
+		goto end;
+
+	index = 0;
+
+	do {
+		nnext = jp_advance(p, active, nactive, NULL, 0, index++, next);
+
+		if (!nnext) {
+			if (json_tokenizer_skip_value(t))
+				goto err;
+
+			continue;
+		}
+
+		if (ret->array.length >= t->limits.max_container_elements) {
+			jt_fail(t, JSON_ERR_CONTAINER_ELEMENTS);
+			goto err;
+		}
+
+		if (jt_account(t, sizeof(struct json_value_t)))
+			goto err;
+
+		if ((r = jp_parse(t, p, next, nnext, &val)) == 1)
+			goto err;
+
+		if (r != JP_SKIPPED)
+			jt_array_append(t, ret, &val);
+	} while (jt_consume_token(t, JSON_TOK_COMMA));
+
+	if (!jt_consume_token(t, JSON_TOK_RIGHT_SQUARE_BRACE))
+		goto err;
+
+	goto end;
+
+err:
+	jt_report_error(t);
+	error = 1;
+
+end:
+	t->depth--;
+	jp_scratch_free(t, p, next);
+	json_value_destroy_a(&val, t->allocator);
+
+	if (!error && !ret->array.length) {
+		json_value_destroy_a(ret, t->allocator);
+		return JP_SKIPPED;
+	}
+
+	return error;
+}
+
+/* Returns 0 if something was built into ret, JP_SKIPPED if the value selected
+ * nothing and 1 on error. */
+static int jp_parse(
+		struct json_tokenizer_t *t,
+		const struct json_projection_t *p,
+		const size_t *active,
+		size_t nactive,
+		struct json_value_t *ret)
+{
+	size_t i;
+
+	for (i = 0; i < nactive; i++)
+		if (p->nodes[active[i]].terminal)
+			return json_value_parse(t, ret);
+
+	switch (t->kind) {
+		case JSON_TOK_LEFT_CURLY_BRACE:
+			return jp_parse_object(t, p, active, nactive, ret);
+		case JSON_TOK_LEFT_SQUARE_BRACE:
+			return jp_parse_array(t, p, active, nactive, ret);
+		default:
+			return json_tokenizer_skip_value(t) ? 1 : JP_SKIPPED;
+	}
+}
+
+int json_value_parse_projected(
+		struct json_tokenizer_t *t,
+		const struct json_projection_t *p,
+		struct json_value_t *ret)
+{
+	static const size_t root = 0;
+
+	if (t->depth == 0)
+		t->dom_bytes = 0;
+
+	return jp_parse(t, p, &root, 1, ret) == 1;
+}
@@ -0,0 +1,67 @@
+#ifndef GRAMAS_JSON_PROJECTION_H
+#define GRAMAS_JSON_PROJECTION_H
+
+#include "json.h"
+
+#include <stddef.h>
+
+/* A projection is a set of paths compiled into a trie that the parser
+ * consults while it consumes tokens. Only the values the paths select are
+ * built; everything else is stepped over with json_tokenizer_skip_value() and
+ * never allocated.
+ *
+ * Path syntax, relative to the top-level value:
+ *
+ *      .name       member "name" of an object
+ *      .*          any member of an object
+ *      [N]         element N of an array
+ *      [*]         any element of an array
+ *      .           the whole value
+ *
+ * so ".user.id" and ".events[*].ts" select a user's id and the timestamp of
+ * every event. The result keeps the shape of the input but only contains the
+ * members and elements along selected paths. Array elements that select
+ * nothing are dropped, so the surviving elements are renumbered. */
+
+enum json_projection_step_e {
+	JSON_PROJ_KEY,
+	JSON_PROJ_ANY_KEY,
+	JSON_PROJ_INDEX,
+	JSON_PROJ_ANY_INDEX,
+};
+
+struct json_projection_step_t {
+	enum json_projection_step_e kind;
+	struct json_string_t name;	/* Includes the terminating NUL like tokens do */
+	size_t index;
+	size_t child;
+};
+
+struct json_projection_node_t {
+	int terminal;
+	size_t length;
+	size_t capacity;
+	struct json_projection_step_t *steps;
+};
+
+struct json_projection_t {
+	size_t length;
+	size_t capacity;
+	struct json_projection_node_t *nodes;	/* nodes[0] is the root */
+};
+
+void json_projection_init(struct json_projection_t *p);
+
+/* Returns nonzero and leaves p unchanged if the path is malformed. */
+int json_projection_add(struct json_projection_t *p, const char *path);
+
+void json_projection_destroy(struct json_projection_t *p);
+
+/* Like json_value_parse() but only builds what p selects. If nothing in the
+ * value is selected, ret is left as JSON_NONE. Returns nonzero on error. */
+int json_value_parse_projected(
+		struct json_tokenizer_t *t,
+		const struct json_projection_t *p,
+		struct json_value_t *ret);
+
+#endif /* GRAMAS_JSON_PROJECTION_H */
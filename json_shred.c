@@ -0,0 +1,351 @@
+#include "json_shred.h"
+
+#include "buf.h"
+#include "json_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define JS_NONE SIZE_MAX
+
+void json_shredder_init(struct json_shredder_t *s, size_t row_group_size,
+		void (*on_row_group)(void *ctx, const struct json_shredder_t *s), void *ctx)
+{
+	memset(s, 0, sizeof(*s));
+	s->row_group_size = row_group_size ? row_group_size : 1;
+	s->on_row_group = on_row_group;
+	s->ctx = ctx;
+	s->last = JS_NONE;
+	s->first = JS_NONE;
+}
+
+static size_t js_valid_words(const struct json_shredder_t *s)
+{
+	return (s->row_group_size + 63) / 64;
+}
+
+static int js_column_is(const struct json_column_t *c, const struct json_shredder_t *s,
+		enum json_column_type_e type)
+{
+	return c->type == type && c->path_length == s->path_length
+			&& memcmp(c->path, s->path, s->path_length) == 0;
+}
+
+static size_t js_new_column(struct json_shredder_t *s, enum json_column_type_e type)
+{
+	struct json_column_t c = { 0 };
+	size_t rows = s->row_group_size;
+
+	c.path = malloc(s->path_length + 1);
+	memcpy(c.path, s->path, s->path_length + 1);
+	c.path_length = s->path_length;
+	c.type = type;
+	c.valid = calloc(js_valid_words(s), sizeof(*c.valid));
+	c.next = JS_NONE;
+
+	if (type == JSON_COLUMN_FLOAT)
+		c.floats = malloc(rows * sizeof(*c.floats));
+	else if (type == JSON_COLUMN_INT || type == JSON_COLUMN_BOOL)
+		c.ints = malloc(rows * sizeof(*c.ints));
+	else
+		c.offsets = calloc(rows + 1, sizeof(*c.offsets));
+
+	buf_append((char **)&s->columns, &s->ncolumns, &s->capacity, sizeof(c),
+			(const char *)&c, NULL);
+
+	return s->ncolumns - 1;
+}
+
+/* Finds the column for the current path, trying the one that came after the
+ * previous leaf last time before looking through all of them. Returns NULL
+ * if the row already has a value there. */
+static struct json_column_t *js_column(struct json_shredder_t *s, enum json_column_type_e type)
+{
+	size_t *guess = s->last == JS_NONE ? &s->first : &s->columns[s->last].next;
+	size_t i = *guess;
+
+	if (i == JS_NONE || !js_column_is(&s->columns[i], s, type)) {
+		for (i = 0; i < s->ncolumns && !js_column_is(&s->columns[i], s, type); i++)
+			;
+
+		if (i == s->ncolumns)
+			i = js_new_column(s, type);
+
+		/* The new column may have moved them. */
+		guess = s->last == JS_NONE ? &s->first : &s->columns[s->last].next;
+		*guess = i;
+	}
+
+	s->last = i;
+
+	if (json_column_is_valid(&s->columns[i], s->rows))
+		return NULL;
+
+	s->columns[i].valid[s->rows / 64] |= (uint64_t)1 << (s->rows % 64);
+
+	return &s->columns[i];
+}
+
+/* Sets the offsets of the rows before the current one, which have no text. */
+static void js_fill_offsets(struct json_column_t *c, size_t row)
+{
+	for (; c->filled < row; c->filled++)
+		c->offsets[c->filled + 1] = c->arena_length;
+}
+
+static void js_arena_write(struct json_column_t *c, const char *text, size_t length)
+{
+	if (!length)
+		return;
+
+	buf_ensure_capacity(&c->arena, &c->arena_capacity, c->arena_length + length, NULL);
+	memcpy(c->arena + c->arena_length, text, length);
+	c->arena_length += length;
+}
+
+static void js_text_done(struct json_shredder_t *s, struct json_column_t *c)
+{
+	c->offsets[s->rows + 1] = c->arena_length;
+	c->filled = s->rows + 1;
+}
+
+static int js_string(struct json_shredder_t *s, struct json_tokenizer_t *t)
+{
+	struct json_string_t str = { 0 };
+	struct json_column_t *c;
+
+	if (jt_take_string(t, &str))
+		return 1;
+
+	if ((c = js_column(s, JSON_COLUMN_STRING))) {
+		js_fill_offsets(c, s->rows);
+		js_arena_write(c, json_string_text(&str), json_string_length(&str) - 1);
+		js_text_done(s, c);
+	}
+
+	json_string_destroy_a(&str, t->allocator);
+
+	return 0;
+}
+
+/* Arrays are the one place a tree is built, to print it into the arena. */
+static int js_array(struct json_shredder_t *s, struct json_tokenizer_t *t)
+{
+	struct json_value_t val = { 0 };
+	struct json_column_t *c;
+
+	if (json_value_parse(t, &val)) {
+		json_value_destroy_a(&val, t->allocator);
+		return 1;
+	}
+
+	if ((c = js_column(s, JSON_COLUMN_JSON))) {
+		js_fill_offsets(c, s->rows);
+		json_value_to_string(&val, c,
+				(void (*)(void *, const char *, size_t))js_arena_write);
+		js_text_done(s, c);
+	}
+
+	json_value_destroy_a(&val, t->allocator);
+
+	return 0;
+}
+
+static int js_value(struct json_shredder_t *s, struct json_tokenizer_t *t);
+
+/* Adds "/" and the key to the path, escaped the way JSON Pointers are so
+ * that every leaf has a path of its own. */
+static void js_path_push(struct json_shredder_t *s, const char *key, size_t length)
+{
+	size_t i;
+
+	/* At worst every byte is escaped. */
+	buf_ensure_capacity(&s->path, &s->path_capacity, s->path_length + 2 * length + 2, NULL);
+	s->path[s->path_length++] = '/';
+
+	for (i = 0; i < length; i++) {
+		if (key[i] == '~' || key[i] == '/') {
+			s->path[s->path_length++] = '~';
+			s->path[s->path_length++] = key[i] == '~' ? '0' : '1';
+		} else {
+			s->path[s->path_length++] = key[i];
+		}
+	}
+
+	s->path[s->path_length] = '\0';
+}
+
+static int js_object(struct json_shredder_t *s, struct json_tokenizer_t *t)
+{
+	struct json_string_t key = { 0 };
+	size_t path_length = s->path_length;
+	int error = 1;
+
+	jt_consume_token(t, JSON_TOK_LEFT_CURLY_BRACE);
+
+	if (jt_depth_enter(t))
+		goto end;
+
+	if (jt_consume_token(t, JSON_TOK_RIGHT_CURLY_BRACE)) {
+		error = 0;
+		goto end;
+	}
+
+	do {
+		if (jt_take_string(t, &key) || !jt_consume_token(t, JSON_TOK_COLON))
+			goto end;
+
+		s->path_length = path_length;
+		js_path_push(s, json_string_text(&key), json_string_length(&key) - 1);
+
+		if (js_value(s, t))
+			goto end;
+
+		s->path_length = path_length;
+	} while (jt_consume_token(t, JSON_TOK_COMMA));
+
+	error = !jt_consume_token(t, JSON_TOK_RIGHT_CURLY_BRACE);
+
+end:
+	t->depth--;
+	s->path_length = path_length;
+	json_string_destroy_a(&key, t->allocator);
+
+	return error;
+}
+
+static int js_value(struct json_shredder_t *s, struct json_tokenizer_t *t)
+{
+	struct json_column_t *c;
+
+	switch (t->kind) {
+		case JSON_TOK_LEFT_CURLY_BRACE:
+			return js_object(s, t);
+		case JSON_TOK_LEFT_SQUARE_BRACE:
+			return js_array(s, t);
+		case JSON_TOK_STRING:
+		case JSON_TOK_STRING_CHUNK:
+			return js_string(s, t);
+		case JSON_TOK_INT:
+			if ((c = js_column(s, JSON_COLUMN_INT)))
+				c->ints[s->rows] = strtoll(t->token, NULL, 10);
+
+			break;
+		case JSON_TOK_FLOAT:
+			if ((c = js_column(s, JSON_COLUMN_FLOAT)))
+				c->floats[s->rows] = strtod(t->token, NULL);
+
+			break;
+		case JSON_TOK_NAKED_WORD:
+			if (strcmp(t->token, "true") == 0 || strcmp(t->token, "false") == 0) {
+				if ((c = js_column(s, JSON_COLUMN_BOOL)))
+					c->ints[s->rows] = t->token[0] == 't';
+			} else if (strcmp(t->token, "null") != 0) {
+				return 1;
+			}
+
+			break;
+		default:
+			return 1;
+	}
+
+	json_tokenizer_next(t);
+
+	return 0;
+}
+
+/* Takes back whatever the current row got before it turned out broken. */
+static void js_drop_row(struct json_shredder_t *s)
+{
+	struct json_column_t *c;
+	size_t i;
+
+	for (i = 0; i < s->ncolumns; i++) {
+		c = &s->columns[i];
+		c->valid[s->rows / 64] &= ~((uint64_t)1 << (s->rows % 64));
+
+		if (c->offsets && c->filled > s->rows) {
+			c->arena_length = c->offsets[s->rows];
+			c->filled = s->rows;
+		}
+	}
+}
+
+int json_shredder_add(struct json_shredder_t *s, struct json_tokenizer_t *t)
+{
+	t->dom_bytes = 0;
+	s->last = JS_NONE;
+	s->path_length = 0;
+	buf_ensure_capacity(&s->path, &s->path_capacity, 1, NULL);
+	s->path[0] = '\0';
+
+	if (js_value(s, t)) {
+		jt_report_error(t);
+		js_drop_row(s);
+		return 1;
+	}
+
+	if (++s->rows == s->row_group_size)
+		json_shredder_flush(s);
+
+	return 0;
+}
+
+void json_shredder_flush(struct json_shredder_t *s)
+{
+	struct json_column_t *c;
+	size_t i;
+
+	if (!s->rows)
+		return;
+
+	for (i = 0; i < s->ncolumns; i++) {
+		if (s->columns[i].offsets)
+			js_fill_offsets(&s->columns[i], s->rows);
+	}
+
+	if (s->on_row_group)
+		s->on_row_group(s->ctx, s);
+
+	s->row_groups++;
+	s->rows = 0;
+
+	for (i = 0; i < s->ncolumns; i++) {
+		c = &s->columns[i];
+		memset(c->valid, 0, js_valid_words(s) * sizeof(*c->valid));
+		c->arena_length = 0;
+		c->filled = 0;
+	}
+}
+
+void json_shredder_destroy(struct json_shredder_t *s)
+{
+	struct json_column_t *c;
+	size_t i;
+
+	for (i = 0; i < s->ncolumns; i++) {
+		c = &s->columns[i];
+		free(c->path);
+		free(c->valid);
+		free(c->ints);
+		free(c->floats);
+		free(c->offsets);
+		free(c->arena);
+	}
+
+	free(s->columns);
+	free(s->path);
+	memset(s, 0, sizeof(*s));
+}
+
+const char *json_column_type_to_str(enum json_column_type_e type)
+{
+	switch (type) {
+		case JSON_COLUMN_INT: return "int";
+		case JSON_COLUMN_FLOAT: return "float";
+		case JSON_COLUMN_BOOL: return "bool";
+		case JSON_COLUMN_STRING: return "string";
+		case JSON_COLUMN_JSON: return "json";
+		default: return "undefined";
+	}
+}
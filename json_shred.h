@@ -0,0 +1,112 @@
+#ifndef GRAMAS_JSON_SHRED_H
+#define GRAMAS_JSON_SHRED_H
+
+#include "json.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Turns a stream of records, such as NDJSON, into columns straight from the
+ * tokens, without building a tree for each record. Every leaf of a record
+ * gets a typed column named by its JSON Pointer: "/user/id", with "~" and "/"
+ * in keys written as "~0" and "~1", or "" for a record that is not an
+ * object. A column is created the first time its path shows up with that
+ * type, so columns appear as the schema grows and a path seen with two
+ * types has two columns. Nulls are rows without a value. Arrays are not
+ * split up: they are kept whole as JSON text in a JSON_COLUMN_JSON column.
+ *
+ * Rows are gathered into row groups of row_group_size rows, each handed to
+ * on_row_group once it is full and then cleared:
+ *
+ *      json_shredder_init(&s, 65536, write_row_group, ctx);
+ *
+ *      for (json_tokenizer_next(t); t->kind != JSON_TOK_NONE;)
+ *          if (json_shredder_add(&s, t))
+ *              break;
+ *
+ *      json_shredder_flush(&s);
+ *      json_shredder_destroy(&s);
+ *
+ * If a record has the same path twice, the first value is kept. */
+
+enum json_column_type_e {
+	JSON_COLUMN_INT,
+	JSON_COLUMN_FLOAT,
+	JSON_COLUMN_BOOL,
+	JSON_COLUMN_STRING,
+	JSON_COLUMN_JSON
+};
+
+struct json_column_t {
+	char *path;
+	size_t path_length;	/* Without the terminating NUL */
+	enum json_column_type_e type;
+
+	/* Bit r % 64 of valid[r / 64] is set if row r has a value. */
+	uint64_t *valid;
+
+	/* JSON_COLUMN_INT and JSON_COLUMN_BOOL use ints, JSON_COLUMN_FLOAT uses
+	 * floats. Rows without a value hold garbage. */
+	int64_t *ints;
+	double *floats;
+
+	/* The text of row r of a string or JSON column is
+	 * arena[offsets[r], offsets[r + 1]), not NUL-terminated. */
+	size_t *offsets;
+	char *arena;
+	size_t arena_length;
+	size_t arena_capacity;
+
+	size_t filled;	/* Rows whose offsets are set */
+	size_t next;	/* Column of the leaf that followed this one last time */
+};
+
+struct json_shredder_t {
+	size_t row_group_size;
+	size_t rows;	/* Rows in the current row group */
+	size_t row_groups;	/* Row groups handed out so far */
+
+	struct json_column_t *columns;
+	size_t ncolumns;
+	size_t capacity;
+
+	void (*on_row_group)(void *ctx, const struct json_shredder_t *s);
+	void *ctx;
+
+	/* Path of the leaf being shredded and the column of the one before
+	 * it, which usually tells which column comes next. */
+	char *path;
+	size_t path_length;
+	size_t path_capacity;
+	size_t last;
+	size_t first;
+};
+
+static inline int json_column_is_valid(const struct json_column_t *c, size_t row)
+{
+	return (c->valid[row / 64] >> (row % 64)) & 1;
+}
+
+static inline const char *json_column_text(const struct json_column_t *c, size_t row,
+		size_t *length)
+{
+	*length = c->offsets[row + 1] - c->offsets[row];
+	return c->arena + c->offsets[row];
+}
+
+void json_shredder_init(struct json_shredder_t *s, size_t row_group_size,
+		void (*on_row_group)(void *ctx, const struct json_shredder_t *s), void *ctx);
+
+/* Shreds the value at the current token into the next row. Returns nonzero,
+ * after reporting through on_error, if it is broken or over a limit, in which
+ * case the row is dropped. */
+int json_shredder_add(struct json_shredder_t *s, struct json_tokenizer_t *t);
+
+/* Hands out the rows gathered so far, if there are any, as a row group of
+ * its own. */
+void json_shredder_flush(struct json_shredder_t *s);
+void json_shredder_destroy(struct json_shredder_t *s);
+
+const char *json_column_type_to_str(enum json_column_type_e type);
+
+#endif /* GRAMAS_JSON_SHRED_H */
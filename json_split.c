@@ -0,0 +1,257 @@
+#include "json_split.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct js_masks {
+	uint64_t quote;
+	uint64_t backslash;
+	uint64_t open;
+	uint64_t close;
+	uint64_t newline;
+};
+
+#if __SSE2__
+
+static inline uint64_t js_eq(const __m128i v[4], char c)
+{
+	const __m128i m = _mm_set1_epi8(c);
+
+	return (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[0], m))
+		| (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[1], m)) << 16
+		| (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[2], m)) << 32
+		| (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v[3], m)) << 48;
+}
+
+static void js_classify(const char *block, struct js_masks *m)
+{
+	const __m128i lower = _mm_set1_epi8(0x20);
+	__m128i v[4];
+	__m128i folded[4];
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		v[i] = _mm_loadu_si128((const __m128i *)(block + i * 16));
+		/* '[' and ']' are '{' and '}' with bit 5 clear. */
+		folded[i] = _mm_or_si128(v[i], lower);
+	}
+
+	m->quote = js_eq(v, '"');
+	m->backslash = js_eq(v, '\\');
+	m->newline = js_eq(v, '\n');
+	m->open = js_eq(folded, '{');
+	m->close = js_eq(folded, '}');
+}
+
+#else
+
+static void js_classify(const char *block, struct js_masks *m)
+{
+	uint64_t bit;
+	int i;
+
+	memset(m, 0, sizeof(*m));
+
+	for (i = 0; i < 64; i++) {
+		bit = (uint64_t)1 << i;
+
+		if (block[i] == '"')
+			m->quote |= bit;
+		else if (block[i] == '\\')
+			m->backslash |= bit;
+		else if (block[i] == '\n')
+			m->newline |= bit;
+		else if ((block[i] | 0x20) == '{')
+			m->open |= bit;
+		else if ((block[i] | 0x20) == '}')
+			m->close |= bit;
+	}
+}
+
+#endif
+
+/* Marks the characters escaped by a backslash. Runs of backslashes escape
+ * each other in pairs; backslashes are rare enough to walk one by one. last
+ * is the bit of the last byte in the block. */
+static uint64_t js_escaped(struct json_splitter_t *s, uint64_t backslash, uint64_t last)
+{
+	uint64_t escaped = (uint64_t)s->escape;
+	uint64_t bit;
+
+	backslash &= ~escaped;
+	s->escape = 0;
+
+	while (backslash) {
+		bit = backslash & -backslash;
+
+		if (bit == last)
+			s->escape = 1;
+
+		escaped |= bit << 1;
+		backslash &= ~(bit | bit << 1);
+	}
+
+	return escaped;
+}
+
+static void js_boundary(struct json_splitter_t *s, uint64_t newline, int at)
+{
+	struct json_split_point_t p;
+	uint64_t before = at == 63 ? ~(uint64_t)0 : ((uint64_t)1 << (at + 1)) - 1;
+
+	newline &= before;
+	p.offset = s->offset + (size_t)at + 1;
+	p.lines = s->lines + (size_t)__builtin_popcountll(newline);
+	p.line_start = newline ? s->offset + (size_t)(64 - __builtin_clzll(newline)) : s->line_start;
+	s->on_boundary(s->ctx, &p);
+}
+
+/* Scans the first n bytes of a 64-byte block. */
+static void js_block(struct json_splitter_t *s, const char *block, size_t n)
+{
+	struct js_masks m;
+	uint64_t valid = n == 64 ? ~(uint64_t)0 : ((uint64_t)1 << n) - 1;
+	uint64_t strings;
+	uint64_t brackets;
+	uint64_t bit;
+	size_t opens;
+	size_t closes;
+
+	js_classify(block, &m);
+
+	m.quote &= valid;
+	m.backslash &= valid;
+	m.open &= valid;
+	m.close &= valid;
+	m.newline &= valid;
+
+	/* Everything from an opening quote up to its closing one. Past the
+	 * last quote every bit is the same, so the top one is carried over. */
+	strings = m.quote & ~js_escaped(s, m.backslash, (uint64_t)1 << (n - 1));
+	strings ^= strings << 1;
+	strings ^= strings << 2;
+	strings ^= strings << 4;
+	strings ^= strings << 8;
+	strings ^= strings << 16;
+	strings ^= strings << 32;
+	strings ^= s->in_string;
+	s->in_string = (uint64_t)((int64_t)strings >> 63);
+
+	m.open &= ~strings;
+	m.close &= ~strings;
+	opens = (size_t)__builtin_popcountll(m.open);
+	closes = (size_t)__builtin_popcountll(m.close);
+
+	if (s->depth > closes) {
+		s->depth += opens - closes;
+	} else {
+		for (brackets = m.open | m.close; brackets; brackets ^= bit) {
+			bit = brackets & -brackets;
+
+			if (m.open & bit)
+				s->depth++;
+			else if (s->depth && !--s->depth)
+				js_boundary(s, m.newline, __builtin_ctzll(bit));
+		}
+	}
+
+	if (m.newline) {
+		s->lines += (size_t)__builtin_popcountll(m.newline);
+		s->line_start = s->offset + (size_t)(64 - __builtin_clzll(m.newline));
+	}
+
+	s->offset += n;
+}
+
+void json_splitter_init(struct json_splitter_t *s,
+		void (*on_boundary)(void *ctx, const struct json_split_point_t *at),
+		void *ctx)
+{
+	memset(s, 0, sizeof(*s));
+	s->on_boundary = on_boundary;
+	s->ctx = ctx;
+}
+
+void json_splitter_start_at(struct json_splitter_t *s, const struct json_split_point_t *at)
+{
+	s->offset = at->offset;
+	s->lines = at->lines;
+	s->line_start = at->line_start;
+}
+
+void json_splitter_feed(struct json_splitter_t *s, const char *data, size_t length)
+{
+	char block[64];
+
+	for (; length >= 64; data += 64, length -= 64)
+		js_block(s, data, 64);
+
+	if (length) {
+		memcpy(block, data, length);
+		js_block(s, block, length);
+	}
+}
+
+struct js_cuts {
+	struct json_split_point_t *points;
+	size_t count;
+	size_t capacity;
+	size_t target;
+	size_t last;
+	size_t length;
+	int failed;
+};
+
+static void js_cut(void *ctx, const struct json_split_point_t *at)
+{
+	struct js_cuts *c = ctx;
+	struct json_split_point_t *points;
+
+	/* Leave the last piece at least as big as the others. */
+	if (at->offset - c->last < c->target || c->length - at->offset < c->target || c->failed)
+		return;
+
+	if (c->count == c->capacity) {
+		c->capacity = c->capacity ? c->capacity * 2 : 16;
+
+		if (!(points = realloc(c->points, c->capacity * sizeof(*points)))) {
+			c->failed = 1;
+			return;
+		}
+
+		c->points = points;
+	}
+
+	c->points[c->count++] = *at;
+	c->last = at->offset;
+}
+
+int json_split(const char *text, size_t length, size_t target,
+		struct json_split_point_t **points, size_t *count)
+{
+	struct json_splitter_t s;
+	struct js_cuts c = { 0 };
+
+	c.target = target ? target : 1;
+	c.length = length;
+
+	/* Too small to be worth cutting. */
+	if (length >= 2 * c.target) {
+		json_splitter_init(&s, js_cut, &c);
+		json_splitter_feed(&s, text, length);
+	}
+
+	if (c.failed) {
+		free(c.points);
+		return 1;
+	}
+
+	*points = c.points;
+	*count = c.count;
+
+	return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef GRAMAS_JSON_SPLIT_H
+#define GRAMAS_JSON_SPLIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Finds where top-level objects and arrays end in a stream of JSON values
+ * written back to back, "}{" with or without whitespace between them, without
+ * tokenizing it. The input is looked at 64 bytes at a time: quotes, escapes,
+ * brackets and newlines become bit masks (with SSE2 where available), strings
+ * are masked out with a prefix XOR over the quote bits, and brackets are
+ * only counted one by one in blocks where the depth could reach zero.
+ *
+ * Every range between two boundaries holds whole values and can be parsed on
+ * its own. Scalars at the top level are not boundaries; they end up in the
+ * range of the object or array that follows them. The input is not
+ * validated: broken JSON just yields boundaries the parser will reject. */
+
+struct json_split_point_t {
+	/* Just past the closing bracket. */
+	size_t offset;
+	/* Newlines before offset, and where the last line begins, for
+	 * json_tokenizer_start_at(). */
+	size_t lines;
+	size_t line_start;
+};
+
+struct json_splitter_t {
+	void (*on_boundary)(void *ctx, const struct json_split_point_t *at);
+	void *ctx;
+
+	size_t offset;
+	size_t depth;
+	uint64_t in_string;
+	int escape;
+	size_t lines;
+	size_t line_start;
+};
+
+void json_splitter_init(struct json_splitter_t *s,
+		void (*on_boundary)(void *ctx, const struct json_split_point_t *at),
+		void *ctx);
+
+/* Scans the next length bytes of input, reporting every boundary in them
+ * before returning. */
+void json_splitter_feed(struct json_splitter_t *s, const char *data, size_t length);
+
+/* Counts positions from the given point of the input on, to pick up a
+ * stream that was split up to there before. */
+void json_splitter_start_at(struct json_splitter_t *s, const struct json_split_point_t *at);
+
+/* Cuts text into pieces of at least target bytes, where possible, that start
+ * and end between top-level values. Stores the end of every piece but the
+ * last in a malloc()ed *points. Returns nonzero if memory ran out. */
+int json_split(const char *text, size_t length, size_t target,
+		struct json_split_point_t **points, size_t *count);
+
+#endif /* GRAMAS_JSON_SPLIT_H */
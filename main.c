@@ -1,49 +1,1417 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "buf.h"
+#include "fd_reader.h"
 #include "fstream_reader.h"
+#include "json_follow.h"
+#include "uring_reader.h"
 #include "json.h"
+#include "json_index.h"
+#include "json_iter.h"
+#include "json_node.h"
+#include "json_pipeline.h"
+#include "json_pool.h"
+#include "json_projection.h"
+#include "json_shred.h"
+#include "json_split.h"
+#include "work_pool.h"
 
 static void write_to_file(FILE *f, const char *bytes, size_t length)
 {
 	fwrite(bytes, 1, length, f);
 }
 
-static void report_error(void *, const char *unexpected_token, size_t length,
+/* Where report_error() writes: stderr unless a file is being parsed in a
+ * batch, whose messages are prefixed with its name. */
+struct error_sink {
+	FILE *f;
+	const char *name;
+};
+
+static void report_error(void *handler, enum json_error_e error,
+		const char *unexpected_token, size_t length,
 		size_t linenum, size_t char_pos)
 {
-	fprintf(stderr, "Unexpected token at %zu:%zu --- \"%s\"\n",
-			linenum + 1, char_pos + 1, unexpected_token);
+	const struct error_sink *sink = handler;
+	FILE *f = sink ? sink->f : stderr;
+
+	if (sink && sink->name)
+		fprintf(f, "%s: ", sink->name);
+
+	if (error == JSON_ERR_SYNTAX) {
+		fprintf(f, "Unexpected token at %zu:%zu --- \"%.*s\"\n",
+				linenum + 1, char_pos + 1, (int)length, unexpected_token);
+	} else {
+		fprintf(f, "Input rejected at %zu:%zu --- %s\n",
+				linenum + 1, char_pos + 1, json_strerror(error));
+	}
 }
 
-int main(void)
+/* Where the "Object #N" prefixes go in the output of a piece of a split
+ * file. N is only known once the pieces before it have been counted. */
+struct value_mark {
+	long at;
+	size_t index;
+};
+
+struct value_marks {
+	struct value_mark *marks;
+	size_t count;
+	size_t capacity;
+};
+
+static void print_prefix(FILE *out, struct value_marks *marks, size_t i)
 {
-	struct fstream_reader fstr = { 0 };
-	struct json_tokenizer_t tok = { 0 };
+	struct value_mark m;
+
+	if (!marks) {
+		fprintf(out, "Object #%zu", i);
+		return;
+	}
+
+	m.at = ftell(out);
+	m.index = i;
+	buf_append((char **)&marks->marks, &marks->count, &marks->capacity,
+			sizeof(m), (const char *)&m, NULL);
+}
+
+static void print_value(FILE *out, const struct json_value_t *v)
+{
+	json_value_to_string(v, out,
+			(void(*)(void *, const char *, size_t))write_to_file);
+	fputc('\n', out);
+}
+
+static void print_node(FILE *out, const struct json_node_t *n)
+{
+	json_node_to_string(n, out,
+			(void(*)(void *, const char *, size_t))write_to_file);
+	fputc('\n', out);
+}
+
+/* Prints the elements of the array at the current token one by one, adding
+ * them to index if it is given. */
+static int stream_array(struct json_tokenizer_t *tok,
+		const struct json_projection_t *proj, size_t i, FILE *out,
+		struct value_marks *marks, struct json_index_t *index)
+{
+	struct json_array_iter_t it;
 	struct json_value_t val = { 0 };
-	size_t i = 0;
+	int r;
+
+	if (json_array_iter_open(&it, tok))
+		return 1;
+
+	it.projection = proj;
+
+	for (;;) {
+		if (index && !it.done)
+			json_index_add(index, tok);
+
+		if ((r = json_array_iter_next(&it, &val)) <= 0)
+			break;
+
+		if (val.type != JSON_NONE) {
+			print_prefix(out, marks, i);
+			fprintf(out, "[%zu]: ", it.index - 1);
+			print_value(out, &val);
+		}
+
+		json_value_destroy_a(&val, tok->allocator);
+	}
+
+	json_value_destroy_a(&val, tok->allocator);
+
+	return r < 0;
+}
+
+/* Lists every token with its position in the input. */
+static int dump_tokens(struct json_tokenizer_t *tok, FILE *out)
+{
+	struct json_token_t tokens[256];
+	size_t n;
+	size_t i;
+
+	while ((n = json_tokenizer_next_batch(tok, tokens, 256)) > 0) {
+		for (i = 0; i < n; i++) {
+			fprintf(out, "%s %zu %zu%s\n", json_tok_kind_to_str(tokens[i].kind),
+					tokens[i].offset, tokens[i].length,
+					tokens[i].has_escapes ? " escaped" : "");
+		}
+
+		if (tokens[n - 1].kind == JSON_TOK_ERROR)
+			return 1;
+	}
+
+	return 0;
+}
+
+struct parse_options {
+	const struct json_projection_t *proj;
+	int stream;
+	int tokens;
+	/* Build json_node_t trees instead of json_value_t ones. */
+	int compact;
+	/* Move each top-level value into one block before printing it. */
+	int freeze;
+
+	/* Only when reading standard input. */
+	struct json_index_t *index;
+};
+
+/* Prints every value in the input to out, numbering them from *values on,
+ * and leaves the number after the last one in *values. Returns nonzero if
+ * there was nothing to print because the input was empty or broken from the
+ * start. */
+static int parse_all(struct json_tokenizer_t *tok, const struct parse_options *o,
+		FILE *out, struct value_marks *marks, size_t *values)
+{
+	struct json_value_t val = { 0 };
+	struct json_node_t node = { 0 };
+	struct json_value_t *frozen;
+	int index_elements = o->index && o->index->flags & JSON_INDEX_ELEMENTS;
+	int error;
+	size_t i;
 	int ret = 1;
 
-	fstream_init(&fstr, stdin, 4096);
-	json_tokenizer_init(&tok, &fstr, (int (*)(void *))fstream_next);
-	json_tokenizer_next(&tok);
+	if (o->tokens)
+		return dump_tokens(tok, out);
 
-	tok.on_error = report_error;
+	json_tokenizer_next(tok);
+
+	tok->on_error = report_error;
+
+	for (i = *values; tok->kind != JSON_TOK_NONE; i++) {
+		if (o->index && !index_elements)
+			json_index_add(o->index, tok);
 
-	for (i = 0; tok.kind > 0; i++) {
-		if (json_value_parse(&tok, &val))
+		if (o->stream && tok->kind == JSON_TOK_LEFT_SQUARE_BRACE) {
+			if (stream_array(tok, o->proj, i, out, marks,
+						index_elements ? o->index : NULL))
+				break;
+
+			ret = 0;
+			continue;
+		}
+
+		if (o->compact) {
+			if (json_node_parse(tok, &node))
+				break;
+
+			ret = 0;
+			print_prefix(out, marks, i);
+			fputs(": ", out);
+			print_node(out, &node);
+			json_node_destroy_a(&node, tok->allocator);
+			continue;
+		}
+
+		if (o->proj)
+			error = json_value_parse_projected(tok, o->proj, &val);
+		else
+			error = json_value_parse(tok, &val);
+
+		if (error)
 			break;
 
 		ret = 0;
-		printf("Object #%zu: ", i);
-		json_value_to_string(&val,  stdout,
-				(void(*)(void *, const char *, size_t))write_to_file);
-		puts("");
-		json_value_destroy(&val);
+
+		if (val.type == JSON_NONE)
+			continue;
+
+		print_prefix(out, marks, i);
+		fputs(": ", out);
+
+		if (o->freeze && (frozen = json_value_freeze_a(&val, tok->allocator))) {
+			print_value(out, frozen);
+			free(frozen);
+		} else {
+			print_value(out, &val);
+			json_value_destroy_a(&val, tok->allocator);
+		}
+	}
+
+	json_value_destroy_a(&val, tok->allocator);
+	*values = i;
+
+	return ret;
+}
+
+/* Files named on the command line, parsed on a work_pool and printed in the
+ * order they were given. Files of at least twice split_size bytes are mapped
+ * and cut by json_split() into pieces parsed in parallel; the rest are read
+ * as one piece.
+ *
+ * With an output directory a file's output is written there by the worker
+ * that parses its last piece, and only the error messages wait to be printed
+ * in order. Otherwise all of it waits, so at most BATCH_AHEAD files per
+ * worker are let ahead of the printing. */
+#define BATCH_AHEAD 4
+
+struct batch_piece {
+	struct batch_file *file;
+	size_t begin;
+	size_t end;
+	struct json_split_point_t start;
+	char *out;
+	size_t out_length;
+	char *err;
+	size_t err_length;
+	struct value_marks marks;
+	size_t values;
+	int ret;
+	int stopped;
+	int done;
+};
+
+struct batch_file {
+	struct batch *batch;
+	char *path;
+	off_t size;
+	char *text;
+	struct batch_piece *pieces;
+	size_t npieces;
+	size_t pending;
+	int submitted;
+	int ready;
+	int stored;
+	int open_error;
+	int ret;
+};
+
+struct batch {
+	struct batch_file *files;
+	size_t count;
+	size_t capacity;
+	const struct parse_options *opts;
+	const struct json_tokenizer_t *proto;
+	const char *output_dir;
+	size_t bufsize;
+	size_t split_size;
+	struct work_pool_t pool;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+};
+
+static int batch_add(struct batch *b, const char *path, off_t size)
+{
+	struct batch_file *files;
+	struct batch_file *f;
+
+	if (b->count == b->capacity) {
+		b->capacity = b->capacity ? b->capacity * 2 : 64;
+
+		if (!(files = realloc(b->files, b->capacity * sizeof(*files))))
+			return 1;
+
+		b->files = files;
 	}
 
-	json_value_destroy(&val);
+	f = &b->files[b->count];
+	memset(f, 0, sizeof(*f));
+	f->batch = b;
+	f->size = size;
+
+	if (!(f->path = strdup(path)))
+		return 1;
+
+	b->count++;
+
+	return 0;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Adds path, or the regular files in it if it is a directory, in name order. */
+static int batch_add_path(struct batch *b, const char *path)
+{
+	struct dirent *e;
+	struct stat st;
+	char **names = NULL;
+	char **grown;
+	size_t count = 0;
+	size_t i;
+	char *name;
+	DIR *dir;
+	int ret = 0;
+
+	if (stat(path, &st))
+		return batch_add(b, path, 0);
+
+	if (!S_ISDIR(st.st_mode))
+		return batch_add(b, path, st.st_size);
+
+	if (!(dir = opendir(path)))
+		return batch_add(b, path, 0);
+
+	while ((e = readdir(dir))) {
+		if (asprintf(&name, "%s/%s", path, e->d_name) < 0) {
+			ret = 1;
+			break;
+		}
+
+		if (stat(name, &st) || !S_ISREG(st.st_mode)) {
+			free(name);
+			continue;
+		}
+
+		if (!(grown = realloc(names, (count + 1) * sizeof(*names)))) {
+			free(name);
+			ret = 1;
+			break;
+		}
+
+		names = grown;
+		names[count++] = name;
+	}
+
+	closedir(dir);
+	qsort(names, count, sizeof(*names), compare_paths);
+
+	for (i = 0; i < count; i++) {
+		if (!ret && !stat(names[i], &st))
+			ret = batch_add(b, names[i], st.st_size);
+
+		free(names[i]);
+	}
+
+	free(names);
+
+	return ret;
+}
+
+static FILE *batch_open_output(struct batch *b, struct batch_file *f)
+{
+	const char *base = strrchr(f->path, '/');
+	char *name;
+	FILE *out;
+
+	if (asprintf(&name, "%s/%s.out", b->output_dir, base ? base + 1 : f->path) < 0)
+		return NULL;
+
+	out = fopen(name, "w");
+	free(name);
+
+	return out;
+}
+
+/* A piece of a mapped file, handed to the tokenizer in one go. */
+struct mem_source {
+	const char *begin;
+	const char *end;
+};
+
+static int mem_fill(struct mem_source *m, const char **begin, const char **end)
+{
+	if (m->begin == m->end)
+		return EOF;
+
+	*begin = m->begin;
+	*end = m->end;
+	m->begin = m->end;
+
+	return 0;
+}
+
+/* Writes a piece's output with the "Object #N" prefixes noted in its marks
+ * filled in, its first value being number base. */
+static void write_marked(FILE *out, const struct batch_piece *p, size_t base)
+{
+	size_t at = 0;
+	size_t i;
+
+	for (i = 0; i < p->marks.count; i++) {
+		fwrite(p->out + at, 1, (size_t)p->marks.marks[i].at - at, out);
+		fprintf(out, "Object #%zu", base + p->marks.marks[i].index);
+		at = (size_t)p->marks.marks[i].at;
+	}
+
+	fwrite(p->out + at, 1, p->out_length - at, out);
+}
+
+/* Goes through a file's pieces in order, up to and including the first one
+ * that stopped at an error, as parsing it whole would have: their output goes
+ * to out, if there is one, and their messages to err. Without err the
+ * messages are kept for batch_emit(). */
+static int batch_collect(struct batch *b, struct batch_file *f, FILE *out, FILE *err)
+{
+	struct batch_piece *p;
+	size_t base = 0;
+	size_t i;
+	int stopped = 0;
+	int ret = b->opts->tokens ? 0 : 1;
+
+	for (i = 0; i < f->npieces; i++) {
+		p = &f->pieces[i];
+
+		pthread_mutex_lock(&b->lock);
+
+		while (!p->done)
+			pthread_cond_wait(&b->done, &b->lock);
+
+		pthread_mutex_unlock(&b->lock);
+
+		if (stopped) {
+			free(p->err);
+			p->err = NULL;
+			p->err_length = 0;
+		} else {
+			if (out)
+				write_marked(out, p, base);
+
+			base += p->values;
+			stopped = p->stopped;
+
+			if (b->opts->tokens)
+				ret |= p->ret;
+			else
+				ret &= p->ret;
+		}
+
+		if (err && p->err) {
+			fwrite(p->err, 1, p->err_length, err);
+			free(p->err);
+			p->err = NULL;
+		}
+
+		free(p->out);
+		free(p->marks.marks);
+		p->out = NULL;
+		p->marks.marks = NULL;
+	}
+
+	if (f->text)
+		munmap(f->text, (size_t)f->size);
+
+	f->text = NULL;
+
+	return ret;
+}
+
+/* Writes a finished file to the output directory. A file read as one piece
+ * has already been written there by batch_parse_piece(). */
+static void batch_store(struct batch *b, struct batch_file *f)
+{
+	FILE *out = NULL;
+	size_t i;
+
+	if (f->npieces > 1 && !(out = batch_open_output(b, f)))
+		f->open_error = errno;
+
+	f->ret = batch_collect(b, f, out, NULL);
+
+	if (out)
+		fclose(out);
+
+	if (f->open_error) {
+		f->ret = 1;
+
+		for (i = 0; i < f->npieces; i++) {
+			free(f->pieces[i].err);
+			f->pieces[i].err = NULL;
+		}
+	}
+
+	pthread_mutex_lock(&b->lock);
+	f->stored = 1;
+	pthread_cond_broadcast(&b->done);
+	pthread_mutex_unlock(&b->lock);
+}
+
+static void batch_parse_piece(void *arg)
+{
+	struct batch_piece *p = arg;
+	struct batch_file *f = p->file;
+	struct batch *b = f->batch;
+	struct json_tokenizer_t tok;
+	struct mem_source mem;
+	struct fd_reader fdr;
+	struct error_sink sink;
+	FILE *out;
+	FILE *err;
+	int fd = -1;
+	int last;
+
+	p->ret = 1;
+	p->stopped = 1;
+	err = open_memstream(&p->err, &p->err_length);
+
+	if (b->output_dir && f->npieces == 1)
+		out = batch_open_output(b, f);
+	else
+		out = open_memstream(&p->out, &p->out_length);
+
+	if (!err || !out) {
+		if (err)
+			fprintf(err, "%s: %s\n", f->path, strerror(errno));
+	} else if (!f->text && (fd = open(f->path, O_RDONLY)) < 0) {
+		fprintf(err, "%s: %s\n", f->path, strerror(errno));
+	} else if (!f->text && fd_reader_init(&fdr, fd, b->bufsize)) {
+		fprintf(err, "%s: out of memory\n", f->path);
+		close(fd);
+	} else {
+		if (f->text) {
+			mem.begin = f->text + p->begin;
+			mem.end = f->text + p->end;
+			json_tokenizer_init_buffered(&tok, &mem,
+					(int (*)(void *, const char **, const char **))mem_fill);
+			json_tokenizer_start_at(&tok, p->start.offset, p->start.lines,
+					p->start.line_start);
+		} else {
+			json_tokenizer_init_buffered(&tok, &fdr,
+					(int (*)(void *, const char **, const char **))fd_reader_fill);
+		}
+
+		tok.allocator = b->proto->allocator;
+		tok.limits = b->proto->limits;
+		tok.string_chunk_size = b->proto->string_chunk_size;
+		tok.pack_arrays = b->proto->pack_arrays;
+		sink.f = err;
+		sink.name = f->path;
+		tok.error_handler = &sink;
+
+		p->ret = parse_all(&tok, b->opts, out, f->npieces > 1 ? &p->marks : NULL,
+				&p->values);
+		p->stopped = tok.error || tok.kind != JSON_TOK_NONE;
+
+		json_tokenizer_destroy(&tok);
+
+		if (!f->text && fdr.error) {
+			fprintf(err, "%s: %s\n", f->path, strerror(fdr.error));
+			p->ret = 1;
+			p->stopped = 1;
+		}
+
+		if (!f->text)
+			fd_reader_destroy(&fdr);
+	}
+
+	if (out)
+		fclose(out);
+
+	if (err)
+		fclose(err);
+
+	pthread_mutex_lock(&b->lock);
+	p->done = 1;
+	last = --f->pending == 0;
+	pthread_cond_broadcast(&b->done);
+	pthread_mutex_unlock(&b->lock);
+
+	if (last && b->output_dir)
+		batch_store(b, f);
+}
+
+/* Maps a big file and cuts it up. Leaves it alone, to be read as one piece,
+ * if it cannot be mapped or has nowhere to cut. */
+static void batch_split(struct batch_file *f)
+{
+	struct json_split_point_t *points;
+	struct batch_piece *pieces;
+	size_t count;
+	size_t i;
+	void *text;
+	int fd;
+
+	if ((fd = open(f->path, O_RDONLY)) < 0)
+		return;
+
+	text = mmap(NULL, (size_t)f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (text == MAP_FAILED)
+		return;
+
+	if (json_split(text, (size_t)f->size, f->batch->split_size, &points, &count)
+			|| !count || !(pieces = calloc(count + 1, sizeof(*pieces)))) {
+		munmap(text, (size_t)f->size);
+		return;
+	}
+
+	for (i = 0; i <= count; i++) {
+		pieces[i].file = f;
+		pieces[i].begin = i ? points[i - 1].offset : 0;
+		pieces[i].end = i < count ? points[i].offset : (size_t)f->size;
+
+		if (i)
+			pieces[i].start = points[i - 1];
+	}
+
+	free(points);
+	free(f->pieces);
+	f->text = text;
+	f->pieces = pieces;
+	f->npieces = count + 1;
+}
+
+static void batch_parse_file(void *arg)
+{
+	struct batch_file *f = arg;
+	struct batch *b = f->batch;
+	size_t i;
+
+	f->npieces = 1;
+
+	if (!(f->pieces = calloc(1, sizeof(*f->pieces)))) {
+		f->npieces = 0;
+	} else {
+		f->pieces->file = f;
+
+		if (b->split_size && (size_t)f->size >= 2 * b->split_size)
+			batch_split(f);
+	}
+
+	f->pending = f->npieces;
+
+	pthread_mutex_lock(&b->lock);
+	f->ready = 1;
+	pthread_cond_broadcast(&b->done);
+	pthread_mutex_unlock(&b->lock);
+
+	/* Pieces go on this worker's deque for idle workers to steal. */
+	for (i = 1; i < f->npieces; i++)
+		if (work_pool_submit(&b->pool, batch_parse_piece, &f->pieces[i]))
+			batch_parse_piece(&f->pieces[i]);
+
+	if (f->npieces)
+		batch_parse_piece(&f->pieces[0]);
+}
+
+/* Prints a file's output, or with an output directory just its messages,
+ * once it is ready. */
+static int batch_emit(struct batch *b, struct batch_file *f)
+{
+	size_t i;
+
+	if (!f->npieces) {
+		fprintf(stderr, "%s: out of memory\n", f->path);
+		return 1;
+	}
+
+	if (!b->output_dir)
+		return batch_collect(b, f, stdout, stderr);
+
+	pthread_mutex_lock(&b->lock);
+
+	while (!f->stored)
+		pthread_cond_wait(&b->done, &b->lock);
+
+	pthread_mutex_unlock(&b->lock);
+
+	if (f->open_error)
+		fprintf(stderr, "%s: %s\n", f->path, strerror(f->open_error));
+
+	for (i = 0; i < f->npieces; i++) {
+		if (f->pieces[i].err)
+			fwrite(f->pieces[i].err, 1, f->pieces[i].err_length, stderr);
+
+		free(f->pieces[i].err);
+	}
+
+	return f->ret;
+}
+
+static void batch_submit(struct batch *b, struct batch_file *f)
+{
+	f->submitted = 1;
+
+	if (work_pool_submit(&b->pool, batch_parse_file, f))
+		batch_parse_file(f);
+}
+
+static int compare_sizes(const void *a, const void *b)
+{
+	off_t x = (*(struct batch_file * const *)a)->size;
+	off_t y = (*(struct batch_file * const *)b)->size;
+
+	return (x < y) - (x > y);
+}
+
+/* Parses every file named in paths. The biggest files are started first so
+ * that none of them is left running alone at the end. */
+static int batch_parse(char **paths, size_t npaths, size_t jobs, size_t split_size,
+		const struct parse_options *opts, const struct json_tokenizer_t *proto,
+		const char *output_dir, size_t bufsize)
+{
+	struct batch b = { 0 };
+	struct batch_file **order = NULL;
+	struct batch_file *f;
+	size_t in_flight = 0;
+	size_t ahead;
+	size_t next = 0;
+	size_t i;
+	int ret = 0;
+
+	b.opts = opts;
+	b.proto = proto;
+	b.output_dir = output_dir;
+	b.bufsize = bufsize;
+	b.split_size = split_size;
+	pthread_mutex_init(&b.lock, NULL);
+	pthread_cond_init(&b.done, NULL);
+
+	for (i = 0; i < npaths; i++) {
+		if (batch_add_path(&b, paths[i])) {
+			fprintf(stderr, "Out of memory\n");
+			ret = 1;
+			goto done;
+		}
+	}
+
+	if (!(order = malloc((b.count ? b.count : 1) * sizeof(*order)))) {
+		ret = 1;
+		goto done;
+	}
+
+	for (i = 0; i < b.count; i++)
+		order[i] = &b.files[i];
+
+	qsort(order, b.count, sizeof(*order), compare_sizes);
+
+	if (work_pool_init(&b.pool, jobs, json_pool_trim)) {
+		fprintf(stderr, "Could not start the worker threads\n");
+		work_pool_destroy(&b.pool);
+		ret = 1;
+		goto done;
+	}
+
+	ahead = b.output_dir ? b.count : b.pool.workers * BATCH_AHEAD;
+
+	/* Hand each file's output over as soon as everything before it is out.
+	 * The next one to print is started even if that lets one more ahead. */
+	for (i = 0; i < b.count; i++) {
+		f = &b.files[i];
+
+		for (; next < b.count && in_flight < ahead; next++) {
+			if (!order[next]->submitted) {
+				batch_submit(&b, order[next]);
+				in_flight++;
+			}
+		}
+
+		if (!f->submitted) {
+			batch_submit(&b, f);
+			in_flight++;
+		}
+
+		pthread_mutex_lock(&b.lock);
+
+		while (!f->ready)
+			pthread_cond_wait(&b.done, &b.lock);
+
+		pthread_mutex_unlock(&b.lock);
+
+		ret |= batch_emit(&b, f);
+		in_flight--;
+	}
+
+	work_pool_destroy(&b.pool);
+
+done:
+	for (i = 0; i < b.count; i++) {
+		free(b.files[i].path);
+		free(b.files[i].pieces);
+	}
+
+	free(b.files);
+	free(order);
+	pthread_cond_destroy(&b.done);
+	pthread_mutex_destroy(&b.lock);
+
+	return ret;
+}
+
+/* Prints a row group column by column, one line per column. */
+static void print_row_group(void *ctx, const struct json_shredder_t *s)
+{
+	const struct json_column_t *c;
+	FILE *out = ctx;
+	const char *text;
+	size_t length;
+	size_t i;
+	size_t r;
+
+	fprintf(out, "Row group #%zu: %zu rows\n", s->row_groups, s->rows);
+
+	for (i = 0; i < s->ncolumns; i++) {
+		c = &s->columns[i];
+		fprintf(out, "\"%s\" %s:", c->path, json_column_type_to_str(c->type));
+
+		for (r = 0; r < s->rows; r++) {
+			fputs(r ? ", " : " ", out);
+
+			if (!json_column_is_valid(c, r)) {
+				fputs("null", out);
+				continue;
+			}
+
+			if (c->type == JSON_COLUMN_INT) {
+				fprintf(out, "%" PRIi64, c->ints[r]);
+			} else if (c->type == JSON_COLUMN_FLOAT) {
+				fprintf(out, "%g", c->floats[r]);
+			} else if (c->type == JSON_COLUMN_BOOL) {
+				fputs(c->ints[r] ? "true" : "false", out);
+			} else {
+				text = json_column_text(c, r, &length);
+				fprintf(out, c->type == JSON_COLUMN_STRING ? "\"%.*s\"" : "%.*s",
+						(int)length, text);
+			}
+		}
+
+		fputc('\n', out);
+	}
+}
+
+/* Shreds every value in the input into columns printed rows row groups at a
+ * time. */
+static int shred_all(struct json_tokenizer_t *tok, size_t rows, FILE *out)
+{
+	struct json_shredder_t s;
+	int ret = 0;
+
+	json_shredder_init(&s, rows, print_row_group, out);
+	json_tokenizer_next(tok);
+	tok->on_error = report_error;
+
+	while (tok->kind != JSON_TOK_NONE) {
+		if (json_shredder_add(&s, tok)) {
+			ret = 1;
+			break;
+		}
+	}
+
+	json_shredder_flush(&s);
+	json_shredder_destroy(&s);
+
+	return ret;
+}
+
+/* Prints record n of standard input, found through the index in index_path
+ * without reading what comes before it. */
+static int print_record(const char *index_path, size_t n, struct json_tokenizer_t *proto,
+		size_t bufsize)
+{
+	struct json_index_t index;
+	struct json_index_entry_t e;
+	struct json_tokenizer_t tok;
+	struct json_value_t val = { 0 };
+	struct fd_reader fdr;
+	FILE *f;
+	int ret = 1;
+
+	json_index_init(&index, 0);
+
+	if (!(f = fopen(index_path, "rb")) || json_index_read(&index, f)) {
+		fprintf(stderr, "%s: %s\n", index_path, f ? "not an index" : strerror(errno));
+		goto done;
+	}
+
+	if (json_index_get(&index, n, &e)) {
+		fprintf(stderr, "No record %zu, the index has %zu\n", n, index.count);
+		goto done;
+	}
+
+	if (fd_reader_init(&fdr, STDIN_FILENO, bufsize)) {
+		fprintf(stderr, "Out of memory\n");
+		goto done;
+	}
+
+	if (fd_reader_seek(&fdr, (off_t)e.offset)) {
+		fprintf(stderr, "Standard input can not seek: %s\n", strerror(errno));
+		fd_reader_destroy(&fdr);
+		goto done;
+	}
+
+	json_tokenizer_init_buffered(&tok, &fdr,
+			(int (*)(void *, const char **, const char **))fd_reader_fill);
+	tok.allocator = proto->allocator;
+	tok.limits = proto->limits;
+	tok.pack_arrays = proto->pack_arrays;
+	tok.on_error = report_error;
+
+	if (!json_index_parse(&index, n, &tok, &val)) {
+		print_value(stdout, &val);
+		ret = 0;
+	}
+
+	json_value_destroy_a(&val, tok.allocator);
 	json_tokenizer_destroy(&tok);
+	fd_reader_destroy(&fdr);
+
+done:
+	if (f)
+		fclose(f);
+
+	json_index_destroy(&index);
+
+	return ret;
+}
+
+/* Prints the values in standard input as they are appended to it, saving in
+ * checkpoint_path, if given, how far it got after each run of them so that
+ * the next run picks up from there. */
+static int follow_input(const char *checkpoint_path, const struct parse_options *o,
+		struct json_tokenizer_t *proto)
+{
+	struct json_follow_t f;
+	struct json_split_point_t at = { 0 };
+	struct json_tokenizer_t tok;
+	struct mem_source mem;
+	const char *begin;
+	const char *end;
+	size_t values = 0;
+	int stopped;
+	int r;
+	int ret = 0;
+
+	if (checkpoint_path && json_checkpoint_load(checkpoint_path, &at, &values)) {
+		if (access(checkpoint_path, F_OK) == 0) {
+			fprintf(stderr, "%s: not a checkpoint\n", checkpoint_path);
+			return 1;
+		}
+
+		memset(&at, 0, sizeof(at));
+		values = 0;
+	}
+
+	if (json_follow_open(&f, STDIN_FILENO, &at)) {
+		fprintf(stderr, "Standard input can not seek: %s\n", strerror(errno));
+		json_follow_close(&f);
+		return 1;
+	}
+
+	while (!(r = json_follow_next(&f, &begin, &end, &at))) {
+		mem.begin = begin;
+		mem.end = end;
+		json_tokenizer_init_buffered(&tok, &mem,
+				(int (*)(void *, const char **, const char **))mem_fill);
+		json_tokenizer_start_at(&tok, at.offset, at.lines, at.line_start);
+		tok.allocator = proto->allocator;
+		tok.limits = proto->limits;
+		tok.string_chunk_size = proto->string_chunk_size;
+		tok.pack_arrays = proto->pack_arrays;
+
+		parse_all(&tok, o, stdout, NULL, &values);
+		stopped = tok.error || tok.kind != JSON_TOK_NONE;
+		json_tokenizer_destroy(&tok);
+
+		/* Broken input stays ahead of the checkpoint. */
+		if (stopped) {
+			ret = 1;
+			break;
+		}
+
+		fflush(stdout);
+		json_follow_commit(&f);
+
+		if (checkpoint_path && json_checkpoint_save(checkpoint_path, &f.done, values)) {
+			fprintf(stderr, "%s: %s\n", checkpoint_path, strerror(errno));
+			ret = 1;
+			break;
+		}
+	}
+
+	if (r > 0) {
+		fprintf(stderr, "Standard input could not be read or was truncated\n");
+		ret = 1;
+	}
+
+	json_follow_close(&f);
+
+	return ret;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+			"Usage: %s [options] [FILE|DIR]...\n"
+			"\n"
+			"Reads standard input unless files, or directories of them, are named.\n"
+			"\n"
+			"  --select PATH       only build the values at PATH, e.g. .user.id or .events[*].ts;\n"
+			"                      may be repeated\n"
+			"  --stream            print the elements of top-level arrays one by one instead of\n"
+			"                      building the whole array first\n"
+			"  --compact           build each value as a tree of 16-byte json_node_t nodes;\n"
+			"                      not with --select, --stream, --freeze or --pack-arrays\n"
+			"  --freeze            move each top-level value into a single block of memory\n"
+			"                      before printing it\n"
+			"  --pack-arrays       keep arrays of only ints or only floats as plain int64_t or\n"
+			"                      double arrays\n"
+			"  --tokens            list every token with its offset and length instead of\n"
+			"                      parsing\n"
+			"  --stats             dump tokenizer and parser counters to stderr as JSON on exit;\n"
+			"                      needs a build with JSON_STATS on, and not with named files,\n"
+			"                      --follow or --record\n"
+			"  --max-depth N       reject values nested deeper than N\n"
+			"  --max-token N       reject tokens longer than N bytes\n"
+			"  --max-string N      reject strings longer than N bytes\n"
+			"  --string-chunk N    hand strings of N bytes or more to the parser in pieces of\n"
+			"                      about N bytes\n"
+			"  --max-elements N    reject arrays and objects with more than N elements\n"
+			"  --max-bytes N       reject top-level values taking more than N bytes\n"
+			"  --buffer-size N     read the input N bytes at a time (default 64 KiB)\n"
+			"  --read-ahead N      keep up to N buffers of standard input read ahead on a\n"
+			"                      second thread\n"
+			"  --uring             read standard input through io_uring\n"
+			"  --pipeline          tokenize standard input on a second thread while this one\n"
+			"                      parses\n"
+			"  --jobs N            parse named files on N threads; one per processor by default\n"
+			"  --split-size N      cut named files of 2N bytes or more into pieces of about N\n"
+			"                      bytes between top-level values, parsed in parallel; 0 never\n"
+			"                      cuts (default 8 MiB)\n"
+			"  --output-dir DIR    write each named file's output to DIR/NAME.out\n"
+			"  --index FILE        save where every top-level value starts in FILE\n"
+			"  --index-elements    index the elements of top-level arrays instead; implies\n"
+			"                      --stream\n"
+			"  --index-no-lines    leave line numbers out of the index\n"
+			"  --record N          with --index, print only the Nth record of a seekable input\n"
+			"  --follow            keep reading standard input as it grows, like tail -f; values\n"
+			"                      are printed once all of an object or array has been written\n"
+			"  --checkpoint FILE   with --follow, resume from and save to FILE how far the input\n"
+			"                      has been printed\n"
+			"  --shred N           split the values into a column per leaf JSON Pointer, printed\n"
+			"                      N rows at a time\n",
+			argv0);
+}
+
+static int parse_size_arg(int argc, char **argv, size_t *i, size_t *out)
+{
+	char *end;
+
+	if (*i + 1 >= (size_t)argc)
+		return 1;
+
+	*out = strtoull(argv[++*i], &end, 10);
+
+	return *end != '\0';
+}
+
+int main(int argc, char **argv)
+{
+	struct fstream_reader fstr = { 0 };
+	struct fd_reader fdr = { 0 };
+	struct uring_loop loop = { 0 };
+	struct uring_reader ur = { 0 };
+	void *input = &fstr;
+	int (*input_fill)(void *, const char **, const char **) =
+			(int (*)(void *, const char **, const char **))fstream_fill;
+	void (*input_interrupt)(void *) = (void (*)(void *))fstream_interrupt;
+	struct json_tokenizer_t plain = { 0 };
+	struct json_tokenizer_t *tok = &plain;
+	struct json_pipeline_t pipe = { 0 };
+	struct json_projection_t proj = { 0 };
+	struct parse_options opts = { 0 };
+	struct json_stats_t stats;
+	int dump_stats = 0;
+	int pipeline = 0;
+	int uring = 0;
+	size_t bufsize = FD_READER_DEFAULT_BUFSIZE;
+	size_t read_ahead = 0;
+	size_t jobs = 0;
+	size_t split_size = 8 * 1024 * 1024;
+	struct json_index_t index;
+	const char *index_path = NULL;
+	unsigned index_flags = JSON_INDEX_LINES;
+	size_t record = SIZE_MAX;
+	const char *output_dir = NULL;
+	const char *checkpoint_path = NULL;
+	int follow = 0;
+	size_t shred_rows = 0;
+	char **paths = NULL;
+	size_t npaths = 0;
+	size_t i = 0;
+	int ret = 1;
+
+	fdr.fd = -1;
+	loop.ring_fd = -1;
+	json_tokenizer_init_buffered(tok, NULL, NULL);
+	tok->allocator = &json_pool_allocator;
+	json_projection_init(&proj);
+
+	for (i = 1; i < (size_t)argc; i++) {
+		if (strcmp(argv[i], "--select") == 0) {
+			if (i + 1 >= (size_t)argc || json_projection_add(&proj, argv[++i]))
+				goto usage;
+
+			opts.proj = &proj;
+		} else if (strcmp(argv[i], "--stream") == 0) {
+			opts.stream = 1;
+		} else if (strcmp(argv[i], "--pipeline") == 0) {
+			pipeline = 1;
+		} else if (strcmp(argv[i], "--uring") == 0) {
+			uring = 1;
+		} else if (strcmp(argv[i], "--compact") == 0) {
+			opts.compact = 1;
+		} else if (strcmp(argv[i], "--freeze") == 0) {
+			opts.freeze = 1;
+		} else if (strcmp(argv[i], "--pack-arrays") == 0) {
+			tok->pack_arrays = 1;
+		} else if (strcmp(argv[i], "--tokens") == 0) {
+			opts.tokens = 1;
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			dump_stats = 1;
+		} else if (strcmp(argv[i], "--max-depth") == 0) {
+			if (parse_size_arg(argc, argv, &i, &tok->limits.max_depth))
+				goto usage;
+		} else if (strcmp(argv[i], "--max-token") == 0) {
+			if (parse_size_arg(argc, argv, &i, &tok->limits.max_token_length))
+				goto usage;
+		} else if (strcmp(argv[i], "--max-string") == 0) {
+			if (parse_size_arg(argc, argv, &i, &tok->limits.max_string_length))
+				goto usage;
+		} else if (strcmp(argv[i], "--max-elements") == 0) {
+			if (parse_size_arg(argc, argv, &i, &tok->limits.max_container_elements))
+				goto usage;
+		} else if (strcmp(argv[i], "--max-bytes") == 0) {
+			if (parse_size_arg(argc, argv, &i, &tok->limits.max_total_bytes))
+				goto usage;
+		} else if (strcmp(argv[i], "--buffer-size") == 0) {
+			if (parse_size_arg(argc, argv, &i, &bufsize) || bufsize == 0)
+				goto usage;
+		} else if (strcmp(argv[i], "--read-ahead") == 0) {
+			if (parse_size_arg(argc, argv, &i, &read_ahead))
+				goto usage;
+		} else if (strcmp(argv[i], "--string-chunk") == 0) {
+			if (parse_size_arg(argc, argv, &i, &tok->string_chunk_size)
+					|| tok->string_chunk_size == 0)
+				goto usage;
+		} else if (strcmp(argv[i], "--jobs") == 0) {
+			if (parse_size_arg(argc, argv, &i, &jobs))
+				goto usage;
+		} else if (strcmp(argv[i], "--index") == 0) {
+			if (i + 1 >= (size_t)argc)
+				goto usage;
+
+			index_path = argv[++i];
+		} else if (strcmp(argv[i], "--index-elements") == 0) {
+			index_flags |= JSON_INDEX_ELEMENTS;
+		} else if (strcmp(argv[i], "--index-no-lines") == 0) {
+			index_flags &= ~(unsigned)JSON_INDEX_LINES;
+		} else if (strcmp(argv[i], "--record") == 0) {
+			if (parse_size_arg(argc, argv, &i, &record))
+				goto usage;
+		} else if (strcmp(argv[i], "--split-size") == 0) {
+			if (parse_size_arg(argc, argv, &i, &split_size))
+				goto usage;
+		} else if (strcmp(argv[i], "--shred") == 0) {
+			if (parse_size_arg(argc, argv, &i, &shred_rows) || shred_rows == 0)
+				goto usage;
+		} else if (strcmp(argv[i], "--follow") == 0) {
+			follow = 1;
+		} else if (strcmp(argv[i], "--checkpoint") == 0) {
+			if (i + 1 >= (size_t)argc)
+				goto usage;
+
+			checkpoint_path = argv[++i];
+		} else if (strcmp(argv[i], "--output-dir") == 0) {
+			if (i + 1 >= (size_t)argc)
+				goto usage;
+
+			output_dir = argv[++i];
+		} else if (argv[i][0] == '-') {
+			goto usage;
+		} else {
+			if (!paths)
+				paths = &argv[i];
+
+			/* Paths come after all the options. */
+			if (&argv[i] != paths + npaths)
+				goto usage;
+
+			npaths++;
+		}
+	}
+
+	if (index_path && (npaths || pipeline || opts.tokens))
+		goto usage;
+
+	if (opts.compact && (opts.proj || opts.stream || opts.freeze || plain.pack_arrays))
+		goto usage;
+
+	if (shred_rows && (npaths || follow || index_path || opts.tokens || opts.proj
+				|| opts.stream || opts.compact || opts.freeze))
+		goto usage;
+
+	if (follow && (npaths || index_path || pipeline || uring))
+		goto usage;
+
+	if (checkpoint_path && !follow)
+		goto usage;
+
+	/* Only a single parse of standard input reports its counters. */
+	if (dump_stats && (follow || npaths || record != SIZE_MAX))
+		goto usage;
+
+	if (dump_stats && !JSON_STATS) {
+		fprintf(stderr, "--stats needs a build with JSON_STATS on\n");
+		json_tokenizer_destroy(&plain);
+		json_projection_destroy(&proj);
+
+		return 2;
+	}
+
+	if (follow) {
+		ret = follow_input(checkpoint_path, &opts, &plain);
+		json_tokenizer_destroy(&plain);
+		json_projection_destroy(&proj);
+		json_pool_trim();
+
+		return ret;
+	}
+
+	if (record != SIZE_MAX) {
+		if (!index_path)
+			goto usage;
+
+		ret = print_record(index_path, record, &plain, bufsize);
+		json_tokenizer_destroy(&plain);
+		json_projection_destroy(&proj);
+		json_pool_trim();
+
+		return ret;
+	}
+
+	if (npaths) {
+		ret = batch_parse(paths, npaths, jobs, split_size, &opts, &plain,
+				output_dir, bufsize);
+		json_tokenizer_destroy(&plain);
+		json_projection_destroy(&proj);
+		json_pool_trim();
+
+		return ret;
+	}
+
+	if (uring) {
+		if (uring_loop_init(&loop, URING_READER_DEPTH, bufsize)
+				|| uring_reader_open(&loop, &ur, STDIN_FILENO)) {
+			fprintf(stderr, "Could not set up the reader\n");
+			goto done;
+		}
+
+		input = &ur;
+		input_fill = (int (*)(void *, const char **, const char **))uring_reader_fill;
+		input_interrupt = (void (*)(void *))uring_reader_interrupt;
+
+		if (pipeline && uring_reader_allow_interrupt(&ur))
+			input_interrupt = NULL;
+	} else if (read_ahead > 1) {
+		if (fstream_init_readahead(&fstr, stdin, bufsize, read_ahead))
+			fprintf(stderr, "Could not start the read-ahead thread, reading inline\n");
+	} else if (!fd_reader_init(&fdr, STDIN_FILENO, bufsize)) {
+		input = &fdr;
+		input_fill = (int (*)(void *, const char **, const char **))fd_reader_fill;
+		input_interrupt = (void (*)(void *))fd_reader_interrupt;
+
+		if (pipeline && fd_reader_allow_interrupt(&fdr))
+			input_interrupt = NULL;
+	} else {
+		fstream_init(&fstr, stdin, bufsize);
+	}
+
+	tok->cs = input;
+	tok->cs_fill = input_fill;
+
+	if (pipeline) {
+		json_pipeline_init(&pipe, input, input_fill, 0);
+		pipe.cs_interrupt = input_interrupt;
+		pipe.tokenizer.allocator = plain.allocator;
+		pipe.tokenizer.limits = plain.limits;
+		pipe.tokenizer.string_chunk_size = plain.string_chunk_size;
+		pipe.tokenizer.pack_arrays = plain.pack_arrays;
+		tok = &pipe.tokenizer;
+
+		if (json_pipeline_start(&pipe)) {
+			fprintf(stderr, "Could not start the tokenizer thread\n");
+			goto done;
+		}
+	}
+
+	if (index_path) {
+		json_index_init(&index, index_flags);
+		opts.index = &index;
+
+		/* Elements can only be told apart while streaming. */
+		if (index_flags & JSON_INDEX_ELEMENTS)
+			opts.stream = 1;
+	}
+
+	i = 0;
+
+	if (shred_rows)
+		ret = shred_all(tok, shred_rows, stdout);
+	else
+		ret = parse_all(tok, &opts, stdout, NULL, &i);
+
+	if (index_path) {
+		FILE *f = fopen(index_path, "wb");
+
+		if (!f || json_index_write(&index, f) || fclose(f)) {
+			fprintf(stderr, "%s: %s\n", index_path, strerror(errno));
+			ret = 1;
+		}
+
+		json_index_destroy(&index);
+	}
+
+done:
+	if (dump_stats) {
+		if (pipeline)
+			json_pipeline_stats(&pipe, &stats);
+		else
+			json_tokenizer_stats(tok, &stats);
+		json_stats_to_string(&stats, stderr,
+				(void(*)(void *, const char *, size_t))write_to_file);
+		fputs("\n", stderr);
+	}
+
+	if (pipeline)
+		json_pipeline_destroy(&pipe);
+
+	json_tokenizer_destroy(&plain);
+
+	if (fdr.error) {
+		fprintf(stderr, "Could not read the input: %s\n", strerror(fdr.error));
+		ret = 1;
+	}
+
+	if (ur.loop) {
+		if (ur.error) {
+			fprintf(stderr, "Could not read the input: %s\n", strerror(ur.error));
+			ret = 1;
+		}
+
+		uring_reader_close(&ur);
+	}
+
+	uring_loop_destroy(&loop);
+	fd_reader_destroy(&fdr);
 	fstream_destroy(&fstr);
+	json_projection_destroy(&proj);
+	json_pool_trim();
 
 	return ret;
+
+usage:
+	usage(argv[0]);
+	json_tokenizer_destroy(&plain);
+	fstream_destroy(&fstr);
+	json_projection_destroy(&proj);
+
+	return 2;
 }
@@ -0,0 +1,48 @@
+# Parses generated values into json_node_t trees with --compact and into the
+# regular DOM, which must print the same and stop at the same errors and
+# limits. The values mix every node kind, short and long strings, strings
+# handed over in chunks, and nesting up to 40 deep.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_compact.cmake
+
+set(input "${WORK_DIR}/compact_input.json")
+set(text "")
+
+foreach(i RANGE 0 299)
+	math(EXPR pad "${i} % 97")
+	math(EXPR depth "${i} % 40 + 1")
+	string(REPEAT "z" ${pad} z)
+	string(REPEAT "[" ${depth} open)
+	string(REPEAT "]" ${depth} close)
+	string(APPEND text "{\"i\": ${i}, \"f\": -${i}.25, \"s\": \"${z}\", \"e\": \"\\u00e9\\\"\", "
+		"\"t\": true, \"n\": null, \"o\": {}, \"a\": [], \"d\": ${open}${i}${close}, "
+		"\"z\": {\"y\": [false, {\"x\": \"${z}\"}]}}\n")
+endforeach()
+
+foreach(tail "" "[1, 2, {\"c\": ]}\n" "{\"deep\": [[[[[[[[[[[[1]]]]]]]]]]]]}\n"
+		"[0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10]\n")
+	file(WRITE "${input}" "${text}${tail}")
+
+	foreach(flags "" "--string-chunk;16" "--max-depth;12" "--max-elements;10")
+		execute_process(COMMAND "${STRTOK}" --buffer-size 4096 ${flags}
+			INPUT_FILE "${input}"
+			RESULT_VARIABLE plain_result
+			OUTPUT_VARIABLE plain_out
+			ERROR_VARIABLE plain_err)
+
+		if (NOT plain_out MATCHES "Object #0: ")
+			message(FATAL_ERROR "the input did not parse with ${flags}:\n${plain_err}")
+		endif()
+
+		execute_process(COMMAND "${STRTOK}" --buffer-size 4096 --compact ${flags}
+			INPUT_FILE "${input}"
+			RESULT_VARIABLE result
+			OUTPUT_VARIABLE out
+			ERROR_VARIABLE err)
+
+		if (NOT out STREQUAL plain_out OR NOT err STREQUAL plain_err
+				OR NOT result STREQUAL plain_result)
+			message(FATAL_ERROR "--compact ${flags} differs from the DOM:\n${err}")
+		endif()
+	endforeach()
+endforeach()
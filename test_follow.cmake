@@ -0,0 +1,71 @@
+# Follows a pipe to its end with --checkpoint, appends to the input and
+# follows it again as a file from the checkpoint. The two runs must print
+# what one plain parse of all of it does, and the error that ends the second
+# must be reported where a run over the whole input reports it.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_follow.cmake
+
+set(input "${WORK_DIR}/follow_input.json")
+set(checkpoint "${WORK_DIR}/follow_checkpoint")
+set(first "")
+set(second "")
+
+foreach(i RANGE 0 199)
+	string(APPEND first "{\"n\": ${i},\n \"a\": [${i}, \"}\"]}\n")
+endforeach()
+
+foreach(i RANGE 200 299)
+	string(APPEND second "[${i},\n{\"s\": \"[\"}]\n\n")
+endforeach()
+
+file(WRITE "${input}" "${first}${second}")
+
+execute_process(COMMAND "${STRTOK}"
+	INPUT_FILE "${input}"
+	OUTPUT_VARIABLE plain_out)
+
+file(WRITE "${input}" "${first}")
+file(REMOVE "${checkpoint}")
+
+execute_process(COMMAND sh -c "cat \"$1\" | \"$2\" --follow --checkpoint \"$3\""
+		sh "${input}" "${STRTOK}" "${checkpoint}"
+	TIMEOUT 10
+	RESULT_VARIABLE result
+	OUTPUT_VARIABLE first_out)
+
+if (NOT result STREQUAL "0" OR NOT EXISTS "${checkpoint}")
+	message(FATAL_ERROR "--follow did not finish the pipe (${result})")
+endif()
+
+file(READ "${checkpoint}" saved)
+file(APPEND "${input}" "${second}{\"bad\": }\n")
+
+execute_process(COMMAND sh -c "cat \"$1\" | \"$2\" --follow" sh "${input}" "${STRTOK}"
+	TIMEOUT 10
+	OUTPUT_QUIET
+	ERROR_VARIABLE whole_err)
+
+execute_process(COMMAND "${STRTOK}" --follow --checkpoint "${checkpoint}"
+	INPUT_FILE "${input}"
+	TIMEOUT 10
+	RESULT_VARIABLE result
+	OUTPUT_VARIABLE second_out
+	ERROR_VARIABLE second_err)
+
+if (NOT result STREQUAL "1")
+	message(FATAL_ERROR "--follow did not stop at the error (${result})")
+endif()
+
+if (NOT "${first_out}${second_out}" STREQUAL plain_out)
+	message(FATAL_ERROR "resuming from the checkpoint printed something else")
+endif()
+
+if (NOT second_err STREQUAL whole_err OR NOT whole_err MATCHES "Unexpected token")
+	message(FATAL_ERROR "the resumed run reported\n${second_err}instead of\n${whole_err}")
+endif()
+
+file(READ "${checkpoint}" kept)
+
+if (NOT kept STREQUAL saved)
+	message(FATAL_ERROR "the checkpoint moved past broken input")
+endif()
@@ -0,0 +1,44 @@
+# Parses generated values with --freeze, which must print what the trees
+# they were moved from would have. The values hold strings both short enough
+# to be kept inline and long enough not to be, empty containers, nesting and
+# packed arrays, and the input ends in a syntax error. With --stream the
+# elements of the top-level arrays are frozen one by one.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_freeze.cmake
+
+set(input "${WORK_DIR}/freeze_input.json")
+set(text "")
+
+foreach(i RANGE 0 299)
+	math(EXPR pad "${i} % 61")
+	string(REPEAT "f" ${pad} f)
+	string(APPEND text "{\"${f}\": \"${f}\", \"o\": {\"e\": {}, \"a\": [], \"b\": [true, null]}, "
+		"\"i\": [${i}, -1, ${pad}], \"d\": [${i}.5, 0.25], \"m\": [[\"${f}\", ${i}], {\"k${f}\": ${i}}]}\n"
+		"[${i}, \"${f}\", {\"f\": [\"${f}\"]}]\n")
+endforeach()
+
+string(APPEND text "{\"x\": [1, 2}\n")
+file(WRITE "${input}" "${text}")
+
+foreach(flags "" "--pack-arrays" "--stream")
+	execute_process(COMMAND "${STRTOK}" ${flags}
+		INPUT_FILE "${input}"
+		RESULT_VARIABLE plain_result
+		OUTPUT_VARIABLE plain_out
+		ERROR_VARIABLE plain_err)
+
+	if (NOT plain_out MATCHES "Object #299" OR NOT plain_err MATCHES "Unexpected token")
+		message(FATAL_ERROR "the input did not parse with ${flags}:\n${plain_err}")
+	endif()
+
+	execute_process(COMMAND "${STRTOK}" --freeze ${flags}
+		INPUT_FILE "${input}"
+		RESULT_VARIABLE result
+		OUTPUT_VARIABLE out
+		ERROR_VARIABLE err)
+
+	if (NOT out STREQUAL plain_out OR NOT err STREQUAL plain_err
+			OR NOT result STREQUAL plain_result)
+		message(FATAL_ERROR "--freeze ${flags} differs from the unfrozen trees")
+	endif()
+endforeach()
@@ -0,0 +1,82 @@
+# Saves an index of a generated file while parsing it and reads records back
+# through it with --record, which must print what the plain parse printed for
+# the same value, with and without line numbers in the index. The values
+# span lines and buffers, so that the saved offsets are checked as well as
+# the lookup.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_index.cmake
+
+set(input "${WORK_DIR}/index_input.json")
+set(index "${WORK_DIR}/index_input.idx")
+set(text "")
+
+foreach(i RANGE 0 599)
+	math(EXPR pad "${i} % 53")
+	string(REPEAT "y" ${pad} y)
+	string(APPEND text "{\"n\": ${i},\n \"s\": \"${y}\",\n \"a\": [${i}, [\"]\"], null]}\n")
+endforeach()
+
+file(WRITE "${input}" "${text}")
+
+# Prints value n of the parse in out as --record does, without the prefix.
+function(expected_record out n var)
+	string(REGEX MATCH "\nObject #${n}: [^\n]*\n" line "\n${out}")
+	string(REGEX REPLACE "^\nObject #${n}: " "" line "${line}")
+
+	if (line STREQUAL "")
+		message(FATAL_ERROR "the plain parse printed no value ${n}")
+	endif()
+
+	set(${var} "${line}" PARENT_SCOPE)
+endfunction()
+
+foreach(flags "--index" "--index-no-lines;--index")
+	execute_process(COMMAND "${STRTOK}" --buffer-size 4096 ${flags} "${index}"
+		INPUT_FILE "${input}"
+		OUTPUT_VARIABLE plain_out)
+
+	foreach(n 0 1 2 63 64 65 314 598 599)
+		execute_process(COMMAND "${STRTOK}" --buffer-size 4096 --index "${index}" --record ${n}
+			INPUT_FILE "${input}"
+			RESULT_VARIABLE result
+			OUTPUT_VARIABLE out
+			ERROR_VARIABLE err)
+		expected_record("${plain_out}" ${n} expected)
+
+		if (NOT result STREQUAL "0" OR NOT out STREQUAL expected)
+			message(FATAL_ERROR "${flags} --record ${n} printed\n${out}${err}instead of\n${expected}")
+		endif()
+	endforeach()
+
+	execute_process(COMMAND "${STRTOK}" --index "${index}" --record 600
+		INPUT_FILE "${input}"
+		RESULT_VARIABLE result
+		OUTPUT_QUIET
+		ERROR_QUIET)
+
+	if (NOT result STREQUAL "1")
+		message(FATAL_ERROR "${flags} --record 600 did not fail")
+	endif()
+endforeach()
+
+# With --index-elements the records are the elements of the top-level arrays.
+string(REPLACE "}\n{" "},\n{" elements "${text}")
+file(WRITE "${input}" "[\n${elements}, {}]\n")
+
+execute_process(COMMAND "${STRTOK}" --buffer-size 4096 --index-elements --index "${index}"
+	INPUT_FILE "${input}"
+	OUTPUT_VARIABLE plain_out)
+string(REPLACE "Object #0[" "Object #" plain_out "${plain_out}")
+string(REGEX REPLACE "\nObject #([0-9]+)\\]" "\nObject #\\1" plain_out "\n${plain_out}")
+
+foreach(n 0 299 599 600)
+	execute_process(COMMAND "${STRTOK}" --buffer-size 4096 --index "${index}" --record ${n}
+		INPUT_FILE "${input}"
+		RESULT_VARIABLE result
+		OUTPUT_VARIABLE out)
+	expected_record("${plain_out}" ${n} expected)
+
+	if (NOT result STREQUAL "0" OR NOT out STREQUAL expected)
+		message(FATAL_ERROR "--index-elements --record ${n} printed\n${out}instead of\n${expected}")
+	endif()
+endforeach()
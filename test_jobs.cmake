@@ -0,0 +1,71 @@
+# Parses a directory of generated files on one thread and on several, which
+# must print the same, both to standard output and with --output-dir. The
+# files range from a few bytes to big enough to be split, so the workers also
+# steal the pieces queued by one another, and one of them is broken.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_jobs.cmake
+
+set(dir "${WORK_DIR}/jobs_input")
+file(REMOVE_RECURSE "${dir}")
+file(MAKE_DIRECTORY "${dir}")
+
+foreach(f RANGE 0 39)
+	math(EXPR records "(${f} * ${f} * 7) % 300 + 1")
+	set(text "")
+
+	foreach(i RANGE 1 ${records})
+		string(APPEND text "{\"file\": ${f}, \"n\": ${i}, \"a\": [\"x\", ${i}.25, false]}\n")
+	endforeach()
+
+	if (f EQUAL 17)
+		string(APPEND text "{\"bad\": }\n")
+	endif()
+
+	file(WRITE "${dir}/in${f}.json" "${text}")
+endforeach()
+
+execute_process(COMMAND "${STRTOK}" --jobs 1 --split-size 0 "${dir}"
+	RESULT_VARIABLE one_result
+	OUTPUT_VARIABLE one_out
+	ERROR_VARIABLE one_err)
+
+if (NOT one_out MATCHES "\"file\": 39" OR NOT one_err MATCHES "in17.json: Unexpected token")
+	message(FATAL_ERROR "the files did not parse as expected:\n${one_err}")
+endif()
+
+foreach(jobs 4 8)
+	execute_process(COMMAND "${STRTOK}" --jobs ${jobs} --split-size 1000 "${dir}"
+		RESULT_VARIABLE result
+		OUTPUT_VARIABLE out
+		ERROR_VARIABLE err)
+
+	if (NOT out STREQUAL one_out OR NOT err STREQUAL one_err
+			OR NOT result STREQUAL one_result)
+		message(FATAL_ERROR "--jobs ${jobs} differs from --jobs 1")
+	endif()
+endforeach()
+
+foreach(jobs 1 4)
+	set(out_dir "${WORK_DIR}/jobs_output${jobs}")
+	file(REMOVE_RECURSE "${out_dir}")
+	file(MAKE_DIRECTORY "${out_dir}")
+
+	execute_process(COMMAND "${STRTOK}" --jobs ${jobs} --split-size 1000
+			--output-dir "${out_dir}" "${dir}"
+		RESULT_VARIABLE result
+		OUTPUT_QUIET
+		ERROR_QUIET)
+
+	if (NOT result STREQUAL one_result)
+		message(FATAL_ERROR "--output-dir --jobs ${jobs} returned ${result}")
+	endif()
+endforeach()
+
+foreach(f RANGE 0 39)
+	file(READ "${WORK_DIR}/jobs_output1/in${f}.json.out" one)
+	file(READ "${WORK_DIR}/jobs_output4/in${f}.json.out" four)
+
+	if (NOT one STREQUAL four)
+		message(FATAL_ERROR "--output-dir --jobs 4 wrote something else for in${f}.json")
+	endif()
+endforeach()
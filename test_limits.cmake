@@ -0,0 +1,55 @@
+# Feeds each --max-* limit a value at the limit, which must parse, followed
+# by one just past it, which must be rejected with the limit's message on the
+# line it is on. The input is read two bytes at a time, so that token and
+# string lengths are counted across buffers.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_limits.cmake
+
+set(input "${WORK_DIR}/limits_input.json")
+string(REPEAT "s" 40 s)
+
+function(check_limit flag n ok over message)
+	file(WRITE "${input}" "${ok}\n${over}\n${ok}\n")
+
+	execute_process(COMMAND "${STRTOK}" --buffer-size 2 ${flag} ${n} ${ARGN}
+		INPUT_FILE "${input}"
+		OUTPUT_VARIABLE out
+		ERROR_VARIABLE err)
+
+	if (NOT out MATCHES "^Object #0: [^\n]*\n$"
+			OR NOT err MATCHES "^Input rejected at 2:[0-9]+ --- ${message}\n$")
+		message(FATAL_ERROR "${flag} ${n} ${ARGN} printed\n${out}${err}")
+	endif()
+endfunction()
+
+check_limit(--max-depth 3 "[{\"a\": [1]}]" "[{\"a\": [[1]]}]" "nesting too deep")
+check_limit(--max-elements 3 "{\"a\": [1, 2, 3], \"b\": 2}" "{\"a\": [1, 2, 3, 4]}"
+	"too many container elements")
+check_limit(--max-token 6 "123456" "1234567" "token too long")
+check_limit(--max-string 40 "\"${s}\"" "[\"${s}x\"]" "string too long")
+check_limit(--max-string 40 "\"${s}\"" "[\"${s}x\"]" "string too long" --string-chunk 8)
+string(REPEAT "\"${s}\", " 8 strings)
+check_limit(--max-bytes 300 "{\"a\": \"${s}\"}" "{\"a\": [${strings}1]}" "value too large")
+
+# The limits hold per value, and none is hit by input within all of them.
+set(text "")
+
+foreach(i RANGE 0 199)
+	string(APPEND text "{\"n\": ${i}, \"a\": [[\"${s}\"], ${i}]}\n")
+endforeach()
+
+file(WRITE "${input}" "${text}")
+
+execute_process(COMMAND "${STRTOK}"
+	INPUT_FILE "${input}"
+	OUTPUT_VARIABLE plain_out)
+
+execute_process(COMMAND "${STRTOK}" --max-depth 3 --max-elements 2 --max-token 42
+		--max-string 40 --max-bytes 1000
+	INPUT_FILE "${input}"
+	OUTPUT_VARIABLE out
+	ERROR_VARIABLE err)
+
+if (NOT out STREQUAL plain_out OR NOT out MATCHES "Object #199" OR NOT err STREQUAL "")
+	message(FATAL_ERROR "values within the limits were rejected:\n${err}")
+endif()
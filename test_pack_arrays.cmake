@@ -0,0 +1,49 @@
+# Parses generated values with --pack-arrays, which must print what plain
+# arrays of the same numbers do: arrays of only ints, of only floats, of both,
+# empty ones, ones nested in others and ones at the int64_t limits.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_pack_arrays.cmake
+
+set(input "${WORK_DIR}/pack_arrays_input.json")
+set(text "[9223372036854775807, -9223372036854775808, 0]\n[1.5, -0.0, 1e300]\n[]\n")
+
+foreach(i RANGE 0 299)
+	math(EXPR length "${i} % 45")
+	set(ints "")
+	set(floats "")
+
+	foreach(j RANGE ${length})
+		math(EXPR n "${i} * ${j} - 1000")
+		string(APPEND ints "${n}, ")
+		string(APPEND floats "${n}.75, ")
+	endforeach()
+
+	string(APPEND text "{\"i\": [${ints}${i}], \"f\": [${floats}0.5], \"m\": [${ints}${i}.5], "
+		"\"n\": [[${ints}1], [${floats}2.5], [], [true, ${i}]]}\n")
+endforeach()
+
+string(APPEND text "[1, 2, 3,]\n")
+file(WRITE "${input}" "${text}")
+
+execute_process(COMMAND "${STRTOK}"
+	INPUT_FILE "${input}"
+	RESULT_VARIABLE plain_result
+	OUTPUT_VARIABLE plain_out
+	ERROR_VARIABLE plain_err)
+
+if (NOT plain_out MATCHES "Object #302" OR NOT plain_err MATCHES "Unexpected token")
+	message(FATAL_ERROR "the input did not parse:\n${plain_err}")
+endif()
+
+foreach(flags "" "--buffer-size;16" "--max-elements;46")
+	execute_process(COMMAND "${STRTOK}" --pack-arrays ${flags}
+		INPUT_FILE "${input}"
+		RESULT_VARIABLE result
+		OUTPUT_VARIABLE out
+		ERROR_VARIABLE err)
+
+	if (NOT out STREQUAL plain_out OR NOT err STREQUAL plain_err
+			OR NOT result STREQUAL plain_result)
+		message(FATAL_ERROR "--pack-arrays ${flags} differs from plain arrays:\n${err}")
+	endif()
+endforeach()
@@ -0,0 +1,63 @@
+# The pipelined parser must print what the plain one does, and must stop as
+# soon as it has seen a syntax error even though the writer keeps standard
+# input open: the producer thread is waiting for input by then, in whichever
+# source was picked, and has to be woken rather than waited for.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_pipeline.cmake
+
+set(input "${WORK_DIR}/pipeline_input.json")
+set(text "")
+
+foreach(i RANGE 0 2999)
+	math(EXPR pad "${i} % 41")
+	string(REPEAT "x" ${pad} x)
+	string(APPEND text "{\"n\": ${i}, \"s\": \"${x}\\\"\", \"a\": [${i}, ${pad}.5, true, null]}\n")
+endforeach()
+
+file(WRITE "${input}" "${text}")
+
+execute_process(COMMAND "${STRTOK}"
+	INPUT_FILE "${input}"
+	OUTPUT_VARIABLE plain_out)
+
+foreach(mode "--pipeline" "--pipeline;--read-ahead;4" "--pipeline;--uring")
+	execute_process(COMMAND "${STRTOK}" ${mode} --buffer-size 4096
+		INPUT_FILE "${input}"
+		OUTPUT_VARIABLE out)
+
+	if (NOT out STREQUAL plain_out)
+		message(FATAL_ERROR "${mode} prints something else than the plain parser")
+	endif()
+endforeach()
+
+# The writer sends a broken value and then holds the FIFO open for far
+# longer than the parser may take.
+set(fifo "${WORK_DIR}/pipeline_fifo")
+set(script [=[
+fifo=$1
+shift
+rm -f "$fifo"
+mkfifo "$fifo" || exit 99
+(printf '{"a": }\n'; exec sleep 60) > "$fifo" 2> /dev/null &
+writer=$!
+"$@" < "$fifo"
+rc=$?
+kill $writer
+rm -f "$fifo"
+exit $rc
+]=])
+
+foreach(mode "--pipeline" "--pipeline;--read-ahead;4" "--pipeline;--uring"
+		"--read-ahead;4" "--uring")
+	foreach(run RANGE 1 20)
+		execute_process(COMMAND sh -c "${script}" sh "${fifo}" "${STRTOK}" ${mode}
+			TIMEOUT 10
+			RESULT_VARIABLE result
+			OUTPUT_QUIET
+			ERROR_VARIABLE err)
+
+		if (NOT result STREQUAL "1" OR NOT err MATCHES "Unexpected token")
+			message(FATAL_ERROR "${mode} did not stop at the error (${result}):\n${err}")
+		endif()
+	endforeach()
+endforeach()
@@ -0,0 +1,53 @@
+# Puts a syntax error at many places in generated input, after lines of
+# different lengths and multi-byte characters, and checks that it is
+# reported at the same line and column however the input is read: in
+# buffers from one byte to the default size, ahead on another thread, or
+# from a named file.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_positions.cmake
+
+set(input "${WORK_DIR}/positions_input.json")
+
+foreach(bad 0 7 38 39 40 131)
+	set(text "")
+
+	foreach(i RANGE 0 ${bad})
+		math(EXPR pad "${i} * 7 % 50")
+		string(REPEAT "é" ${pad} p)
+		string(APPEND text "{\"p\": \"${p}\",\n  \"n\": ${i}}\n")
+	endforeach()
+
+	string(APPEND text "{\"p\": \"${p}\", \"n\": [1 2]}\n")
+	file(WRITE "${input}" "${text}")
+
+	execute_process(COMMAND "${STRTOK}"
+		INPUT_FILE "${input}"
+		OUTPUT_QUIET
+		ERROR_VARIABLE plain_err)
+
+	math(EXPR line "${bad} * 2 + 3")
+
+	if (NOT plain_err MATCHES "^Unexpected token at ${line}:[0-9]+ --- \"2\"\n$")
+		message(FATAL_ERROR "the error after ${bad} values was reported as\n${plain_err}")
+	endif()
+
+	foreach(flags "--buffer-size;1" "--buffer-size;3" "--buffer-size;64"
+			"--read-ahead;2;--buffer-size;5")
+		execute_process(COMMAND "${STRTOK}" ${flags}
+			INPUT_FILE "${input}"
+			OUTPUT_QUIET
+			ERROR_VARIABLE err)
+
+		if (NOT err STREQUAL plain_err)
+			message(FATAL_ERROR "${flags} reported\n${err}instead of\n${plain_err}")
+		endif()
+	endforeach()
+
+	execute_process(COMMAND "${STRTOK}" --split-size 0 "${input}"
+		OUTPUT_QUIET
+		ERROR_VARIABLE err)
+
+	if (NOT err STREQUAL "${input}: ${plain_err}")
+		message(FATAL_ERROR "the named file reported\n${err}instead of\n${plain_err}")
+	endif()
+endforeach()
@@ -0,0 +1,55 @@
+# Reads a generated file with --read-ahead, from the file and through a pipe,
+# with buffers small enough that most tokens straddle two of them and with
+# few enough of them that the reader keeps waiting for the parser. It must
+# print what reading it plainly does, up to the same error.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_read_ahead.cmake
+
+set(input "${WORK_DIR}/read_ahead_input.json")
+set(text "")
+
+foreach(i RANGE 0 999)
+	math(EXPR pad "${i} % 71")
+	string(REPEAT "r" ${pad} r)
+	string(APPEND text "{\"n\": ${i}, \"s\": \"${r}\", \"a\": [${i}.75, true, [null]]}\n")
+endforeach()
+
+string(APPEND text "{\"bad\": [1 2]}\n{\"after\": 1}\n")
+file(WRITE "${input}" "${text}")
+
+execute_process(COMMAND "${STRTOK}"
+	INPUT_FILE "${input}"
+	RESULT_VARIABLE plain_result
+	OUTPUT_VARIABLE plain_out
+	ERROR_VARIABLE plain_err)
+
+if (NOT plain_out MATCHES "Object #999" OR NOT plain_err MATCHES "Unexpected token")
+	message(FATAL_ERROR "the input did not parse:\n${plain_err}")
+endif()
+
+foreach(size 7 256 65536)
+	foreach(count 1 3)
+		execute_process(COMMAND "${STRTOK}" --buffer-size ${size} --read-ahead ${count}
+			INPUT_FILE "${input}"
+			RESULT_VARIABLE result
+			OUTPUT_VARIABLE out
+			ERROR_VARIABLE err)
+
+		if (NOT out STREQUAL plain_out OR NOT err STREQUAL plain_err
+				OR NOT result STREQUAL plain_result)
+			message(FATAL_ERROR "--buffer-size ${size} --read-ahead ${count} differs from a file")
+		endif()
+
+		execute_process(COMMAND sh -c "cat \"$1\" | \"$2\" --buffer-size $3 --read-ahead $4"
+				sh "${input}" "${STRTOK}" ${size} ${count}
+			TIMEOUT 10
+			RESULT_VARIABLE result
+			OUTPUT_VARIABLE out
+			ERROR_VARIABLE err)
+
+		if (NOT out STREQUAL plain_out OR NOT err STREQUAL plain_err
+				OR NOT result STREQUAL plain_result)
+			message(FATAL_ERROR "--buffer-size ${size} --read-ahead ${count} differs through a pipe")
+		endif()
+	endforeach()
+endforeach()
@@ -0,0 +1,21 @@
+# Runs bench_sched on a few streams with windows small enough that every
+# stream is suspended and woken thousands of times. The streams tokenized by
+# the scheduler must count as many tokens as those run on their own threads.
+#
+#     cmake -DBENCH_SCHED=path/to/bench_sched -P test_sched.cmake
+
+foreach(window 1 7 4096)
+	execute_process(COMMAND "${BENCH_SCHED}" 50 ${window}
+		RESULT_VARIABLE result
+		OUTPUT_VARIABLE out)
+
+	string(REGEX MATCH "\ncoro_sched +[0-9.]+ s +([0-9]+) tokens" sched "${out}")
+	set(sched_tokens "${CMAKE_MATCH_1}")
+	string(REGEX MATCH "\nthread per stream +[0-9.]+ s +([0-9]+) tokens" threads "${out}")
+	set(thread_tokens "${CMAKE_MATCH_1}")
+
+	if (NOT result STREQUAL "0" OR sched_tokens STREQUAL ""
+			OR NOT sched_tokens STREQUAL thread_tokens)
+		message(FATAL_ERROR "bench_sched 50 ${window} printed (${result})\n${out}")
+	endif()
+endforeach()
@@ -0,0 +1,73 @@
+# Checks --select on a small input against fixed results, one path or several
+# at a time, and that selecting the root of generated values prints them
+# whole while selecting one field skips the rest, however it is split into
+# buffers and string chunks.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_select.cmake
+
+set(input "${WORK_DIR}/select_input.json")
+
+file(WRITE "${input}" "{\"u\":{\"id\":1,\"n\":\"x\"},\"e\":[{\"ts\":1,\"k\":2},{\"ts\":3},{\"k\":4}],"
+	"\"z\":[[1,2],[3,4]]}\n{\"e\":\"str\"}\n[{\"u\":1}]\n{\"u\":{\"id\":{\"deep\":[1]}}}\n")
+
+function(check_select expected)
+	set(args "")
+
+	foreach(path ${ARGN})
+		list(APPEND args --select "${path}")
+	endforeach()
+
+	execute_process(COMMAND "${STRTOK}" ${args}
+		INPUT_FILE "${input}"
+		RESULT_VARIABLE result
+		OUTPUT_VARIABLE out
+		ERROR_VARIABLE err)
+
+	if (NOT result STREQUAL "0" OR NOT out STREQUAL expected)
+		message(FATAL_ERROR "--select ${ARGN} printed\n${out}${err}instead of\n${expected}")
+	endif()
+endfunction()
+
+check_select("Object #0: {\"u\": {\"id\": 1}}\nObject #3: {\"u\": {\"id\": {\"deep\": [1]}}}\n"
+	.u.id)
+check_select("Object #0: {\"u\": {\"id\": 1}}\nObject #3: {\"u\": {\"id\": {\"deep\": [1]}}}\n"
+	.*.id)
+check_select("Object #0: {\"e\": [{\"ts\": 1}, {\"ts\": 3}]}\n" ".e[*].ts")
+check_select("Object #0: {\"e\": [{\"ts\": 3}]}\n" ".e[1]")
+check_select("Object #0: {\"z\": [[1], [3]]}\n" ".z[*][0]")
+check_select("Object #0: {\"e\": [{\"k\": 2}], \"u\": {\"n\": \"x\"}}\n" .u.n ".e[0].k")
+check_select("" .missing)
+
+set(text "")
+
+foreach(i RANGE 0 299)
+	math(EXPR pad "${i} % 131")
+	string(REPEAT "p" ${pad} p)
+	string(APPEND text "{\"skip\": {\"s\": \"${p}\\\"}\", \"a\": [[\"${p}\"], {}]}, \"keep\": [${i}, \"${p}\"]}\n")
+endforeach()
+
+file(WRITE "${input}" "${text}")
+
+execute_process(COMMAND "${STRTOK}"
+	INPUT_FILE "${input}"
+	OUTPUT_VARIABLE plain_out)
+
+foreach(flags "--buffer-size;64" "--buffer-size;64;--string-chunk;16" "--buffer-size;65536")
+	execute_process(COMMAND "${STRTOK}" ${flags} --select .
+		INPUT_FILE "${input}"
+		OUTPUT_VARIABLE out)
+
+	if (NOT out STREQUAL plain_out)
+		message(FATAL_ERROR "${flags} --select . differs from no --select")
+	endif()
+
+	execute_process(COMMAND "${STRTOK}" ${flags} --select .keep
+		INPUT_FILE "${input}"
+		OUTPUT_VARIABLE out)
+
+	if (NOT out MATCHES "^Object #0: {\"keep\": \\[0, \"\"\\]}\n"
+			OR NOT out MATCHES "\nObject #299: {\"keep\": \\[299, \"p+\"\\]}\n$"
+			OR out MATCHES "skip")
+		message(FATAL_ERROR "${flags} --select .keep printed\n${out}")
+	endif()
+endforeach()
@@ -0,0 +1,82 @@
+# Checks --shred on a small input against a fixed expectation, then shreds
+# generated records and the same records as printed by the regular DOM, which
+# must give the same columns. The records differ in shape and in the types at
+# the same path, keep their keys in the order the DOM prints them, shortest
+# first, and are written with escapes and spacing that the DOM does not
+# reproduce.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_shred.cmake
+
+set(input "${WORK_DIR}/shred_input.json")
+
+file(WRITE "${input}" "{\"a/b\": {\"~\": true}, \"id\": 1}\n"
+	"{\"id\": 2.5, \"t\": [1,2], \"u\": {\"n\": null}}\n\"x\"\n")
+
+execute_process(COMMAND "${STRTOK}" --shred 2
+	INPUT_FILE "${input}"
+	OUTPUT_VARIABLE out)
+
+set(expected [=[
+Row group #0: 2 rows
+"/a~1b/~0" bool: true, null
+"/id" int: 1, null
+"/id" float: null, 2.5
+"/t" json: null, [1, 2]
+Row group #1: 1 rows
+"/a~1b/~0" bool: null
+"/id" int: null
+"/id" float: null
+"/t" json: null
+"" string: "x"
+]=])
+
+if (NOT out STREQUAL expected)
+	message(FATAL_ERROR "--shred printed\n${out}instead of\n${expected}")
+endif()
+
+set(text "")
+
+foreach(i RANGE 0 499)
+	math(EXPR kind "${i} % 5")
+	math(EXPR pad "${i} % 23")
+	string(REPEAT "w" ${pad} w)
+
+	if (kind EQUAL 0)
+		string(APPEND text "{\"id\":${i},\"name\":\"\\u00e9${w}\\/\",\"tags\":[${i} ,\"${w}\"]}\n")
+	elseif (kind EQUAL 1)
+		string(APPEND text "{ \"id\" : ${i}.50 , \"user\" : { \"ok\" : false , \"age\" : -${pad} } }\n")
+	elseif (kind EQUAL 2)
+		string(APPEND text "{\"id\": \"${i}\", \"name\": null, \"user\": {\"ok\": true, \"x~y\": []}}\n")
+	elseif (kind EQUAL 3)
+		string(APPEND text "[${i}, {\"a\":[]}]\n")
+	else()
+		string(APPEND text "${i}\n")
+	endif()
+endforeach()
+
+file(WRITE "${input}" "${text}")
+
+execute_process(COMMAND "${STRTOK}"
+	INPUT_FILE "${input}"
+	OUTPUT_VARIABLE dom_out)
+string(REGEX REPLACE "(^|\n)Object #[0-9]+: " "\\1" dom_out "${dom_out}")
+file(WRITE "${WORK_DIR}/shred_reprinted.json" "${dom_out}")
+
+foreach(rows 1 7 1000)
+	execute_process(COMMAND "${STRTOK}" --shred ${rows}
+		INPUT_FILE "${input}"
+		RESULT_VARIABLE result
+		OUTPUT_VARIABLE out)
+
+	execute_process(COMMAND "${STRTOK}" --shred ${rows}
+		INPUT_FILE "${WORK_DIR}/shred_reprinted.json"
+		OUTPUT_VARIABLE reprinted_out)
+
+	if (NOT result STREQUAL "0" OR NOT out MATCHES "\"/user/x~0y\" json: ")
+		message(FATAL_ERROR "--shred ${rows} did not shred the input (${result})")
+	endif()
+
+	if (NOT out STREQUAL reprinted_out)
+		message(FATAL_ERROR "--shred ${rows} differs on the DOM's output")
+	endif()
+endforeach()
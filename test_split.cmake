@@ -0,0 +1,46 @@
+# Parses a generated file whole and cut into small pieces by json_split(),
+# which must print the same. Its strings are full of backslash runs, escaped
+# quotes and brackets, so that some of each straddle the splitter's 64-byte
+# blocks, and it ends in a syntax error that stops the output in the same
+# place either way.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_split.cmake
+
+set(input "${WORK_DIR}/split_input.json")
+set(text "")
+
+foreach(i RANGE 0 399)
+	math(EXPR pad "${i} % 67")
+	math(EXPR run "${i} % 9")
+	string(REPEAT "a" ${pad} a)
+	# Every "\\\\" is one escaped backslash in the file.
+	string(REPEAT "\\\\" ${run} bs)
+	string(APPEND text
+		"{\"s\": \"${a}${bs}\\\"}\\n{${bs}\\\"\", \"t\": [\"${bs}\", \"]${a}\\\\\"], \"n\": ${i}}\n")
+endforeach()
+
+string(APPEND text "{\"bad\": }\n{\"after\": 1}\n")
+file(WRITE "${input}" "${text}")
+
+execute_process(COMMAND "${STRTOK}" --split-size 0 "${input}"
+	RESULT_VARIABLE whole_result
+	OUTPUT_VARIABLE whole_out
+	ERROR_VARIABLE whole_err)
+
+if (NOT whole_out MATCHES "Object #399")
+	message(FATAL_ERROR "the input did not parse:\n${whole_err}")
+endif()
+
+foreach(size 64 100 1000)
+	foreach(jobs 1 4)
+		execute_process(COMMAND "${STRTOK}" --jobs ${jobs} --split-size ${size} "${input}"
+			RESULT_VARIABLE result
+			OUTPUT_VARIABLE out
+			ERROR_VARIABLE err)
+
+		if (NOT out STREQUAL whole_out OR NOT err STREQUAL whole_err
+				OR NOT result STREQUAL whole_result)
+			message(FATAL_ERROR "--split-size ${size} --jobs ${jobs} differs from --split-size 0")
+		endif()
+	endforeach()
+endforeach()
@@ -0,0 +1,51 @@
+# Prints the elements of a generated top-level array with --stream, which
+# must give each element as parsing it on its own does, and checks that
+# values other than arrays are printed whole and that an error in the middle
+# of the array stops it after the elements before it.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_stream.cmake
+
+set(input "${WORK_DIR}/stream_input.json")
+set(elements "")
+
+foreach(i RANGE 0 499)
+	math(EXPR pad "${i} % 29")
+	string(REPEAT "e" ${pad} e)
+	list(APPEND elements "{\"i\": ${i}, \"e\": [\"${e}\", [${i}]]}" "\"${e}\"" "[]")
+endforeach()
+
+string(JOIN "\n" text ${elements})
+file(WRITE "${input}" "${text}\n")
+
+execute_process(COMMAND "${STRTOK}"
+	INPUT_FILE "${input}"
+	OUTPUT_VARIABLE one_by_one)
+
+string(JOIN ",\n" text ${elements})
+
+foreach(size 16 65536)
+	file(WRITE "${input}" "[${text}]\n{\"after\": [1]}\n")
+
+	execute_process(COMMAND "${STRTOK}" --stream --buffer-size ${size}
+		INPUT_FILE "${input}"
+		RESULT_VARIABLE result
+		OUTPUT_VARIABLE out)
+
+	string(REGEX REPLACE "\nObject #0\\[([0-9]+)\\]: " "\nObject #\\1: " out "\n${out}")
+
+	if (NOT result STREQUAL "0"
+			OR NOT out STREQUAL "\n${one_by_one}Object #1: {\"after\": [1]}\n")
+		message(FATAL_ERROR "--stream --buffer-size ${size} printed other elements")
+	endif()
+
+	file(WRITE "${input}" "[${text}, {\"bad\" 1}, 2]\n")
+
+	execute_process(COMMAND "${STRTOK}" --stream --buffer-size ${size}
+		INPUT_FILE "${input}"
+		OUTPUT_VARIABLE out
+		ERROR_VARIABLE err)
+
+	if (NOT out MATCHES "\nObject #0\\[1499\\]: \\[\\]\n$" OR NOT err MATCHES "Unexpected token")
+		message(FATAL_ERROR "--stream --buffer-size ${size} did not stop at the error:\n${err}")
+	endif()
+endforeach()
@@ -0,0 +1,46 @@
+# Parses generated values with long strings handed over in chunks, which
+# must print what parsing them whole does. The strings are full of escapes,
+# including surrogate pairs, so that chunk and buffer boundaries fall inside
+# them, and some of them are object keys.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_string_chunk.cmake
+
+set(input "${WORK_DIR}/string_chunk_input.json")
+set(text "")
+set(escapes [=[\u00e9\\\"\ud83d\ude00\n]=])
+
+foreach(i RANGE 0 199)
+	math(EXPR pad "${i} % 89")
+	math(EXPR run "${i} % 7")
+	string(REPEAT "c" ${pad} c)
+	string(REPEAT "${escapes}" ${run} esc)
+	string(APPEND text "{\"${c}${esc}k\": \"${esc}${c}\", \"a\": [\"${c}\", \"${esc}\"]}\n")
+endforeach()
+
+string(APPEND text "[\"${c}\", ]\n")
+file(WRITE "${input}" "${text}")
+
+execute_process(COMMAND "${STRTOK}"
+	INPUT_FILE "${input}"
+	RESULT_VARIABLE plain_result
+	OUTPUT_VARIABLE plain_out
+	ERROR_VARIABLE plain_err)
+
+if (NOT plain_out MATCHES "Object #199" OR NOT plain_err MATCHES "Unexpected token")
+	message(FATAL_ERROR "the input did not parse:\n${plain_err}")
+endif()
+
+foreach(size 3 4096)
+	foreach(chunk 1 5 64)
+		execute_process(COMMAND "${STRTOK}" --buffer-size ${size} --string-chunk ${chunk}
+			INPUT_FILE "${input}"
+			RESULT_VARIABLE result
+			OUTPUT_VARIABLE out
+			ERROR_VARIABLE err)
+
+		if (NOT out STREQUAL plain_out OR NOT err STREQUAL plain_err
+				OR NOT result STREQUAL plain_result)
+			message(FATAL_ERROR "--buffer-size ${size} --string-chunk ${chunk} differs:\n${err}")
+		endif()
+	endforeach()
+endforeach()
@@ -0,0 +1,69 @@
+# Checks --tokens on a small input against a fixed list, then lists the
+# tokens of a generated file read in buffers of different sizes, which must
+# give the same kinds, offsets and lengths whichever buffer a token started
+# or ended in.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_tokens.cmake
+
+set(input "${WORK_DIR}/tokens_input.json")
+
+file(WRITE "${input}" "{\"a\\\"b\": [1, -2.5, true, null]}\n\"x\" [1, @]")
+
+execute_process(COMMAND "${STRTOK}" --tokens
+	INPUT_FILE "${input}"
+	RESULT_VARIABLE result
+	OUTPUT_VARIABLE out)
+
+set(expected [=[
+left_curly_brace 0 1
+string 1 6 escaped
+colon 7 1
+left_square_brace 9 1
+int 10 1
+comma 11 1
+float 13 4
+comma 17 1
+naked_word 19 4
+comma 23 1
+naked_word 25 4
+right_square_brace 29 1
+right_curly_brace 30 1
+string 32 3
+left_square_brace 36 1
+int 37 1
+comma 38 1
+error 40 1
+]=])
+
+if (NOT result STREQUAL "1" OR NOT out STREQUAL expected)
+	message(FATAL_ERROR "--tokens printed (${result})\n${out}instead of\n${expected}")
+endif()
+
+set(text "")
+
+foreach(i RANGE 0 299)
+	math(EXPR pad "${i} % 37")
+	string(REPEAT "t" ${pad} t)
+	string(APPEND text "{\"${t}\": [${i}, -${i}.125, \"${t}\\\\\\\"\", false, {}], \"n\":null}\n")
+endforeach()
+
+file(WRITE "${input}" "${text}")
+
+execute_process(COMMAND "${STRTOK}" --tokens
+	INPUT_FILE "${input}"
+	OUTPUT_VARIABLE whole_out)
+
+if (NOT whole_out MATCHES "\nright_curly_brace [0-9]+ 1\n$")
+	message(FATAL_ERROR "--tokens did not list the generated file")
+endif()
+
+foreach(size 1 7 100)
+	execute_process(COMMAND "${STRTOK}" --tokens --buffer-size ${size}
+		INPUT_FILE "${input}"
+		RESULT_VARIABLE result
+		OUTPUT_VARIABLE out)
+
+	if (NOT result STREQUAL "0" OR NOT out STREQUAL whole_out)
+		message(FATAL_ERROR "--tokens --buffer-size ${size} differs")
+	endif()
+endforeach()
@@ -0,0 +1,53 @@
+# Reads a generated file with --uring, from the file and through a pipe, in
+# buffers from a few bytes to the default size. It must print what reading
+# it plainly does, up to the same error. Where io_uring is not available the
+# same runs check the fallback.
+#
+#     cmake -DSTRTOK=path/to/strtok -DWORK_DIR=dir -P test_uring.cmake
+
+set(input "${WORK_DIR}/uring_input.json")
+set(text "")
+
+foreach(i RANGE 0 999)
+	math(EXPR pad "${i} % 67")
+	string(REPEAT "u" ${pad} u)
+	string(APPEND text "[${i}, {\"s\": \"${u}\", \"b\": [false, ${i}.5]}]\n")
+endforeach()
+
+string(APPEND text "[1, {\"s\" \"colon\"}]\n[2]\n")
+file(WRITE "${input}" "${text}")
+
+execute_process(COMMAND "${STRTOK}"
+	INPUT_FILE "${input}"
+	RESULT_VARIABLE plain_result
+	OUTPUT_VARIABLE plain_out
+	ERROR_VARIABLE plain_err)
+
+if (NOT plain_out MATCHES "Object #999" OR NOT plain_err MATCHES "Unexpected token")
+	message(FATAL_ERROR "the input did not parse:\n${plain_err}")
+endif()
+
+foreach(size 5 512 65536)
+	execute_process(COMMAND "${STRTOK}" --buffer-size ${size} --uring
+		INPUT_FILE "${input}"
+		RESULT_VARIABLE result
+		OUTPUT_VARIABLE out
+		ERROR_VARIABLE err)
+
+	if (NOT out STREQUAL plain_out OR NOT err STREQUAL plain_err
+			OR NOT result STREQUAL plain_result)
+		message(FATAL_ERROR "--buffer-size ${size} --uring differs from a file:\n${err}")
+	endif()
+
+	execute_process(COMMAND sh -c "cat \"$1\" | \"$2\" --buffer-size $3 --uring"
+			sh "${input}" "${STRTOK}" ${size}
+		TIMEOUT 10
+		RESULT_VARIABLE result
+		OUTPUT_VARIABLE out
+		ERROR_VARIABLE err)
+
+	if (NOT out STREQUAL plain_out OR NOT err STREQUAL plain_err
+			OR NOT result STREQUAL plain_result)
+		message(FATAL_ERROR "--buffer-size ${size} --uring differs through a pipe:\n${err}")
+	endif()
+endforeach()
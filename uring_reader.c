@@ -0,0 +1,536 @@
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "uring_reader.h"
+
+#define UR_SLOT_BITS 3
+/* The slot number in user_data of a reader's poll on its wake_fd. */
+#define UR_WAKE ((1 << UR_SLOT_BITS) - 1)
+
+static int ur_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ur_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int ur_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void ur_unmap(struct uring_loop *l)
+{
+	if (l->sq_ring && l->sq_ring != MAP_FAILED)
+		munmap(l->sq_ring, l->sq_ring_size);
+
+	if (l->cq_ring && l->cq_ring != MAP_FAILED)
+		munmap(l->cq_ring, l->cq_ring_size);
+
+	if (l->sqes && (void *)l->sqes != MAP_FAILED)
+		munmap(l->sqes, l->sqes_size);
+
+	l->sq_ring = l->cq_ring = NULL;
+	l->sqes = NULL;
+}
+
+/* Leaves ring_fd at -1 if the kernel will not give us a ring. */
+static void ur_ring_init(struct uring_loop *l)
+{
+	struct io_uring_params p;
+	struct iovec *iov;
+	size_t i;
+	char *sq;
+	char *cq;
+
+	memset(&p, 0, sizeof(p));
+
+	if ((l->ring_fd = ur_setup((unsigned)l->nbufs, &p)) < 0) {
+		l->ring_fd = -1;
+		return;
+	}
+
+	l->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	l->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	l->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	l->sq_ring = mmap(NULL, l->sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, l->ring_fd, IORING_OFF_SQ_RING);
+	l->cq_ring = mmap(NULL, l->cq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, l->ring_fd, IORING_OFF_CQ_RING);
+	l->sqes = mmap(NULL, l->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, l->ring_fd, IORING_OFF_SQES);
+
+	if (l->sq_ring == MAP_FAILED || l->cq_ring == MAP_FAILED || (void *)l->sqes == MAP_FAILED) {
+		ur_unmap(l);
+		close(l->ring_fd);
+		l->ring_fd = -1;
+		return;
+	}
+
+	sq = l->sq_ring;
+	cq = l->cq_ring;
+	l->sq_head = (unsigned *)(sq + p.sq_off.head);
+	l->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	l->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	l->sq_array = (unsigned *)(sq + p.sq_off.array);
+	l->sq_entries = p.sq_entries;
+	l->cq_head = (unsigned *)(cq + p.cq_off.head);
+	l->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	l->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	l->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	/* Registered buffers save the kernel mapping them on every read, but
+	 * may be refused under a low RLIMIT_MEMLOCK. Plain reads work then. */
+	if (!(iov = calloc(l->nbufs, sizeof(*iov))))
+		return;
+
+	for (i = 0; i < l->nbufs; i++) {
+		iov[i].iov_base = l->arena + i * l->bufsize;
+		iov[i].iov_len = l->bufsize;
+	}
+
+	l->fixed_buffers = ur_register(l->ring_fd, IORING_REGISTER_BUFFERS, iov,
+			(unsigned)l->nbufs) == 0;
+	free(iov);
+}
+
+int uring_loop_init(struct uring_loop *l, size_t nbufs, size_t bufsize)
+{
+	void *arena;
+	size_t i;
+
+	memset(l, 0, sizeof(*l));
+	l->ring_fd = -1;
+	l->nbufs = nbufs;
+	l->bufsize = bufsize;
+
+	if (posix_memalign(&arena, 4096, nbufs * bufsize))
+		return 1;
+
+	l->arena = arena;
+
+	if (!(l->free_bufs = malloc(nbufs * sizeof(*l->free_bufs)))) {
+		free(l->arena);
+		return 1;
+	}
+
+	for (i = 0; i < nbufs; i++)
+		l->free_bufs[l->nfree++] = nbufs - 1 - i;
+
+	coro_sched_init(&l->sched, 0);
+	ur_ring_init(l);
+
+	return 0;
+}
+
+void uring_loop_destroy(struct uring_loop *l)
+{
+	if (l->ring_fd >= 0) {
+		ur_unmap(l);
+		close(l->ring_fd);
+	}
+
+	free(l->free_bufs);
+	free(l->arena);
+	memset(l, 0, sizeof(*l));
+	l->ring_fd = -1;
+}
+
+/* Hands the queued reads to the kernel and, if wait is set, blocks until
+ * at least one completes. Completions are filed with their readers. */
+static void ur_queue(struct uring_reader *r, size_t i);
+
+static void ur_reap(struct uring_loop *l, int wait)
+{
+	struct io_uring_cqe *cqe;
+	struct uring_reader *r;
+	struct uring_slot_t *slot;
+	unsigned head;
+	size_t i;
+	int ret;
+	int res;
+
+	if (l->to_submit || wait) {
+		do {
+			ret = ur_enter(l->ring_fd, l->to_submit, wait ? 1 : 0,
+					wait ? IORING_ENTER_GETEVENTS : 0);
+		} while (ret < 0 && errno == EINTR);
+
+		if (ret > 0)
+			l->to_submit -= (unsigned)ret < l->to_submit ? (unsigned)ret : l->to_submit;
+	}
+
+	head = *l->cq_head;
+
+	while (head != __atomic_load_n(l->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &l->cqes[head & *l->cq_mask];
+		r = (struct uring_reader *)(uintptr_t)(cqe->user_data & ~(uint64_t)((1 << UR_SLOT_BITS) - 1));
+		i = (size_t)(cqe->user_data & ((1 << UR_SLOT_BITS) - 1));
+		res = cqe->res;
+
+		/* Let go of the entry first: queueing the rest of a short read
+		 * may have to reap again. */
+		__atomic_store_n(l->cq_head, ++head, __ATOMIC_RELEASE);
+
+		/* Cancellations carry no reader. */
+		if (!r)
+			continue;
+
+		l->in_flight--;
+
+		if (i == UR_WAKE) {
+			r->wake_pending = 0;
+			r->interrupted = 1;
+
+			if (r->t)
+				coro_sched_wake(&l->sched, &r->task);
+
+			continue;
+		}
+
+		slot = &r->slots[i];
+
+		/* A file read may come back short before its end; the rest of
+		 * the buffer is read from where it stopped. */
+		if (res > 0 && r->seekable && slot->filled + (size_t)res < l->bufsize) {
+			slot->filled += (size_t)res;
+			ur_queue(r, i);
+			head = *l->cq_head;
+			continue;
+		}
+
+		slot->result = res < 0 ? res : (ssize_t)slot->filled + res;
+		slot->state = URING_SLOT_DONE;
+
+		if (r->t)
+			coro_sched_wake(&l->sched, &r->task);
+	}
+}
+
+/* Returns the next submission queue entry, cleared, to be filled in and
+ * handed to the kernel with ur_push(). */
+static struct io_uring_sqe *ur_sqe(struct uring_loop *l)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail = *l->sq_tail;
+
+	while (tail - __atomic_load_n(l->sq_head, __ATOMIC_ACQUIRE) == l->sq_entries)
+		ur_reap(l, 0);
+
+	sqe = &l->sqes[tail & *l->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+static void ur_push(struct uring_loop *l)
+{
+	unsigned tail = *l->sq_tail;
+
+	l->sq_array[tail & *l->sq_mask] = tail & *l->sq_mask;
+	__atomic_store_n(l->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	l->to_submit++;
+}
+
+/* Asks the kernel to give up on the request with this user_data. */
+static void ur_cancel(struct uring_loop *l, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = ur_sqe(l);
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = user_data;
+	ur_push(l);
+}
+
+/* Queues a read of whatever part of slot i's buffer is not filled yet. */
+static void ur_queue(struct uring_reader *r, size_t i)
+{
+	struct uring_loop *l = r->loop;
+	struct uring_slot_t *slot = &r->slots[i];
+	struct io_uring_sqe *sqe = ur_sqe(l);
+	char *buf = l->arena + slot->buf * l->bufsize + slot->filled;
+
+	sqe->opcode = l->fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = r->fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = (unsigned)(l->bufsize - slot->filled);
+	sqe->off = r->seekable ? (uint64_t)(slot->offset + (off_t)slot->filled) : (uint64_t)-1;
+	sqe->buf_index = (uint16_t)slot->buf;
+	sqe->user_data = (uint64_t)(uintptr_t)r | i;
+	ur_push(l);
+	l->in_flight++;
+}
+
+/* Without a ring, waits for a pipe to have something to read. Returns
+ * nonzero if uring_reader_interrupt() was called instead. */
+static int ur_wait(struct uring_reader *r)
+{
+	struct pollfd fds[2] = {
+		{ .fd = r->fd, .events = POLLIN },
+		{ .fd = r->wake_fd, .events = POLLIN },
+	};
+	int n;
+
+	do {
+		n = poll(fds, 2, -1);
+	} while (n < 0 && errno == EINTR);
+
+	return n > 0 && fds[1].revents;
+}
+
+static void ur_submit(struct uring_reader *r, size_t i)
+{
+	struct uring_loop *l = r->loop;
+	struct uring_slot_t *slot = &r->slots[i];
+	char *buf = l->arena + slot->buf * l->bufsize;
+	ssize_t res;
+
+	slot->seq = r->next_seq++;
+	slot->state = URING_SLOT_READING;
+	slot->offset = r->offset;
+	slot->filled = 0;
+	r->offset += (off_t)l->bufsize;
+
+	if (l->ring_fd >= 0) {
+		ur_queue(r, i);
+		return;
+	}
+
+	if (r->wake_fd >= 0 && !r->seekable && ur_wait(r)) {
+		r->interrupted = 1;
+		slot->result = 0;
+		slot->state = URING_SLOT_DONE;
+		return;
+	}
+
+	do {
+		res = r->seekable
+			? pread(r->fd, buf + slot->filled, l->bufsize - slot->filled,
+					slot->offset + (off_t)slot->filled)
+			: read(r->fd, buf, l->bufsize);
+
+		if (res > 0)
+			slot->filled += (size_t)res;
+	} while ((res < 0 && errno == EINTR)
+			|| (res > 0 && r->seekable && slot->filled < l->bufsize));
+
+	slot->result = res < 0 ? -errno : (ssize_t)slot->filled;
+	slot->state = URING_SLOT_DONE;
+}
+
+int uring_reader_open(struct uring_loop *l, struct uring_reader *r, int fd)
+{
+	struct stat st;
+	size_t i;
+
+	memset(r, 0, sizeof(*r));
+	r->loop = l;
+	r->fd = fd;
+	r->wake_fd = -1;
+	r->held = -1;
+	r->seekable = !fstat(fd, &st) && S_ISREG(st.st_mode);
+	r->offset = r->seekable ? lseek(fd, 0, SEEK_CUR) : 0;
+
+	if (r->offset < 0)
+		r->offset = 0;
+
+	/* Reads from a pipe complete in whatever order the kernel likes. */
+	r->nslots = r->seekable ? URING_READER_DEPTH : 1;
+
+	if (l->nfree < r->nslots)
+		return 1;
+
+	for (i = 0; i < r->nslots; i++) {
+		r->slots[i].buf = l->free_bufs[--l->nfree];
+		ur_submit(r, i);
+	}
+
+	return 0;
+}
+
+void uring_reader_close(struct uring_reader *r)
+{
+	struct uring_loop *l = r->loop;
+	size_t i;
+
+	/* A read from a pipe may never complete. */
+	for (i = 0; l->ring_fd >= 0 && !r->seekable && i < r->nslots; i++)
+		if (r->slots[i].state == URING_SLOT_READING)
+			ur_cancel(l, (uint64_t)(uintptr_t)r | i);
+
+	if (r->wake_pending)
+		ur_cancel(l, (uint64_t)(uintptr_t)r | UR_WAKE);
+
+	for (i = 0; i < r->nslots; i++) {
+		while (r->slots[i].state == URING_SLOT_READING)
+			ur_reap(l, 1);
+
+		l->free_bufs[l->nfree++] = r->slots[i].buf;
+	}
+
+	while (r->wake_pending)
+		ur_reap(l, 1);
+
+	if (r->t)
+		coro_sched_cancel(&l->sched, &r->task);
+
+	if (r->fd >= 0)
+		close(r->fd);
+
+	if (r->wake_fd >= 0)
+		close(r->wake_fd);
+
+	r->wake_fd = -1;
+
+	r->fd = -1;
+	r->nslots = 0;
+}
+
+static int ur_next(struct uring_reader *r, const char **begin, const char **end, int wait)
+{
+	struct uring_loop *l = r->loop;
+	struct uring_slot_t *slot;
+	size_t i;
+
+	if (r->eof || r->interrupted)
+		return EOF;
+
+	/* The buffer handed out last time has been read. */
+	if (r->held >= 0) {
+		ur_submit(r, (size_t)r->held);
+		r->held = -1;
+	}
+
+	for (i = 0; r->slots[i].seq != r->deliver_seq; i++)
+		;
+
+	slot = &r->slots[i];
+
+	while (slot->state != URING_SLOT_DONE) {
+		if (r->interrupted)
+			return EOF;
+
+		if (!wait) {
+			/* Make sure the reads queued so far are on their way. */
+			if (l->to_submit)
+				ur_reap(l, 0);
+
+			if (slot->state != URING_SLOT_DONE)
+				return JSON_FILL_AGAIN;
+		} else {
+			ur_reap(l, 1);
+		}
+	}
+
+	if (slot->result <= 0) {
+		r->error = slot->result < 0 ? (int)-slot->result : 0;
+		r->eof = 1;
+		return EOF;
+	}
+
+	/* Reads past the end of a file are all empty, and one that ends short
+	 * even after the rest was asked for has reached the end. */
+	if (r->seekable && (size_t)slot->result < l->bufsize)
+		r->eof = 1;
+
+	r->deliver_seq++;
+	*begin = l->arena + slot->buf * l->bufsize;
+	*end = *begin + slot->result;
+
+	if (!r->eof)
+		r->held = (int)i;
+
+	return 0;
+}
+
+int uring_reader_allow_interrupt(struct uring_reader *r)
+{
+	struct uring_loop *l = r->loop;
+	struct io_uring_sqe *sqe;
+
+	if ((r->wake_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+		return 1;
+
+	if (l->ring_fd < 0)
+		return 0;
+
+	sqe = ur_sqe(l);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = r->wake_fd;
+	sqe->poll_events = POLLIN;
+	sqe->user_data = (uint64_t)(uintptr_t)r | UR_WAKE;
+	ur_push(l);
+	l->in_flight++;
+	r->wake_pending = 1;
+
+	return 0;
+}
+
+void uring_reader_interrupt(struct uring_reader *r)
+{
+	uint64_t one = 1;
+
+	/* Only fails once the counter is full, which wakes the reader too. */
+	if (write(r->wake_fd, &one, sizeof(one)) < 0)
+		return;
+}
+
+int uring_reader_fill(struct uring_reader *r, const char **begin, const char **end)
+{
+	return ur_next(r, begin, end, 1);
+}
+
+int uring_reader_poll(struct uring_reader *r, const char **begin, const char **end)
+{
+	return ur_next(r, begin, end, 0);
+}
+
+/* Resumes the reader's tokenizer for one token. */
+static enum coro_task_state_e ur_step(struct coro_task_t *task)
+{
+	struct uring_reader *r = task->data;
+	enum json_token_kind_e kind;
+
+	if ((kind = json_tokenizer_next(r->t)) == JSON_TOK_AGAIN)
+		return CORO_TASK_WAITING;
+
+	r->on_token(r->ctx, r->t);
+
+	if (kind == JSON_TOK_NONE || kind == JSON_TOK_ERROR)
+		return CORO_TASK_DONE;
+
+	return CORO_TASK_RUNNABLE;
+}
+
+void uring_reader_watch(struct uring_reader *r, struct json_tokenizer_t *t,
+		void (*on_token)(void *ctx, struct json_tokenizer_t *t), void *ctx,
+		unsigned priority)
+{
+	r->t = t;
+	r->on_token = on_token;
+	r->ctx = ctx;
+	coro_sched_add(&r->loop->sched, &r->task, ur_step, r, priority);
+}
+
+void uring_loop_run(struct uring_loop *l)
+{
+	/* Without a ring every read is done by the time it is queued, so no
+	 * reader is ever left waiting. */
+	while (coro_sched_run(&l->sched) && l->ring_fd >= 0)
+		ur_reap(l, 1);
+}
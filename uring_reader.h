@@ -0,0 +1,149 @@
+#ifndef GRAMAS_URING_READER_H
+#define GRAMAS_URING_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "coro_sched.h"
+#include "json.h"
+
+/* Reads many descriptors at once through one io_uring. A loop owns the ring
+ * and a pool of registered buffers; every reader opened on it keeps up to
+ * URING_READER_DEPTH reads in flight (one for pipes, which cannot be read
+ * out of order).
+ *
+ * A reader can be read from like any other source with uring_reader_fill(),
+ * which blocks until its next buffer arrives, or be watched: its tokenizer,
+ * set up with json_tokenizer_init_nonblocking() over uring_reader_poll(), is
+ * resumed from the loop's scheduler every time one of its reads completes,
+ * so a single thread keeps any number of streams going:
+ *
+ *      uring_reader_open(&loop, &r, fd);
+ *      json_tokenizer_init_nonblocking(&t, &r,
+ *              (int (*)(void *, const char **, const char **))uring_reader_poll);
+ *      uring_reader_watch(&r, &t, on_token, ctx, 0);
+ *      ...
+ *      uring_loop_run(&loop);
+ *
+ * If io_uring is not available the loop falls back to plain read(2) calls
+ * made when a read would have been queued, behind the same interface. */
+
+#define URING_READER_DEPTH 4
+
+struct uring_reader;
+
+struct uring_loop {
+	int ring_fd;
+	int fixed_buffers;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+	unsigned to_submit;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	char *arena;
+	size_t bufsize;
+	size_t nbufs;
+	size_t *free_bufs;
+	size_t nfree;
+
+	size_t in_flight;
+	struct coro_sched_t sched;
+};
+
+enum uring_slot_state_e {
+	URING_SLOT_IDLE,
+	URING_SLOT_READING,
+	URING_SLOT_DONE
+};
+
+struct uring_slot_t {
+	size_t buf;
+	size_t seq;
+	/* Where a file read starts and how much of it has come in so far. */
+	off_t offset;
+	size_t filled;
+	ssize_t result;
+	enum uring_slot_state_e state;
+};
+
+struct uring_reader {
+	struct uring_loop *loop;
+	int fd;
+	int seekable;
+	off_t offset;
+
+	struct uring_slot_t slots[URING_READER_DEPTH];
+	size_t nslots;
+	size_t next_seq;
+	size_t deliver_seq;
+	int held;
+	int eof;
+	/* The errno of a read that failed, or 0. */
+	int error;
+
+	/* Set up by uring_reader_allow_interrupt(); wake_fd is -1 otherwise. */
+	int wake_fd;
+	int wake_pending;
+	int interrupted;
+
+	/* Watched readers. */
+	struct json_tokenizer_t *t;
+	void (*on_token)(void *ctx, struct json_tokenizer_t *t);
+	void *ctx;
+	struct coro_task_t task;
+};
+
+/* Sets up a ring with nbufs buffers of bufsize bytes shared by all readers.
+ * Returns nonzero if memory ran out; a missing io_uring is not an error. */
+int uring_loop_init(struct uring_loop *l, size_t nbufs, size_t bufsize);
+void uring_loop_destroy(struct uring_loop *l);
+
+/* Resumes watched readers as their reads complete until every one of them
+ * has reached the end of its input or an error. */
+void uring_loop_run(struct uring_loop *l);
+
+/* Starts reading fd. Returns nonzero if the loop has no buffers to spare. */
+int uring_reader_open(struct uring_loop *l, struct uring_reader *r, int fd);
+
+/* Cancels reads from a pipe still in flight and waits for the rest, gives the
+ * buffers back and closes the descriptor. */
+void uring_reader_close(struct uring_reader *r);
+
+/* Buffered sources for the tokenizer: uring_reader_fill() waits for the next
+ * buffer, uring_reader_poll() returns JSON_FILL_AGAIN instead. */
+int uring_reader_fill(struct uring_reader *r, const char **begin, const char **end);
+int uring_reader_poll(struct uring_reader *r, const char **begin, const char **end);
+
+/* Lets uring_reader_interrupt() wake a fill waiting for input: the ring also
+ * polls an eventfd for the reader. Returns nonzero if the eventfd could not
+ * be made. */
+int uring_reader_allow_interrupt(struct uring_reader *r);
+
+/* Makes the fill waiting for input, and every one after it, return EOF. May
+ * be called from any thread, until the reader is closed. */
+void uring_reader_interrupt(struct uring_reader *r);
+
+/* Hands the reader's tokens to on_token from uring_loop_run(). t must read
+ * from the reader through uring_reader_poll(). priority is the reader's
+ * scheduling priority, 0 being the highest. */
+void uring_reader_watch(struct uring_reader *r, struct json_tokenizer_t *t,
+		void (*on_token)(void *ctx, struct json_tokenizer_t *t), void *ctx,
+		unsigned priority);
+
+#endif /* GRAMAS_URING_READER_H */
@@ -0,0 +1,231 @@
+#include "work_pool.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WORK_DEQUE_INITIAL 16
+
+struct wp_self {
+	struct work_pool_t *pool;
+	size_t index;
+};
+
+/* The pool and deque of the worker running on this thread, if any. */
+static _Thread_local struct wp_self wp_self;
+
+static int wp_push(struct work_deque_t *d, const struct work_item_t *item)
+{
+	struct work_item_t *items;
+	size_t capacity;
+	size_t i;
+
+	pthread_mutex_lock(&d->lock);
+
+	if (d->tail - d->head == d->capacity) {
+		capacity = d->capacity ? d->capacity * 2 : WORK_DEQUE_INITIAL;
+
+		if (!(items = malloc(capacity * sizeof(*items)))) {
+			pthread_mutex_unlock(&d->lock);
+			return 1;
+		}
+
+		for (i = d->head; i != d->tail; i++)
+			items[i - d->head] = d->items[i % d->capacity];
+
+		free(d->items);
+		d->items = items;
+		d->tail -= d->head;
+		d->head = 0;
+		d->capacity = capacity;
+	}
+
+	d->items[d->tail++ % d->capacity] = *item;
+	pthread_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+/* The owner takes from the tail, thieves from the head. */
+static int wp_take(struct work_deque_t *d, struct work_item_t *item, int steal)
+{
+	int found;
+
+	pthread_mutex_lock(&d->lock);
+
+	if ((found = d->head != d->tail)) {
+		if (steal)
+			*item = d->items[d->head++ % d->capacity];
+		else
+			*item = d->items[--d->tail % d->capacity];
+	}
+
+	pthread_mutex_unlock(&d->lock);
+
+	return found;
+}
+
+static int wp_find(struct work_pool_t *p, size_t self, struct work_item_t *item)
+{
+	size_t i;
+
+	if (wp_take(&p->deques[self], item, 0))
+		return 1;
+
+	for (i = 1; i < p->workers; i++)
+		if (wp_take(&p->deques[(self + i) % p->workers], item, 1))
+			return 1;
+
+	return 0;
+}
+
+static void *wp_worker(void *arg)
+{
+	struct work_pool_t *p = ((struct wp_self *)arg)->pool;
+	size_t self = ((struct wp_self *)arg)->index;
+	struct work_item_t item;
+
+	free(arg);
+	wp_self.pool = p;
+	wp_self.index = self;
+
+	for (;;) {
+		pthread_mutex_lock(&p->lock);
+
+		while (!p->queued && !p->stop)
+			pthread_cond_wait(&p->work, &p->lock);
+
+		if (!p->queued) {
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+
+		p->queued--;
+		pthread_mutex_unlock(&p->lock);
+
+		/* The count says some deque holds a job for us, but a scan can
+		 * still miss it: another worker may take the one ahead of us
+		 * while the one left behind lands in a deque already looked at.
+		 * Let that worker run before looking again. */
+		while (!wp_find(p, self, &item))
+			sched_yield();
+
+		item.run(item.arg);
+
+		pthread_mutex_lock(&p->lock);
+
+		if (!--p->pending)
+			pthread_cond_broadcast(&p->idle);
+
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	if (p->worker_exit)
+		p->worker_exit();
+
+	return NULL;
+}
+
+int work_pool_init(struct work_pool_t *p, size_t workers, void (*worker_exit)(void))
+{
+	struct wp_self *arg;
+	long n;
+	size_t i;
+
+	memset(p, 0, sizeof(*p));
+
+	if (!workers)
+		workers = (n = sysconf(_SC_NPROCESSORS_ONLN)) > 0 ? (size_t)n : 1;
+
+	p->worker_exit = worker_exit;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->idle, NULL);
+
+	p->deques = calloc(workers, sizeof(*p->deques));
+	p->threads = calloc(workers, sizeof(*p->threads));
+
+	if (!p->deques || !p->threads)
+		return 1;
+
+	for (i = 0; i < workers; i++)
+		pthread_mutex_init(&p->deques[i].lock, NULL);
+
+	p->workers = workers;
+
+	for (; p->started < workers; p->started++) {
+		if (!(arg = malloc(sizeof(*arg))))
+			break;
+
+		arg->pool = p;
+		arg->index = p->started;
+
+		if (pthread_create(&p->threads[p->started], NULL, wp_worker, arg)) {
+			free(arg);
+			break;
+		}
+	}
+
+	/* Workers that did not start have their deques emptied by the others. */
+	return p->started == 0;
+}
+
+int work_pool_submit(struct work_pool_t *p, void (*run)(void *), void *arg)
+{
+	struct work_item_t item = { run, arg };
+	size_t target;
+
+	pthread_mutex_lock(&p->lock);
+	target = wp_self.pool == p ? wp_self.index : p->next++ % p->started;
+	p->pending++;
+	pthread_mutex_unlock(&p->lock);
+
+	if (wp_push(&p->deques[target], &item)) {
+		pthread_mutex_lock(&p->lock);
+		p->pending--;
+		pthread_mutex_unlock(&p->lock);
+		return 1;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->queued++;
+	pthread_cond_signal(&p->work);
+	pthread_mutex_unlock(&p->lock);
+
+	return 0;
+}
+
+void work_pool_wait(struct work_pool_t *p)
+{
+	pthread_mutex_lock(&p->lock);
+
+	while (p->pending)
+		pthread_cond_wait(&p->idle, &p->lock);
+
+	pthread_mutex_unlock(&p->lock);
+}
+
+void work_pool_destroy(struct work_pool_t *p)
+{
+	size_t i;
+
+	pthread_mutex_lock(&p->lock);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->lock);
+
+	for (i = 0; i < p->started; i++)
+		pthread_join(p->threads[i], NULL);
+
+	for (i = 0; p->deques && i < p->workers; i++) {
+		pthread_mutex_destroy(&p->deques[i].lock);
+		free(p->deques[i].items);
+	}
+
+	free(p->deques);
+	free(p->threads);
+	pthread_cond_destroy(&p->idle);
+	pthread_cond_destroy(&p->work);
+	pthread_mutex_destroy(&p->lock);
+}
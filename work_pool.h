@@ -0,0 +1,59 @@
+#ifndef GRAMAS_WORK_POOL_H
+#define GRAMAS_WORK_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* A fixed set of worker threads sharing out independent jobs. Every worker
+ * has its own deque: it takes the job it queued last from its own, and once
+ * that is empty steals the oldest job from someone else's, so a worker stuck
+ * on one big job does not hold up the small ones queued behind it.
+ *
+ * Jobs submitted from inside a job go on the submitting worker's deque, the
+ * rest are dealt out to the workers in turn. */
+
+struct work_item_t {
+	void (*run)(void *arg);
+	void *arg;
+};
+
+struct work_deque_t {
+	pthread_mutex_t lock;
+	struct work_item_t *items;
+	size_t capacity;
+	size_t head;
+	size_t tail;
+};
+
+struct work_pool_t {
+	struct work_deque_t *deques;
+	pthread_t *threads;
+	size_t workers;
+	size_t started;
+	size_t next;
+	void (*worker_exit)(void);
+
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t idle;
+	size_t queued;
+	size_t pending;
+	int stop;
+};
+
+/* Starts workers threads, or one per processor if workers is 0. worker_exit,
+ * if given, is called on every worker thread before it exits. Returns
+ * nonzero if not even one thread could be started. */
+int work_pool_init(struct work_pool_t *p, size_t workers, void (*worker_exit)(void));
+
+/* Queues run(arg). Returns nonzero if memory ran out. */
+int work_pool_submit(struct work_pool_t *p, void (*run)(void *), void *arg);
+
+/* Blocks until every job submitted so far, and every job those submitted,
+ * has finished. */
+void work_pool_wait(struct work_pool_t *p);
+
+/* Finishes the queued jobs and stops the workers. */
+void work_pool_destroy(struct work_pool_t *p);
+
+#endif /* GRAMAS_WORK_POOL_H */